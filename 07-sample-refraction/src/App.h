@@ -1,6 +1,7 @@
 #pragma once
 
 #include "DeviceVulkan.h"
+#include "MappedFile.h"
 #include "camera.h"
 
 
@@ -22,14 +23,40 @@ struct Mesh
 
     int materialID;
 
-    // BONI TODO: combine these into VertexBuffer
-    BufferVulkan positions;
-    BufferVulkan normals;
-    BufferVulkan uvs;
+    // Index of the mesh that owns the buffers, the CPU copies and the BLAS.
+    // This mesh itself, unless it has the same content as an earlier mesh;
+    // then only vertexCount, indexCount and materialID are set here.
+    int geometryID;
 
-    BufferVulkan indices;
+    // MeshFormatFlags (VertexFormat.h), 0 for float normals and UVs and
+    // 32 bit indices
+    uint32_t format;
+
+    // Byte offsets of the geometry in Scene::vertexBuffer, which holds one
+    // interleaved record per vertex (getVertexStride), and Scene::indexBuffer
+    uint32_t vertexOffset;
+    uint32_t indexOffset;
 
     AccelerationStructureVulkan blas;
+
+    // CPU copies of the geometry, used by the CPU raytracer: vertexCount and
+    // indexCount elements in the storage below, or in the file mapping of a
+    // cooked scene or of a .glb (null for meshes sharing another mesh's
+    // geometry).  Only
+    // one of the normal and of the UV arrays is set, depending on format.
+    const glm::vec3* positionData;
+    const glm::vec3* normalData;
+    const uint32_t* octNormalData;
+    const glm::vec2* uvData;
+    const uint32_t* halfUvData;
+    const uint32_t* indexData;
+
+    std::vector<glm::vec3> positionStorage;
+    std::vector<glm::vec3> normalStorage;
+    std::vector<uint32_t> octNormalStorage;
+    std::vector<glm::vec2> uvStorage;
+    std::vector<uint32_t> halfUvStorage;
+    std::vector<uint32_t> indexStorage;
 };
 
 // Keep this padded to 16 bytes
@@ -41,6 +68,17 @@ struct Material
     float pad[2];
 };
 
+// RGBA8, as uploaded to the GPU.  pixels points into pixelStorage, or
+// into the file mapping of a cooked scene.
+struct TextureData
+{
+    uint32_t width;
+    uint32_t height;
+    const uint8_t* pixels;
+
+    std::vector<uint8_t> pixelStorage;
+};
+
 struct CameraUniformData
 {
     glm::mat4 viewInverse;
@@ -66,6 +104,12 @@ struct SceneNode
 struct MeshInstanceData
 {
     int materialID;
+    uint32_t meshFormat; // Mesh::format
+
+    // In 32 bit words, into the vertex and index buffers
+    uint32_t vertexOffset;
+    uint32_t vertexStride;
+    uint32_t indexOffset;
 };
 
 struct Scene
@@ -74,15 +118,19 @@ struct Scene
 
     std::vector<Mesh> meshes;
 
-    std::vector<VkDescriptorBufferInfo> positionsBufferInfos;
-    std::vector<VkDescriptorBufferInfo> normalsBufferInfos;
-    std::vector<VkDescriptorBufferInfo> uvsBufferInfos;
-    std::vector<VkDescriptorBufferInfo> indicesBufferInfos;
+    // GPU geometry of every mesh, see Mesh::vertexOffset
+    BufferVulkan vertexBuffer;
+    BufferVulkan indexBuffer;
 
     std::vector<ImageVulkan> textures;
 
     std::vector<VkDescriptorImageInfo>  baseColorTextureInfos;
 
+    // CPU copies of the material and texture data
+    std::vector<Material> materials;
+    std::vector<TextureData> textureData;
+    std::vector<int> baseColorTextureIDs; // per material, -1 -> fallback white
+
     ImageVulkan fallbackTextureBlack;
     ImageVulkan fallbackTextureWhite;
 
@@ -95,6 +143,13 @@ struct Scene
     Camera camera;
 
     AccelerationStructureVulkan topLevelStruct;
+
+    // Backs the mesh and texture data of a cooked scene, not mapped otherwise
+    MappedFile cookedFile;
+
+    // Backs the mesh data read from the BIN chunk of a .glb, not mapped
+    // otherwise
+    MappedFile glbFile;
 };
 
 struct App
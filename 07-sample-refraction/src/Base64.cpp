@@ -0,0 +1,248 @@
+#include "pch.h"
+
+#include "Base64.h"
+
+// 6 bit value per character, 0xFF for anything else (including '=')
+struct Base64Table
+{
+    uint8_t values[256];
+
+    Base64Table()
+    {
+        const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        memset(values, 0xFF, sizeof(values));
+
+        for (uint8_t i = 0; i < 64; i++)
+            values[(uint8_t)alphabet[i]] = i;
+    }
+};
+
+static const Base64Table s_base64Table;
+
+// Characters before the padding, which is at most two '='.  Any more are
+// left in and fail as invalid characters.
+static size_t getBase64CharacterCount(const char* pSrc, size_t length)
+{
+    size_t padding = 0;
+
+    while (padding < 2 && length > padding && pSrc[length - 1 - padding] == '=')
+        padding++;
+
+    return length - padding;
+}
+
+size_t getBase64DecodedSize(const char* pSrc, size_t length)
+{
+    size_t characters = getBase64CharacterCount(pSrc, length);
+    size_t padding = length - characters;
+
+    // A single character left over can't encode a byte
+    if (characters % 4 == 1 || (padding > 0 && length % 4 != 0))
+        return 0;
+
+    return characters / 4 * 3 + (characters % 4 == 0 ? 0 : characters % 4 - 1);
+}
+
+// Decodes pSrc[start, length) to pDst[outStart, ...)
+static bool decodeBase64Tail(const char* pSrc, size_t start, size_t length, uint8_t* pDst, size_t outStart)
+{
+    const uint8_t* values = s_base64Table.values;
+
+    length = getBase64CharacterCount(pSrc, length);
+
+    size_t i = start;
+    size_t o = outStart;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        uint32_t a = values[(uint8_t)pSrc[i + 0]];
+        uint32_t b = values[(uint8_t)pSrc[i + 1]];
+        uint32_t c = values[(uint8_t)pSrc[i + 2]];
+        uint32_t d = values[(uint8_t)pSrc[i + 3]];
+
+        if ((a | b | c | d) & 0x80)
+            return false;
+
+        uint32_t bits = (a << 18) | (b << 12) | (c << 6) | d;
+
+        pDst[o++] = (uint8_t)(bits >> 16);
+        pDst[o++] = (uint8_t)(bits >> 8);
+        pDst[o++] = (uint8_t)bits;
+    }
+
+    // 2 or 3 characters for 1 or 2 bytes, a single one can't encode a byte
+    size_t rest = length - i;
+
+    if (rest == 1)
+        return false;
+
+    if (rest >= 2)
+    {
+        uint32_t bits = 0;
+
+        for (size_t j = 0; j < rest; j++)
+        {
+            uint32_t value = values[(uint8_t)pSrc[i + j]];
+
+            if (value & 0x80)
+                return false;
+
+            bits |= value << (18 - 6 * j);
+        }
+
+        pDst[o++] = (uint8_t)(bits >> 16);
+
+        if (rest == 3)
+            pDst[o++] = (uint8_t)(bits >> 8);
+    }
+
+    return true;
+}
+
+static bool decodeBase64Scalar(const char* pSrc, size_t length, uint8_t* pDst)
+{
+    return decodeBase64Tail(pSrc, 0, length, pDst, 0);
+}
+
+// Character to 6 bit value with nibble lookups (Mula and Lemire, "Faster
+// Base64 Encoding and Decoding using AVX2 Instructions").  The high nibble
+// picks the offset to add, the low nibble and high nibble together pick a
+// bit that is set for valid characters only.
+static __m128i translateBase64Sse(__m128i chars, __m128i* pInvalid)
+{
+    const __m128i offsets = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i validLow = _mm_setr_epi8((char)0xA8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8,
+        (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF0, 0x54, 0x50, 0x50, 0x50, 0x54);
+    const __m128i validHigh = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+        0, 0, 0, 0, 0, 0, 0, 0);
+
+    __m128i high = _mm_and_si128(_mm_srli_epi32(chars, 4), _mm_set1_epi8(0x0F));
+    __m128i low = _mm_and_si128(chars, _mm_set1_epi8(0x0F));
+
+    // '+' and '/' share the high nibble, '/' needs 16 instead of 19
+    __m128i isSlash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+    __m128i offset = _mm_add_epi8(_mm_shuffle_epi8(offsets, high), _mm_and_si128(isSlash, _mm_set1_epi8(-3)));
+
+    __m128i valid = _mm_and_si128(_mm_shuffle_epi8(validLow, low), _mm_shuffle_epi8(validHigh, high));
+    *pInvalid = _mm_or_si128(*pInvalid, _mm_cmpeq_epi8(valid, _mm_setzero_si128()));
+
+    return _mm_add_epi8(chars, offset);
+}
+
+// 16 values of 6 bits to 12 bytes in the low lanes
+static __m128i packBase64Sse(__m128i values)
+{
+    __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    __m128i quads = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+
+    return _mm_shuffle_epi8(quads, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+static bool decodeBase64Ssse3(const char* pSrc, size_t length, uint8_t* pDst)
+{
+    size_t characters = getBase64CharacterCount(pSrc, length);
+
+    __m128i invalid = _mm_setzero_si128();
+
+    size_t i = 0;
+    size_t o = 0;
+
+    // 16 byte stores of 12 bytes: 8 more characters (6 bytes) after the
+    // block keep the store inside pDst.  The rest and the padding are left
+    // to the scalar loop.
+    for (; i + 24 <= characters; i += 16, o += 12)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*)(pSrc + i));
+        _mm_storeu_si128((__m128i*)(pDst + o), packBase64Sse(translateBase64Sse(chars, &invalid)));
+    }
+
+    if (_mm_movemask_epi8(invalid))
+        return false;
+
+    return decodeBase64Tail(pSrc, i, length, pDst, o);
+}
+
+static __m256i translateBase64Avx2(__m256i chars, __m256i* pInvalid)
+{
+    const __m256i offsets = _mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i validLow = _mm256_setr_epi8((char)0xA8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8,
+        (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF0, 0x54, 0x50, 0x50, 0x50, 0x54,
+        (char)0xA8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8,
+        (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF8, (char)0xF0, 0x54, 0x50, 0x50, 0x50, 0x54);
+    const __m256i validHigh = _mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+        0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    __m256i high = _mm256_and_si256(_mm256_srli_epi32(chars, 4), _mm256_set1_epi8(0x0F));
+    __m256i low = _mm256_and_si256(chars, _mm256_set1_epi8(0x0F));
+
+    __m256i isSlash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+    __m256i offset = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, high),
+        _mm256_and_si256(isSlash, _mm256_set1_epi8(-3)));
+
+    __m256i valid = _mm256_and_si256(_mm256_shuffle_epi8(validLow, low), _mm256_shuffle_epi8(validHigh, high));
+    *pInvalid = _mm256_or_si256(*pInvalid, _mm256_cmpeq_epi8(valid, _mm256_setzero_si256()));
+
+    return _mm256_add_epi8(chars, offset);
+}
+
+// 32 values to 24 bytes in the low lanes, 12 per 128 bit half first
+static __m256i packBase64Avx2(__m256i values)
+{
+    __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    __m256i quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+
+    __m256i halves = _mm256_shuffle_epi8(quads, _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+    return _mm256_permutevar8x32_epi32(halves, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+}
+
+static bool decodeBase64Avx2(const char* pSrc, size_t length, uint8_t* pDst)
+{
+    size_t characters = getBase64CharacterCount(pSrc, length);
+
+    __m256i invalid = _mm256_setzero_si256();
+
+    size_t i = 0;
+    size_t o = 0;
+
+    // 32 byte stores of 24 bytes, 16 more characters after the block
+    for (; i + 48 <= characters; i += 32, o += 24)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*)(pSrc + i));
+        _mm256_storeu_si256((__m256i*)(pDst + o), packBase64Avx2(translateBase64Avx2(chars, &invalid)));
+    }
+
+    if (_mm256_movemask_epi8(invalid))
+        return false;
+
+    return decodeBase64Ssse3(pSrc + i, length - i, pDst + o);
+}
+
+DecodeBase64Function getDecodeBase64Function(SimdLevel level)
+{
+    // AVX2 implies SSSE3
+    if (level == SIMD_LEVEL_AVX2)
+        return decodeBase64Avx2;
+
+    if ((level == SIMD_LEVEL_SSE || level == SIMD_LEVEL_AVX) && hasSsse3())
+        return decodeBase64Ssse3;
+
+    return decodeBase64Scalar;
+}
+
+bool decodeBase64(const char* pSrc, size_t length, std::vector<uint8_t>& dst)
+{
+    static const DecodeBase64Function decode = getDecodeBase64Function(detectSimdLevel());
+
+    size_t size = getBase64DecodedSize(pSrc, length);
+
+    if (size == 0 && length > 0)
+        return false;
+
+    dst.resize(size);
+    return decode(pSrc, length, dst.data());
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "CpuFeatures.h"
+
+// Base64 (RFC 4648, '+' and '/') as in glTF data URIs, no whitespace.  The
+// SIMD kernels translate and pack 16 (SSSE3) or 32 (AVX2) characters at a
+// time and leave the rest, padding included, to the scalar loop.
+
+// Decoded size, 0 for a length that isn't a valid base64 length
+size_t getBase64DecodedSize(const char* pSrc, size_t length);
+
+// pDst holds getBase64DecodedSize() bytes.  False on invalid characters.
+typedef bool (*DecodeBase64Function)(const char* pSrc, size_t length, uint8_t* pDst);
+
+// SIMD_LEVEL_SSE and SIMD_LEVEL_AVX use the SSSE3 kernel and fall back to
+// scalar without SSSE3, the AVX2 kernel needs SIMD_LEVEL_AVX2
+DecodeBase64Function getDecodeBase64Function(SimdLevel level);
+
+// Best kernel for this CPU, resizes dst
+bool decodeBase64(const char* pSrc, size_t length, std::vector<uint8_t>& dst);
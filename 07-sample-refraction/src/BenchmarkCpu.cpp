@@ -0,0 +1,1014 @@
+#include "pch.h"
+
+#include "App.h"
+#include "logging.h"
+#include "CpuFeatures.h"
+#include "TriangleSimd.h"
+#include "WideBvhCpu.h"
+#include "JobSystem.h"
+#include "gltfLoader.h"
+#include "Base64.h"
+#include "CookedScene.h"
+#include "BenchmarkCpu.h"
+
+// Defined by tinygltf along with its implementation, not in the header
+namespace tinygltf
+{
+    std::string base64_encode(unsigned char const* bytes_to_encode, unsigned int in_len);
+    std::string base64_decode(std::string const& s);
+}
+
+typedef std::chrono::high_resolution_clock BenchmarkClock;
+
+static double elapsedMs(BenchmarkClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count();
+}
+
+// All meshes in object space, merged into one triangle soup
+struct TriangleSoup
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+static void mergeMeshes(const Scene& scene, TriangleSoup* pSoup)
+{
+    TriangleSoup& soup = *pSoup;
+
+    soup.boundsMin = glm::vec3(FLT_MAX);
+    soup.boundsMax = glm::vec3(-FLT_MAX);
+
+    for (size_t i = 0; i < scene.meshes.size(); i++)
+    {
+        const Mesh& mesh = scene.meshes[i];
+
+        // Shared geometry has no CPU copy of its own
+        if (mesh.geometryID != (int)i)
+            continue;
+
+        uint32_t baseVertex = (uint32_t)soup.positions.size();
+
+        for (uint32_t j = 0; j < mesh.vertexCount; j++)
+        {
+            const glm::vec3& p = mesh.positionData[j];
+
+            soup.positions.push_back(p);
+            soup.boundsMin = glm::min(soup.boundsMin, p);
+            soup.boundsMax = glm::max(soup.boundsMax, p);
+        }
+
+        for (uint32_t j = 0; j < mesh.indexCount; j++)
+            soup.indices.push_back(baseVertex + mesh.indexData[j]);
+    }
+}
+
+// Rays from a sphere around the bounds towards random points inside them
+static void generateRays(const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+    uint32_t count, std::vector<RayCpu>& rays)
+{
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    float radius = glm::length(boundsMax - boundsMin);
+
+    rays.resize(count);
+
+    for (auto& ray : rays)
+    {
+        glm::vec3 onSphere;
+
+        do
+        {
+            onSphere = glm::vec3(dist(rng), dist(rng), dist(rng)) * 2.f - 1.f;
+        } while (glm::dot(onSphere, onSphere) > 1.f || glm::dot(onSphere, onSphere) < 1e-4f);
+
+        glm::vec3 target = glm::mix(boundsMin, boundsMax, glm::vec3(dist(rng), dist(rng), dist(rng)));
+
+        ray.origin = center + glm::normalize(onSphere) * radius;
+        ray.direction = target - ray.origin;
+        ray.tmin = 0.f;
+        ray.tmax = FLT_MAX;
+    }
+}
+
+void benchmarkTriangleKernels(const Scene& scene)
+{
+    TriangleSoup soup;
+    mergeMeshes(scene, &soup);
+
+    uint32_t triangleCount = (uint32_t)soup.indices.size() / 3;
+
+    if (triangleCount == 0)
+    {
+        printf("No triangles\n");
+        return;
+    }
+
+    std::vector<uint32_t> primitiveIDs(triangleCount);
+
+    for (uint32_t i = 0; i < triangleCount; i++)
+        primitiveIDs[i] = i;
+
+    std::vector<TriangleBlock> blocks;
+    buildTriangleBlocks(soup.positions.data(), soup.indices.data(),
+        primitiveIDs.data(), triangleCount, blocks);
+
+    // Aim for ~50M tests per kernel
+    uint32_t rayCount = (uint32_t)std::min(std::max(50000000ull / triangleCount, 64ull), 1ull << 20);
+
+    std::vector<RayCpu> rays;
+    generateRays(soup.boundsMin, soup.boundsMax, rayCount, rays);
+
+    double tests = (double)rayCount * triangleCount;
+
+    SimdLevel bestLevel = detectSimdLevel();
+
+    printf("Triangle kernels: %u triangles (%zu blocks of %u), %u rays, best level %s\n",
+        triangleCount, blocks.size(), kTriangleBlockWidth, rayCount, getSimdLevelName(bestLevel));
+
+    // Baseline: indexed fetch per triangle, as the BVH leaves do
+    auto startTime = BenchmarkClock::now();
+
+    uint64_t hits = 0;
+    uint64_t primSum = 0;
+
+    for (auto& ray : rays)
+    {
+        HitCpu hit = {};
+        float tmax = ray.tmax;
+        bool found = false;
+
+        for (uint32_t p = 0; p < triangleCount; p++)
+        {
+            float t, u, v;
+
+            if (!intersectTriangle(ray.origin, ray.direction,
+                soup.positions[soup.indices[3 * p + 0]],
+                soup.positions[soup.indices[3 * p + 1]],
+                soup.positions[soup.indices[3 * p + 2]],
+                ray.tmin, tmax, &t, &u, &v))
+                continue;
+
+            tmax = t;
+            found = true;
+            hit.primitiveID = p;
+        }
+
+        hits += found ? 1 : 0;
+        primSum += found ? hit.primitiveID : 0;
+    }
+
+    double baselineMs = elapsedMs(startTime);
+
+    printf("  %-8s %8.1f Mtests/s/core, %llu hits, prim sum %llu\n", "indexed",
+        tests / (baselineMs * 1000.), hits, primSum);
+
+    // Precomputed records, as the BVH leaves with BvhCpuCreateInfo::triangleRecords
+    std::vector<TriangleRecord> records(triangleCount);
+
+    for (uint32_t p = 0; p < triangleCount; p++)
+    {
+        records[p] = makeTriangleRecord(
+            soup.positions[soup.indices[3 * p + 0]],
+            soup.positions[soup.indices[3 * p + 1]],
+            soup.positions[soup.indices[3 * p + 2]]);
+    }
+
+    startTime = BenchmarkClock::now();
+
+    hits = 0;
+    primSum = 0;
+
+    for (auto& ray : rays)
+    {
+        HitCpu hit = {};
+        float tmax = ray.tmax;
+        bool found = false;
+
+        for (uint32_t p = 0; p < triangleCount; p++)
+        {
+            float t, u, v;
+
+            if (!intersectTriangleRecord(ray.origin, ray.direction, records[p], ray.tmin, tmax, &t, &u, &v))
+                continue;
+
+            tmax = t;
+            found = true;
+            hit.primitiveID = p;
+        }
+
+        hits += found ? 1 : 0;
+        primSum += found ? hit.primitiveID : 0;
+    }
+
+    double recordsMs = elapsedMs(startTime);
+
+    printf("  %-8s %8.1f Mtests/s/core, %llu hits, prim sum %llu, %.2fx, %zu bytes per triangle\n", "records",
+        tests / (recordsMs * 1000.), hits, primSum, baselineMs / recordsMs, sizeof(TriangleRecord));
+
+    for (int level = SIMD_LEVEL_SCALAR; level <= bestLevel; level++)
+    {
+        IntersectTriangleBlockFunction intersect = getIntersectTriangleBlockFunction((SimdLevel)level);
+
+        // AVX2 has no kernel of its own
+        if (level > SIMD_LEVEL_SCALAR && intersect == getIntersectTriangleBlockFunction((SimdLevel)(level - 1)))
+            continue;
+
+        startTime = BenchmarkClock::now();
+
+        hits = 0;
+        primSum = 0;
+
+        for (auto& ray : rays)
+        {
+            HitCpu hit = {};
+            float tmax = ray.tmax;
+            bool found = false;
+
+            for (auto& block : blocks)
+            {
+                if (intersect(block, ray, tmax, &hit))
+                {
+                    tmax = hit.t;
+                    found = true;
+                }
+            }
+
+            hits += found ? 1 : 0;
+            primSum += found ? hit.primitiveID : 0;
+        }
+
+        double timeMs = elapsedMs(startTime);
+
+        printf("  %-8s %8.1f Mtests/s/core, %llu hits, prim sum %llu, %.2fx\n",
+            getSimdLevelName((SimdLevel)level), tests / (timeMs * 1000.),
+            hits, primSum, baselineMs / timeMs);
+    }
+}
+
+// Heightfield of (n - 1)^2 * 2 triangles over [-1, 1]^2
+static void generateTerrain(uint32_t n, TriangleSoup* pSoup)
+{
+    TriangleSoup& soup = *pSoup;
+
+    std::mt19937 rng(5678);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+
+    float phases[4] = { dist(rng), dist(rng), dist(rng), dist(rng) };
+
+    soup.positions.resize((size_t)n * n);
+    soup.indices.clear();
+    soup.indices.reserve((size_t)(n - 1) * (n - 1) * 6);
+
+    for (uint32_t y = 0; y < n; y++)
+    {
+        for (uint32_t x = 0; x < n; x++)
+        {
+            float fx = (float)x / (n - 1) * 2.f - 1.f;
+            float fz = (float)y / (n - 1) * 2.f - 1.f;
+            float h = 0.1f * sinf(7.f * fx + phases[0]) * cosf(5.f * fz + phases[1])
+                + 0.02f * sinf(41.f * fx + phases[2]) * sinf(37.f * fz + phases[3]);
+
+            soup.positions[(size_t)y * n + x] = glm::vec3(fx, h, fz);
+        }
+    }
+
+    for (uint32_t y = 0; y + 1 < n; y++)
+    {
+        for (uint32_t x = 0; x + 1 < n; x++)
+        {
+            uint32_t i = y * n + x;
+
+            soup.indices.insert(soup.indices.end(), { i, i + n, i + 1, i + 1, i + n, i + n + 1 });
+        }
+    }
+
+    soup.boundsMin = glm::vec3(-1.f, -0.12f, -1.f);
+    soup.boundsMax = glm::vec3(1.f, 0.12f, 1.f);
+}
+
+// Small randomly oriented triangles in the unit cube, a worst case for
+// overlapping bounds
+static void generateTriangleCloud(uint32_t count, TriangleSoup* pSoup)
+{
+    TriangleSoup& soup = *pSoup;
+
+    std::mt19937 rng(91011);
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
+
+    soup.positions.resize((size_t)count * 3);
+    soup.indices.resize((size_t)count * 3);
+
+    float size = 2.f / cbrtf((float)count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        glm::vec3 center(dist(rng), dist(rng), dist(rng));
+
+        for (uint32_t k = 0; k < 3; k++)
+        {
+            glm::vec3 offset = glm::vec3(dist(rng), dist(rng), dist(rng)) - 0.5f;
+            soup.positions[3 * i + k] = center + offset * size;
+            soup.indices[3 * i + k] = 3 * i + k;
+        }
+    }
+
+    soup.boundsMin = glm::vec3(-size);
+    soup.boundsMax = glm::vec3(1.f + size);
+}
+
+static void benchmarkBvhWidths(const TriangleSoup& soup, const char* name)
+{
+    uint32_t triangleCount = (uint32_t)soup.indices.size() / 3;
+
+    if (triangleCount == 0)
+        return;
+
+    BvhCpuCreateInfo bvhInfo = {};
+    bvhInfo.positions = soup.positions.data();
+    bvhInfo.vertexCount = (uint32_t)soup.positions.size();
+    bvhInfo.indices = soup.indices.data();
+    bvhInfo.indexCount = (uint32_t)soup.indices.size();
+
+    BvhCpu bvh;
+
+    if (!createBvhCpu(bvhInfo, &bvh))
+        return;
+
+    // Float and quantized child bounds for each width
+    const uint32_t kWideCount = 4;
+    WideBvhCpu wideBvhs[kWideCount];
+
+    for (uint32_t i = 0; i < kWideCount; i++)
+        createWideBvhCpu({ &bvh, i < 2 ? 4u : 8u, (i & 1) != 0 }, &wideBvhs[i]);
+
+    const uint32_t rayCount = 1 << 18;
+
+    std::vector<RayCpu> rays;
+    generateRays(soup.boundsMin, soup.boundsMax, rayCount, rays);
+
+    printf("BVH widths, %s: %u triangles, %u rays, binary build %.1f ms\n",
+        name, triangleCount, rayCount, bvh.stats.buildTimeMs);
+
+    std::vector<HitCpu> binaryHits(rayCount);
+    std::vector<uint8_t> binaryFound(rayCount);
+
+    // Second pass with precomputed triangle records in the leaves ("r"),
+    // checked against the hits of the binary BVH without.  t differs in the
+    // last bits, so coplanar triangles may swap and rays through edges may
+    // miss or hit, only t beyond the tolerance counts
+    for (int records = 0; records < 2; records++)
+    {
+        if (records)
+            computeTriangleRecords(bvh);
+
+        for (uint32_t config = 0; config <= kWideCount; config++)
+        {
+            const WideBvhCpu* pWide = config > 0 ? &wideBvhs[config - 1] : nullptr;
+
+            // Closest hit
+            auto startTime = BenchmarkClock::now();
+
+            uint64_t hits = 0;
+            uint64_t mismatches = 0;
+
+            for (uint32_t i = 0; i < rayCount; i++)
+            {
+                HitCpu hit = {};
+                bool found = pWide ? intersectWideBvhCpu(*pWide, rays[i], false, &hit) :
+                    intersectBvhCpu(bvh, rays[i], false, &hit);
+
+                hits += found ? 1 : 0;
+
+                if (!pWide && !records)
+                {
+                    binaryHits[i] = hit;
+                    binaryFound[i] = found;
+                }
+                else if (found != (binaryFound[i] != 0) ||
+                    (found && (records ? fabsf(hit.t - binaryHits[i].t) > 1e-4f * binaryHits[i].t : hit.t != binaryHits[i].t)))
+                {
+                    mismatches++;
+                }
+            }
+
+            double closestMs = elapsedMs(startTime);
+
+            // Occlusion
+            startTime = BenchmarkClock::now();
+
+            uint64_t occluded = 0;
+
+            for (auto& ray : rays)
+                occluded += (pWide ? occludedWideBvhCpu(*pWide, ray) : occludedBvhCpu(bvh, ray)) ? 1 : 0;
+
+            double occludedMs = elapsedMs(startTime);
+
+            uint32_t nodeCount = pWide ? pWide->stats.nodeCount : bvh.stats.nodeCount;
+            size_t memoryBytes = (pWide ? pWide->stats.memoryBytes :
+                bvh.nodeCount * sizeof(BvhNode) + bvh.stats.referenceCount * sizeof(uint32_t)) +
+                bvh.stats.triangleRecordBytes;
+
+            size_t nodeSize = !pWide ? sizeof(BvhNode) :
+                pWide->quantized ? (pWide->width == 8 ? sizeof(QuantizedBvhNode<8>) : sizeof(QuantizedBvhNode<4>)) :
+                (pWide->width == 8 ? sizeof(WideBvhNode<8>) : sizeof(WideBvhNode<4>));
+
+            printf("  BVH%u%s%s %8u nodes of %3zu B, %5.1f B/tri, closest %6.2f Mrays/s, occlusion %6.2f Mrays/s, "
+                "%llu hits, %llu occluded, %llu mismatches\n",
+                pWide ? pWide->width : 2, pWide && pWide->quantized ? "q" : " ", records ? "r" : " ", nodeCount, nodeSize,
+                (double)memoryBytes / triangleCount,
+                rayCount / (closestMs * 1000.), rayCount / (occludedMs * 1000.),
+                hits, occluded, mismatches);
+        }
+    }
+
+    for (auto& wideBvh : wideBvhs)
+        destroyWideBvhCpu(wideBvh);
+
+    destroyBvhCpu(bvh);
+}
+
+void benchmarkWideBvh(const Scene& scene)
+{
+    TriangleSoup soup;
+
+    mergeMeshes(scene, &soup);
+    benchmarkBvhWidths(soup, "scene");
+
+    // ~1M triangles each
+    generateTerrain(708, &soup);
+    benchmarkBvhWidths(soup, "terrain");
+
+    generateTriangleCloud(1 << 20, &soup);
+    benchmarkBvhWidths(soup, "cloud");
+}
+
+static void benchmarkBuildModes(const TriangleSoup& soup, const char* name, JobSystem& js)
+{
+    uint32_t triangleCount = (uint32_t)soup.indices.size() / 3;
+
+    if (triangleCount == 0)
+        return;
+
+    const uint32_t rayCount = 1 << 16;
+
+    std::vector<RayCpu> rays;
+    generateRays(soup.boundsMin, soup.boundsMax, rayCount, rays);
+
+    printf("BVH builds, %s: %u triangles, %u threads, %u rays\n", name, triangleCount, js.threadCount, rayCount);
+
+    for (int mode = 0; mode < BVH_BUILD_MODE_COUNT; mode++)
+    {
+        BvhCpuCreateInfo bvhInfo = {};
+        bvhInfo.positions = soup.positions.data();
+        bvhInfo.vertexCount = (uint32_t)soup.positions.size();
+        bvhInfo.indices = soup.indices.data();
+        bvhInfo.indexCount = (uint32_t)soup.indices.size();
+        bvhInfo.mode = (BvhBuildMode)mode;
+        bvhInfo.pJobSystem = &js;
+
+        BvhCpu bvh;
+
+        if (!createBvhCpu(bvhInfo, &bvh))
+            continue;
+
+        auto startTime = BenchmarkClock::now();
+
+        uint64_t hits = 0;
+
+        for (auto& ray : rays)
+        {
+            HitCpu hit;
+            hits += intersectBvhCpu(bvh, ray, false, &hit) ? 1 : 0;
+        }
+
+        double traceMs = elapsedMs(startTime);
+
+        // Separate pass so the counting doesn't skew the timing
+        BvhTraversalStats steps = {};
+
+        for (auto& ray : rays)
+        {
+            HitCpu hit;
+            intersectBvhCpu(bvh, ray, false, &hit, &steps);
+        }
+
+        printf("  %-10s build %9.1f ms, SAH %7.2f, depth %2u, refs %5.2fx, closest %6.2f Mrays/s, "
+            "%5.1f nodes %5.1f tris per ray, %llu hits\n",
+            getBvhBuildModeName((BvhBuildMode)mode), bvh.stats.buildTimeMs, bvh.stats.sahCost,
+            bvh.stats.maxDepth, (float)bvh.stats.referenceCount / triangleCount, rayCount / (traceMs * 1000.),
+            (double)steps.nodeVisits / rayCount, (double)steps.primTests / rayCount, hits);
+
+        destroyBvhCpu(bvh);
+    }
+}
+
+void benchmarkBvhBuild(const Scene& scene, JobSystem& js)
+{
+    TriangleSoup soup;
+
+    mergeMeshes(scene, &soup);
+    benchmarkBuildModes(soup, "scene", js);
+
+    generateTerrain(708, &soup);
+    benchmarkBuildModes(soup, "terrain", js);
+
+    generateTriangleCloud(1 << 20, &soup);
+    benchmarkBuildModes(soup, "cloud", js);
+}
+
+// Moves the vertices of soup for frameCount frames, refitting one BVH and
+// rebuilding another each frame.  The velocities are either a smooth swirl
+// (the mesh deforms, neighbours stay together) or random per triangle (the
+// triangles scatter, which makes the refit tree go stale).
+static void benchmarkRefitFrames(TriangleSoup& soup, const char* name, uint32_t frameCount, float speed,
+    bool scatter)
+{
+    uint32_t triangleCount = (uint32_t)soup.indices.size() / 3;
+
+    if (triangleCount == 0)
+        return;
+
+    std::mt19937 rng(4321);
+    std::uniform_real_distribution<float> dist(-1.f, 1.f);
+
+    glm::vec3 center = (soup.boundsMin + soup.boundsMax) * 0.5f;
+    float invSize = 1.f / glm::length(soup.boundsMax - soup.boundsMin);
+
+    std::vector<glm::vec3> velocities(soup.positions.size());
+
+    for (size_t i = 0; i < soup.positions.size(); i++)
+    {
+        glm::vec3 p = (soup.positions[i] - center) * invSize;
+        velocities[i] = glm::vec3(sinf(6.f * p.z), 0.5f * cosf(6.f * p.x), -sinf(6.f * p.y)) * speed;
+    }
+
+    if (scatter)
+    {
+        for (uint32_t i = 0; i < triangleCount; i++)
+        {
+            glm::vec3 v = glm::vec3(dist(rng), dist(rng), dist(rng)) * speed;
+
+            for (uint32_t k = 0; k < 3; k++)
+                velocities[soup.indices[3 * i + k]] = v;
+        }
+    }
+
+    BvhCpuCreateInfo bvhInfo = {};
+    bvhInfo.positions = soup.positions.data();
+    bvhInfo.vertexCount = (uint32_t)soup.positions.size();
+    bvhInfo.indices = soup.indices.data();
+    bvhInfo.indexCount = (uint32_t)soup.indices.size();
+
+    BvhCpu refitBvh;
+
+    if (!createBvhCpu(bvhInfo, &refitBvh))
+        return;
+
+    const uint32_t rayCount = 1 << 15;
+
+    printf("BVH refit, %s: %u triangles, %u rays, build %.1f ms, rebuild past %.2fx SAH\n",
+        name, triangleCount, rayCount, refitBvh.stats.buildTimeMs, kBvhRebuildSahRatio);
+
+    auto traceRate = [&](const BvhCpu& bvh, const std::vector<RayCpu>& rays) {
+        auto startTime = BenchmarkClock::now();
+
+        for (auto& ray : rays)
+        {
+            HitCpu hit;
+            intersectBvhCpu(bvh, ray, false, &hit);
+        }
+
+        return rays.size() / (elapsedMs(startTime) * 1000.);
+    };
+
+    for (uint32_t frame = 1; frame <= frameCount; frame++)
+    {
+        glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+        glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+
+        for (size_t i = 0; i < soup.positions.size(); i++)
+        {
+            soup.positions[i] += velocities[i];
+            boundsMin = glm::min(boundsMin, soup.positions[i]);
+            boundsMax = glm::max(boundsMax, soup.positions[i]);
+        }
+
+        auto startTime = BenchmarkClock::now();
+        refitBvhCpu(refitBvh, soup.positions.data(), nullptr);
+        double refitMs = elapsedMs(startTime);
+
+        BvhCpu rebuiltBvh;
+
+        if (!createBvhCpu(bvhInfo, &rebuiltBvh))
+            break;
+
+        std::vector<RayCpu> rays;
+        generateRays(boundsMin, boundsMax, rayCount, rays);
+
+        const BvhBuildStats& stats = refitBvh.stats;
+
+        printf("  frame %2u: refit %7.2f ms, SAH %7.2f (%.2fx build, %.2fx rebuild)%s, %6.2f Mrays/s | "
+            "rebuild %8.1f ms, SAH %7.2f, %6.2f Mrays/s\n",
+            frame, refitMs, stats.sahCost, stats.sahCost / stats.builtSahCost,
+            stats.sahCost / rebuiltBvh.stats.sahCost,
+            shouldRebuildBvhCpu(refitBvh, 0.f) ? " -> rebuild" : "",
+            traceRate(refitBvh, rays), rebuiltBvh.stats.buildTimeMs, rebuiltBvh.stats.sahCost,
+            traceRate(rebuiltBvh, rays));
+
+        destroyBvhCpu(rebuiltBvh);
+    }
+
+    destroyBvhCpu(refitBvh);
+}
+
+void benchmarkBvhRefit(const Scene& scene)
+{
+    TriangleSoup soup;
+
+    mergeMeshes(scene, &soup);
+    benchmarkRefitFrames(soup, "scene", 8, 0.01f * glm::length(soup.boundsMax - soup.boundsMin), false);
+
+    generateTerrain(512, &soup);
+    benchmarkRefitFrames(soup, "terrain", 8, 0.01f, false);
+
+    generateTriangleCloud(1 << 18, &soup);
+    benchmarkRefitFrames(soup, "cloud", 8, 0.02f, true);
+}
+
+// Median of a few loads without a device, so parsing and the CPU copies
+static double timeSceneLoad(const char* filename, uint32_t runCount, JobSystem* pJobSystem)
+{
+    DeviceVulkan vk = {};
+    std::vector<double> times;
+
+    for (uint32_t run = 0; run < runCount; run++)
+    {
+        Scene scene = {};
+
+        auto startTime = BenchmarkClock::now();
+
+        if (!loadGltfFile(vk, filename, { pJobSystem, false }, &scene))
+            return -1.;
+
+        times.push_back(elapsedMs(startTime));
+
+        unmapFile(scene.cookedFile);
+        unmapFile(scene.glbFile);
+    }
+
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+static size_t getFileSize(const char* filename)
+{
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    return file ? (size_t)file.tellg() : 0;
+}
+
+// One thread, then the job system
+static double printSceneLoad(const char* filename, uint32_t runCount, JobSystem& js)
+{
+    double serialMs = timeSceneLoad(filename, runCount, nullptr);
+    double parallelMs = timeSceneLoad(filename, runCount, &js);
+
+    if (serialMs < 0. || parallelMs < 0.)
+        return -1.;
+
+    printf("Scene load, %s: %.1f KB, %.2f ms on 1 thread, %.2f ms on %u threads (%.2fx, median of %u)\n",
+        filename, getFileSize(filename) / 1024., serialMs, parallelMs, js.threadCount, serialMs / parallelMs,
+        runCount);
+
+    return parallelMs;
+}
+
+// The scene loaded from filename, cooked to cookedFilename
+static bool writeCookedSceneFrom(const char* filename, const char* cookedFilename, JobSystem& js)
+{
+    DeviceVulkan vk = {};
+    Scene scene = {};
+
+    if (!loadGltfFile(vk, filename, { &js, false }, &scene))
+        return false;
+
+    bool ok = writeCookedScene(cookedFilename, scene);
+    unmapFile(scene.cookedFile);
+    unmapFile(scene.glbFile);
+
+    return ok;
+}
+
+// The .glb and cooked copies of filename, written to directory
+static void printConvertedSceneLoads(const char* filename, double loadMs, uint32_t runCount,
+    const std::filesystem::path& directory, JobSystem& js)
+{
+    std::string baseName = std::filesystem::path(filename).stem().string();
+    std::string glbFilename = (directory / (baseName + ".glb")).string();
+    std::string cookedFilename = (directory / (baseName + kCookedSceneExtension)).string();
+
+    if (!writeGlbFile(filename, glbFilename.c_str()))
+        return;
+
+    double glbLoadMs = printSceneLoad(glbFilename.c_str(), runCount, js);
+
+    if (glbLoadMs < 0.)
+        return;
+
+    printf("  .glb vs .gltf: %.2fx\n", loadMs / glbLoadMs);
+
+    if (!writeCookedSceneFrom(filename, cookedFilename.c_str(), js))
+        return;
+
+    double cookedLoadMs = printSceneLoad(cookedFilename.c_str(), runCount, js);
+
+    if (cookedLoadMs < 0.)
+        return;
+
+    printf("  cooked vs .gltf: %.2fx, vs .glb: %.2fx\n", loadMs / cookedLoadMs, glbLoadMs / cookedLoadMs);
+}
+
+void benchmarkSceneLoad(const char* filename, JobSystem& js)
+{
+    const uint32_t kRunCount = 10;
+
+    double loadMs = printSceneLoad(filename, kRunCount, js);
+
+    if (loadMs < 0. || std::filesystem::path(filename).extension() != ".gltf")
+        return;
+
+    // Same scene as .glb and cooked, in a directory of its own under the
+    // temp directory, removed afterwards
+    std::error_code ec;
+    std::filesystem::path directory = std::filesystem::temp_directory_path(ec);
+
+    if (ec)
+        return;
+
+    directory /= "sample-refraction-scene-load";
+    std::filesystem::create_directories(directory, ec);
+
+    if (!ec)
+        printConvertedSceneLoads(filename, loadMs, kRunCount, directory, js);
+
+    std::filesystem::remove_all(directory, ec);
+}
+
+static size_t getPeakWorkingSet()
+{
+    PROCESS_MEMORY_COUNTERS counters = { sizeof(counters) };
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+    return counters.PeakWorkingSetSize;
+}
+
+static size_t getWorkingSet()
+{
+    PROCESS_MEMORY_COUNTERS counters = { sizeof(counters) };
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+    return counters.WorkingSetSize;
+}
+
+// One load without a device.  The peak working set never goes down, so
+// the growth of the peak is only seen when it goes past earlier loads:
+// the streaming parser runs first.
+static bool printGltfParse(const char* filename, bool streaming, JobSystem& js)
+{
+    DeviceVulkan vk = {};
+    Scene scene = {};
+
+    size_t startBytes = getWorkingSet();
+    auto startTime = BenchmarkClock::now();
+
+    if (!loadGltfFile(vk, filename, { &js, streaming }, &scene))
+        return false;
+
+    double ms = elapsedMs(startTime);
+    size_t peakBytes = getPeakWorkingSet();
+
+    printf("  %-10s %8.2f ms, peak working set +%.1f MB, %zu nodes\n", streaming ? "streaming" : "tinygltf",
+        ms, (peakBytes > startBytes ? peakBytes - startBytes : 0) / (1024. * 1024.), scene.nodes.size());
+
+    unmapFile(scene.glbFile);
+
+    return true;
+}
+
+// The scene with nodeCount more nodes, instances of its mesh nodes spread
+// along x, written to directory with copies of the buffer and image files
+// it refers to, so their relative paths still work
+static std::string writeManyNodesScene(const char* filename, uint32_t nodeCount,
+    const std::filesystem::path& directory)
+{
+    std::ifstream in(filename, std::ios::binary);
+    nlohmann::json json = nlohmann::json::parse(in, nullptr, false);
+
+    if (json.is_discarded() || !json.contains("nodes") || !json.contains("scenes"))
+        return std::string();
+
+    auto& nodes = json["nodes"];
+    auto& rootNodes = json["scenes"][json.value("scene", 0)]["nodes"];
+
+    std::vector<nlohmann::json> meshNodes;
+
+    for (auto& node : nodes)
+    {
+        if (node.contains("mesh"))
+            meshNodes.push_back(node);
+    }
+
+    if (meshNodes.empty())
+        return std::string();
+
+    for (uint32_t i = 0; i < nodeCount; i++)
+    {
+        nlohmann::json node = meshNodes[i % meshNodes.size()];
+        node["name"] = "instance" + std::to_string(i);
+        node["translation"] = { 3. * (i + 1), 0., 0. };
+        node.erase("matrix");
+
+        rootNodes.push_back(nodes.size());
+        nodes.push_back(std::move(node));
+    }
+
+    std::filesystem::path sourceDirectory = std::filesystem::path(filename).parent_path();
+
+    for (const char* section : { "buffers", "images" })
+    {
+        if (!json.contains(section))
+            continue;
+
+        for (auto& item : json[section])
+        {
+            std::string uri = item.value("uri", std::string());
+
+            if (uri.empty() || uri.compare(0, 5, "data:") == 0)
+                continue;
+
+            std::filesystem::path target = directory / uri;
+            std::error_code ec;
+
+            std::filesystem::create_directories(target.parent_path(), ec);
+            std::filesystem::copy_file(sourceDirectory / uri, target,
+                std::filesystem::copy_options::overwrite_existing, ec);
+
+            if (ec)
+            {
+                printf("Could not copy %s: %s\n", uri.c_str(), ec.message().c_str());
+                return std::string();
+            }
+        }
+    }
+
+    std::filesystem::path outPath = directory /
+        (std::filesystem::path(filename).stem().string() + "-" + std::to_string(nodeCount) + "-nodes.gltf");
+
+    std::ofstream out(outPath, std::ios::binary);
+    out << json.dump();
+
+    return out ? outPath.string() : std::string();
+}
+
+void benchmarkGltfParse(const char* filename, JobSystem& js)
+{
+    const uint32_t kExtraNodeCount = 100000;
+
+    printf("glTF parse, %s: %.1f KB\n", filename, getFileSize(filename) / 1024.);
+
+    if (!printGltfParse(filename, true, js) || !printGltfParse(filename, false, js))
+        return;
+
+    // In a directory of its own under the temp directory, removed afterwards
+    std::error_code ec;
+    std::filesystem::path directory = std::filesystem::temp_directory_path(ec);
+
+    if (ec)
+        return;
+
+    directory /= "sample-refraction-gltf-parse";
+    std::filesystem::create_directories(directory, ec);
+
+    std::string manyNodesFilename = ec ? std::string() : writeManyNodesScene(filename, kExtraNodeCount, directory);
+
+    if (!manyNodesFilename.empty())
+    {
+        printf("glTF parse, %s: %.1f KB\n", manyNodesFilename.c_str(),
+            getFileSize(manyNodesFilename.c_str()) / 1024.);
+
+        printGltfParse(manyNodesFilename.c_str(), true, js);
+        printGltfParse(manyNodesFilename.c_str(), false, js);
+    }
+
+    std::filesystem::remove_all(directory, ec);
+}
+
+// Best of a few runs, in GB/s of input
+template <typename Decode>
+static double timeBase64Decode(size_t length, uint32_t runCount, Decode decode)
+{
+    double bestMs = 0.;
+
+    for (uint32_t run = 0; run < runCount; run++)
+    {
+        auto startTime = BenchmarkClock::now();
+
+        if (!decode())
+            return -1.;
+
+        double ms = elapsedMs(startTime);
+
+        if (run == 0 || ms < bestMs)
+            bestMs = ms;
+    }
+
+    return length / (bestMs * 1e6);
+}
+
+static void benchmarkBase64Decoders(const std::string& text, const char* name)
+{
+    const uint32_t kRunCount = 10;
+
+    size_t size = getBase64DecodedSize(text.data(), text.size());
+
+    if (size == 0)
+        return;
+
+    printf("Base64 decode, %s: %.1f KB\n", name, text.size() / 1024.);
+
+    std::vector<uint8_t> expected;
+    decodeBase64(text.data(), text.size(), expected);
+
+    double rate = timeBase64Decode(text.size(), kRunCount, [&text]() {
+        return !tinygltf::base64_decode(text).empty();
+    });
+
+    printf("  %-10s %6.2f GB/s\n", "tinygltf", rate);
+
+    double tinygltfRate = rate;
+    SimdLevel maxLevel = detectSimdLevel();
+
+    std::vector<uint8_t> decoded(size);
+
+    for (uint32_t level = SIMD_LEVEL_SCALAR; level <= (uint32_t)maxLevel; level++)
+    {
+        DecodeBase64Function decode = getDecodeBase64Function((SimdLevel)level);
+
+        // AVX has no kernel of its own
+        if (level > SIMD_LEVEL_SCALAR && decode == getDecodeBase64Function((SimdLevel)(level - 1)))
+            continue;
+
+        rate = timeBase64Decode(text.size(), kRunCount, [&]() {
+            return decode(text.data(), text.size(), decoded.data());
+        });
+
+        bool match = decoded == expected;
+
+        printf("  %-10s %6.2f GB/s, %.1fx%s\n", getSimdLevelName((SimdLevel)level), rate, rate / tinygltfRate,
+            match ? "" : " (MISMATCH)");
+    }
+}
+
+void benchmarkBase64(const char* filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    nlohmann::json json = nlohmann::json::parse(in, nullptr, false);
+
+    if (!json.is_discarded() && json.contains("buffers"))
+    {
+        // All data URI payloads back to back, each cut to whole groups of 4
+        // characters so the result decodes as one
+        std::string text;
+
+        for (auto& buffer : json["buffers"])
+        {
+            std::string uri = buffer.value("uri", std::string());
+            size_t comma = uri.find(',');
+
+            if (uri.compare(0, 5, "data:") != 0 || comma == std::string::npos)
+                continue;
+
+            size_t length = uri.find('=', comma + 1);
+
+            if (length == std::string::npos)
+                length = uri.size();
+
+            text.append(uri, comma + 1, (length - comma - 1) & ~(size_t)3);
+        }
+
+        benchmarkBase64Decoders(text, filename);
+    }
+
+    std::mt19937 rng(1);
+    std::vector<uint8_t> bytes(16 << 20);
+
+    for (auto& b : bytes)
+        b = (uint8_t)rng();
+
+    benchmarkBase64Decoders(tinygltf::base64_encode(bytes.data(), (unsigned int)bytes.size()), "random");
+}
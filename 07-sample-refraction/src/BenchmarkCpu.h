@@ -0,0 +1,40 @@
+#pragma once
+
+// Microbenchmarks for the CPU raytracer building blocks, run with
+// --benchmark <name>.  Results go to stdout.
+
+struct JobSystem;
+
+// Ray vs triangle throughput of the scalar and SIMD kernels over all
+// triangles of the scene, single threaded.
+void benchmarkTriangleKernels(const Scene& scene);
+
+// Binary vs 4 and 8 wide BVH traversal (closest hit and occlusion), with
+// float and quantized child bounds, on the scene and on generated ~1M
+// triangle scenes, single threaded.
+void benchmarkWideBvh(const Scene& scene);
+
+// Build time, SAH cost and trace speed of each BvhBuildMode, on the scene
+// and on the generated scenes.  LBVH builds use the job system.
+void benchmarkBvhBuild(const Scene& scene, JobSystem& js);
+
+// Refit vs rebuild of a BVH over triangles moving a little every frame:
+// time, SAH cost growth and trace speed, on the scene and on the generated
+// scenes.  Single threaded.
+void benchmarkBvhRefit(const Scene& scene);
+
+// Load time of the scene file and, for a .gltf, of the same scene written
+// as .glb and as a cooked scene to the temp directory.  No device, so
+// parsing (or mapping) and CPU copies.
+// Each file is loaded on one thread and on the job system.
+void benchmarkSceneLoad(const char* filename, JobSystem& js);
+
+// Load time and peak working set growth of the streaming glTF parser and of
+// tinygltf, on the scene and on a copy with 100k more nodes written next to
+// it.  No device.
+void benchmarkGltfParse(const char* filename, JobSystem& js);
+
+// Base64 decode throughput in GB/s of base64 input: tinygltf's decoder
+// against the scalar, SSSE3 and AVX2 decoders, on the data URI buffers of
+// the scene file and on 16 MB of random bytes.  Single threaded.
+void benchmarkBase64(const char* filename);
@@ -0,0 +1,249 @@
+#include "pch.h"
+
+#include "logging.h"
+#include "Hash.h"
+#include "BvhCache.h"
+
+const uint32_t kBvhCacheMagic = 0x48564242; // "BBVH"
+
+const uint64_t kBvhCacheAlignment = 64;
+
+struct BvhCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+
+    uint32_t nodeCount;
+    uint32_t referenceCount;
+
+    // From the start of the file
+    uint64_t nodesOffset;
+    uint64_t primIndicesOffset;
+
+    BvhBuildStats stats;
+};
+
+// Build settings as hashed, zeroed first so the padding is stable
+struct BvhCacheSettings
+{
+    uint32_t version;
+    uint32_t nodeSize;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+
+    uint32_t binCount;
+    uint32_t maxLeafSize;
+    float traversalCost;
+
+    uint32_t mode;
+    float splitBudget;
+    uint64_t maxMemoryBytes;
+};
+
+static uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + kBvhCacheAlignment - 1) & ~(kBvhCacheAlignment - 1);
+}
+
+static void getCacheFilename(const char* directory, uint64_t key, char* filename, size_t size)
+{
+    snprintf(filename, size, "%s/%016llx.bvh", directory, (unsigned long long)key);
+}
+
+uint64_t getBvhCacheKey(const BvhCpuCreateInfo& ci)
+{
+    BvhCacheSettings settings;
+    memset(&settings, 0, sizeof(settings));
+
+    settings.version = kBvhCacheVersion;
+    settings.nodeSize = sizeof(BvhNode);
+    settings.vertexCount = ci.vertexCount;
+    settings.indexCount = ci.indexCount;
+    settings.binCount = ci.binCount;
+    settings.maxLeafSize = ci.maxLeafSize;
+    settings.traversalCost = ci.traversalCost;
+    settings.mode = ci.mode;
+
+    if (ci.mode == BVH_BUILD_SBVH)
+    {
+        settings.splitBudget = ci.splitBudget;
+        settings.maxMemoryBytes = ci.maxMemoryBytes;
+    }
+
+    uint64_t key = hashBytes(&settings, sizeof(settings), 0);
+    key = hashBytes(ci.positions, ci.vertexCount * sizeof(glm::vec3), key);
+    key = hashBytes(ci.indices, ci.indexCount * sizeof(uint32_t), key);
+
+    return key;
+}
+
+// Everything traversal and computeTriangleRecords() read without checks:
+// children after their parent (no cycles) and within kMaxBvhDepth, leaf
+// ranges within primIndices, triangles within the index buffer
+static bool isValidBvhCacheData(const BvhCacheHeader& header, const uint8_t* pData, uint32_t indexCount)
+{
+    const BvhNode* nodes = (const BvhNode*)(pData + header.nodesOffset);
+    const uint32_t* primIndices = (const uint32_t*)(pData + header.primIndicesOffset);
+
+    std::vector<uint8_t> depths(header.nodeCount, 0);
+
+    for (uint32_t n = 0; n < header.nodeCount; n++)
+    {
+        const BvhNode& node = nodes[n];
+
+        if (node.primCount > 0)
+        {
+            if (node.offset > header.referenceCount || node.primCount > header.referenceCount - node.offset)
+                return false;
+
+            continue;
+        }
+
+        if (node.offset <= n + 1 || node.offset >= header.nodeCount || depths[n] + 1 >= (int)kMaxBvhDepth)
+            return false;
+
+        uint8_t childDepth = depths[n] + 1;
+        depths[n + 1] = std::max(depths[n + 1], childDepth);
+        depths[node.offset] = std::max(depths[node.offset], childDepth);
+    }
+
+    for (uint32_t i = 0; i < header.referenceCount; i++)
+    {
+        if (primIndices[i] >= indexCount / 3)
+            return false;
+    }
+
+    return true;
+}
+
+bool loadBvhCache(const char* directory, const BvhCpuCreateInfo& ci, BvhCpu* pBvh)
+{
+    // Box BVHs are cheap to build and change with every instance transform
+    if (ci.primBounds)
+        return false;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    uint64_t key = getBvhCacheKey(ci);
+
+    char filename[512];
+    getCacheFilename(directory, key, filename, sizeof(filename));
+
+    MappedFile file;
+
+    if (!mapFile(filename, &file))
+        return false;
+
+    BvhCacheHeader header;
+
+    bool valid = file.size >= sizeof(header);
+
+    if (valid)
+    {
+        memcpy(&header, file.pData, sizeof(header));
+
+        uint64_t nodesSize = (uint64_t)header.nodeCount * sizeof(BvhNode);
+        uint64_t primIndicesSize = (uint64_t)header.referenceCount * sizeof(uint32_t);
+
+        // Offsets are checked before adding the sizes, so they can't wrap
+        valid = header.magic == kBvhCacheMagic && header.version == kBvhCacheVersion && header.key == key &&
+            header.nodeCount > 0 && header.stats.referenceCount == header.referenceCount &&
+            header.nodesOffset % kBvhCacheAlignment == 0 &&
+            header.primIndicesOffset % kBvhCacheAlignment == 0 &&
+            header.nodesOffset <= file.size && nodesSize <= file.size - header.nodesOffset &&
+            header.primIndicesOffset <= file.size && primIndicesSize <= file.size - header.primIndicesOffset;
+
+        valid = valid && isValidBvhCacheData(header, file.pData, ci.indexCount);
+    }
+
+    if (!valid)
+    {
+        DebugPrint("BVH cache: ignoring %s\n", filename);
+        unmapFile(file);
+        return false;
+    }
+
+    BvhCpu& bvh = *pBvh;
+
+    bvh.nodes.clear();
+    bvh.primIndices.clear();
+    bvh.pNodes = (const BvhNode*)(file.pData + header.nodesOffset);
+    bvh.pPrimIndices = (const uint32_t*)(file.pData + header.primIndicesOffset);
+    bvh.nodeCount = header.nodeCount;
+    bvh.mappedFile = file;
+    bvh.positions = ci.positions;
+    bvh.indices = ci.indices;
+    bvh.traversalCost = ci.traversalCost > 0.f ? ci.traversalCost : 1.f;
+    bvh.stats = header.stats;
+
+    // Derived from the positions, not stored
+    bvh.triangleRecords.clear();
+    bvh.stats.triangleRecordBytes = 0;
+
+    if (ci.triangleRecords)
+        computeTriangleRecords(bvh);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    bvh.stats.buildTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+    return true;
+}
+
+bool saveBvhCache(const char* directory, const BvhCpuCreateInfo& ci, const BvhCpu& bvh)
+{
+    if (ci.primBounds || bvh.nodeCount == 0)
+        return false;
+
+    CreateDirectoryA(directory, nullptr);
+
+    BvhCacheHeader header = {};
+    header.magic = kBvhCacheMagic;
+    header.version = kBvhCacheVersion;
+    header.key = getBvhCacheKey(ci);
+    header.nodeCount = bvh.nodeCount;
+    header.referenceCount = bvh.stats.referenceCount;
+    header.nodesOffset = alignOffset(sizeof(header));
+    header.primIndicesOffset = alignOffset(header.nodesOffset + (uint64_t)header.nodeCount * sizeof(BvhNode));
+    header.stats = bvh.stats;
+
+    char filename[512];
+    getCacheFilename(directory, header.key, filename, sizeof(filename));
+
+    // Written under a temporary name so a crash never leaves a truncated
+    // file under the real one.  Per thread, meshes can share a key.
+    char tempFilename[540];
+    snprintf(tempFilename, sizeof(tempFilename), "%s.%lu.tmp", filename, (unsigned long)GetCurrentThreadId());
+
+    std::ofstream file(tempFilename, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!file.is_open())
+    {
+        DebugPrint("BVH cache: could not write %s\n", tempFilename);
+        return false;
+    }
+
+    static const char padding[kBvhCacheAlignment] = {};
+
+    uint64_t nodesEnd = header.nodesOffset + (uint64_t)header.nodeCount * sizeof(BvhNode);
+
+    file.write((const char*)&header, sizeof(header));
+    file.write(padding, header.nodesOffset - sizeof(header));
+    file.write((const char*)bvh.pNodes, (uint64_t)header.nodeCount * sizeof(BvhNode));
+    file.write(padding, header.primIndicesOffset - nodesEnd);
+    file.write((const char*)bvh.pPrimIndices, (uint64_t)header.referenceCount * sizeof(uint32_t));
+    file.close();
+
+    bool res = !file.fail();
+
+    // Replaces a stale file of the same key
+    res = res && MoveFileExA(tempFilename, filename, MOVEFILE_REPLACE_EXISTING);
+
+    if (!res)
+    {
+        DebugPrint("BVH cache: could not write %s\n", filename);
+        remove(tempFilename);
+    }
+
+    return res;
+}
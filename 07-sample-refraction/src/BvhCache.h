@@ -0,0 +1,25 @@
+#pragma once
+
+#include "BvhCpu.h"
+
+// On-disk cache of triangle BVHs, one file per BVH in a cache directory,
+// named after a hash of the positions, the indices and the build settings.
+// A load maps the file and points the BvhCpu at the nodes and primIndices
+// in it, so nothing is rebuilt or copied.
+//
+// File: BvhCacheHeader, then the nodes and the primIndices, both 64 byte
+// aligned.  Files from another version, whose key doesn't match or whose
+// nodes and indices don't form a valid BVH over the mesh are ignored (and
+// overwritten by the next save).
+
+const uint32_t kBvhCacheVersion = 2;
+
+// Hash of everything createBvhCpu(ci) depends on (not pJobSystem)
+uint64_t getBvhCacheKey(const BvhCpuCreateInfo& ci);
+
+// Maps the cached BVH for ci into *pBvh.  False if there is none or it's
+// stale, *pBvh is untouched then.
+bool loadBvhCache(const char* directory, const BvhCpuCreateInfo& ci, BvhCpu* pBvh);
+
+// Writes bvh, built with ci.  Creates the directory if needed.
+bool saveBvhCache(const char* directory, const BvhCpuCreateInfo& ci, const BvhCpu& bvh);
@@ -0,0 +1,1449 @@
+#include "pch.h"
+
+#include "logging.h"
+#include "JobSystem.h"
+#include "BvhCpu.h"
+
+const uint32_t kMaxBinCount = 64;
+
+struct Aabb
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+static Aabb emptyAabb()
+{
+    return { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+}
+
+static void growAabb(Aabb& a, const glm::vec3& p)
+{
+    a.min = glm::min(a.min, p);
+    a.max = glm::max(a.max, p);
+}
+
+static void growAabb(Aabb& a, const Aabb& b)
+{
+    a.min = glm::min(a.min, b.min);
+    a.max = glm::max(a.max, b.max);
+}
+
+static float aabbArea(const Aabb& a)
+{
+    glm::vec3 e = a.max - a.min;
+
+    if (e.x < 0.f)
+        return 0.f;
+
+    return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+struct BuildBin
+{
+    Aabb bounds;
+    uint32_t count;
+};
+
+struct BuildContext
+{
+    std::vector<Aabb> primBounds;
+    std::vector<glm::vec3> centroids;
+
+    uint32_t binCount;
+    uint32_t maxLeafSize;
+    float traversalCost;
+
+    BvhCpu* pBvh;
+};
+
+// Binned SAH over count items, getBounds(i) / getCentroid(i) access item i.
+// Returns false if no split is better than a leaf (or possible at all).
+// pLeftBounds/pRightBounds receive the bounds of the two sides.
+template <typename GetBounds, typename GetCentroid>
+static bool findBinnedSplit(uint32_t count, const GetBounds& getBounds, const GetCentroid& getCentroid,
+    uint32_t binCount, float traversalCost, const Aabb& bounds, const Aabb& centroidBounds,
+    int* pAxis, uint32_t* pBin, float* pCost, Aabb* pLeftBounds = nullptr, Aabb* pRightBounds = nullptr)
+{
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    uint32_t bestBin = 0;
+
+    float invArea = 1.f / std::max(aabbArea(bounds), FLT_MIN);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float cmin = centroidBounds.min[axis];
+        float extent = centroidBounds.max[axis] - cmin;
+
+        if (extent <= 0.f)
+            continue;
+
+        float scale = binCount * (1.f - 1e-6f) / extent;
+
+        BuildBin bins[kMaxBinCount];
+
+        for (uint32_t b = 0; b < binCount; b++)
+            bins[b] = { emptyAabb(), 0 };
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            uint32_t b = std::min(binCount - 1,
+                (uint32_t)((getCentroid(i)[axis] - cmin) * scale));
+
+            growAabb(bins[b].bounds, getBounds(i));
+            bins[b].count++;
+        }
+
+        // Sweep from the right, then from the left
+        Aabb rightBounds[kMaxBinCount];
+        uint32_t rightCount[kMaxBinCount];
+
+        Aabb acc = emptyAabb();
+        uint32_t accCount = 0;
+
+        for (uint32_t b = binCount - 1; b > 0; b--)
+        {
+            growAabb(acc, bins[b].bounds);
+            accCount += bins[b].count;
+
+            rightBounds[b] = acc;
+            rightCount[b] = accCount;
+        }
+
+        acc = emptyAabb();
+        accCount = 0;
+
+        for (uint32_t b = 0; b < binCount - 1; b++)
+        {
+            growAabb(acc, bins[b].bounds);
+            accCount += bins[b].count;
+
+            if (accCount == 0 || rightCount[b + 1] == 0)
+                continue;
+
+            float cost = traversalCost +
+                (aabbArea(acc) * accCount + aabbArea(rightBounds[b + 1]) * rightCount[b + 1]) * invArea;
+
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = b;
+
+                if (pLeftBounds)
+                {
+                    *pLeftBounds = acc;
+                    *pRightBounds = rightBounds[b + 1];
+                }
+            }
+        }
+    }
+
+    *pAxis = bestAxis;
+    *pBin = bestBin;
+    *pCost = bestCost;
+
+    return bestAxis >= 0;
+}
+
+static bool findSplit(const BuildContext& ctx, uint32_t begin, uint32_t end,
+    const Aabb& bounds, const Aabb& centroidBounds,
+    int* pAxis, uint32_t* pBin, float* pCost)
+{
+    const uint32_t* primIndices = ctx.pBvh->primIndices.data() + begin;
+
+    return findBinnedSplit(end - begin,
+        [&](uint32_t i) -> const Aabb& { return ctx.primBounds[primIndices[i]]; },
+        [&](uint32_t i) -> const glm::vec3& { return ctx.centroids[primIndices[i]]; },
+        ctx.binCount, ctx.traversalCost, bounds, centroidBounds, pAxis, pBin, pCost);
+}
+
+// Appends the subtree over primIndices [begin, end) to nodes, child indices
+// are relative to nodes.  Subtrees over disjoint ranges can be built in
+// parallel.
+static uint32_t buildNode(BuildContext& ctx, std::vector<BvhNode>& nodes,
+    uint32_t begin, uint32_t end, uint32_t depth, uint32_t* pMaxDepth)
+{
+    BvhCpu& bvh = *ctx.pBvh;
+    uint32_t* primIndices = bvh.primIndices.data();
+
+    uint32_t nodeIndex = (uint32_t)nodes.size();
+    nodes.push_back({});
+
+    Aabb bounds = emptyAabb();
+    Aabb centroidBounds = emptyAabb();
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+        growAabb(bounds, ctx.primBounds[primIndices[i]]);
+        growAabb(centroidBounds, ctx.centroids[primIndices[i]]);
+    }
+
+    nodes[nodeIndex].boundsMin = bounds.min;
+    nodes[nodeIndex].boundsMax = bounds.max;
+
+    uint32_t count = end - begin;
+
+    *pMaxDepth = std::max(*pMaxDepth, depth);
+
+    int axis = -1;
+    uint32_t bin = 0;
+    float splitCost = FLT_MAX;
+
+    bool canSplit = count > 1 && depth + 1 < kMaxBvhDepth;
+
+    if (canSplit)
+        findSplit(ctx, begin, end, bounds, centroidBounds, &axis, &bin, &splitCost);
+
+    // Leaf cost is one triangle test per primitive
+    float leafCost = (float)count;
+
+    bool makeLeaf = !canSplit ||
+        (count <= ctx.maxLeafSize && (axis < 0 || leafCost <= splitCost));
+
+    if (makeLeaf)
+    {
+        nodes[nodeIndex].primCount = count;
+        nodes[nodeIndex].offset = begin;
+        return nodeIndex;
+    }
+
+    uint32_t mid = begin;
+
+    if (axis >= 0)
+    {
+        float cmin = centroidBounds.min[axis];
+        float extent = centroidBounds.max[axis] - cmin;
+        float scale = ctx.binCount * (1.f - 1e-6f) / extent;
+
+        uint32_t* it = std::partition(primIndices + begin, primIndices + end, [&](uint32_t prim) {
+            uint32_t b = std::min(ctx.binCount - 1,
+                (uint32_t)((ctx.centroids[prim][axis] - cmin) * scale));
+            return b <= bin;
+        });
+
+        mid = (uint32_t)(it - primIndices);
+    }
+
+    // All centroids in the same spot (or too many primitives for a leaf),
+    // split in the middle.
+    if (mid == begin || mid == end)
+        mid = begin + count / 2;
+
+    buildNode(ctx, nodes, begin, mid, depth + 1, pMaxDepth);
+    uint32_t right = buildNode(ctx, nodes, mid, end, depth + 1, pMaxDepth);
+
+    nodes[nodeIndex].primCount = 0;
+    nodes[nodeIndex].offset = right;
+
+    return nodeIndex;
+}
+
+static void computeStats(BvhCpu& bvh, float traversalCost)
+{
+    BvhBuildStats& stats = bvh.stats;
+
+    stats.nodeCount = (uint32_t)bvh.nodes.size();
+    stats.referenceCount = (uint32_t)bvh.primIndices.size();
+    stats.leafCount = 0;
+    stats.maxLeafPrims = 0;
+    stats.sahCost = 0.f;
+
+    Aabb root = { bvh.nodes[0].boundsMin, bvh.nodes[0].boundsMax };
+    float invRootArea = 1.f / std::max(aabbArea(root), FLT_MIN);
+
+    for (auto& node : bvh.nodes)
+    {
+        float area = aabbArea({ node.boundsMin, node.boundsMax }) * invRootArea;
+
+        if (node.primCount > 0)
+        {
+            stats.leafCount++;
+            stats.maxLeafPrims = std::max(stats.maxLeafPrims, node.primCount);
+            stats.sahCost += area * node.primCount;
+        }
+        else
+        {
+            stats.sahCost += area * traversalCost;
+        }
+    }
+
+    stats.avgLeafPrims = stats.leafCount > 0 ? (float)stats.referenceCount / stats.leafCount : 0.f;
+}
+
+// SBVH (Stich et al. 2009): binned SAH where a node may also be split at a
+// plane that cuts triangles, with the straddling references clipped to
+// both sides.  Only tried where the best object split leaves the children
+// overlapping, and only while the reference budget lasts.
+
+const uint32_t kSpatialBinCount = 32;
+
+// Spatial splits are only tried if the object split children overlap by
+// more than this fraction of the root area
+const float kSpatialSplitAlpha = 1e-5f;
+
+struct BuildReference
+{
+    Aabb bounds; // clipped triangle bounds
+    uint32_t prim;
+};
+
+struct SpatialBin
+{
+    Aabb bounds;
+    uint32_t enter;
+    uint32_t exit;
+};
+
+struct SpatialContext
+{
+    BuildContext* pBuild;
+
+    const glm::vec3* positions;
+    const uint32_t* indices;
+
+    float minOverlapArea;
+    uint32_t maxReferences;
+    uint32_t referenceCount;
+};
+
+static Aabb overlapAabb(const Aabb& a, const Aabb& b)
+{
+    return { glm::max(a.min, b.min), glm::min(a.max, b.max) };
+}
+
+static bool validAabb(const Aabb& a)
+{
+    return a.min.x <= a.max.x && a.min.y <= a.max.y && a.min.z <= a.max.z;
+}
+
+// Bounds of the parts of the triangle on each side of the plane, within the
+// reference's current bounds
+static void splitReference(const SpatialContext& sc, const BuildReference& ref, int axis, float plane,
+    BuildReference* pLeft, BuildReference* pRight)
+{
+    Aabb left = emptyAabb();
+    Aabb right = emptyAabb();
+
+    glm::vec3 v[3] = {
+        sc.positions[sc.indices[3 * ref.prim + 0]],
+        sc.positions[sc.indices[3 * ref.prim + 1]],
+        sc.positions[sc.indices[3 * ref.prim + 2]],
+    };
+
+    for (int i = 0; i < 3; i++)
+    {
+        const glm::vec3& a = v[i];
+        const glm::vec3& b = v[(i + 1) % 3];
+
+        if (a[axis] <= plane)
+            growAabb(left, a);
+
+        if (a[axis] >= plane)
+            growAabb(right, a);
+
+        if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane))
+        {
+            float t = (plane - a[axis]) / (b[axis] - a[axis]);
+
+            glm::vec3 p = a + (b - a) * t;
+            p[axis] = plane;
+
+            growAabb(left, p);
+            growAabb(right, p);
+        }
+    }
+
+    *pLeft = { overlapAabb(left, ref.bounds), ref.prim };
+    *pRight = { overlapAabb(right, ref.bounds), ref.prim };
+}
+
+static bool findSpatialSplit(const SpatialContext& sc, const std::vector<BuildReference>& refs,
+    const Aabb& bounds, int* pAxis, float* pPlane, float* pCost)
+{
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    float bestPlane = 0.f;
+
+    float invArea = 1.f / std::max(aabbArea(bounds), FLT_MIN);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float origin = bounds.min[axis];
+        float extent = bounds.max[axis] - origin;
+
+        if (extent <= 0.f)
+            continue;
+
+        float binSize = extent / kSpatialBinCount;
+        float invBinSize = 1.f / binSize;
+
+        SpatialBin bins[kSpatialBinCount];
+
+        for (auto& bin : bins)
+            bin = { emptyAabb(), 0, 0 };
+
+        // Chop each reference into the bins it spans
+        for (auto& ref : refs)
+        {
+            uint32_t first = std::min(kSpatialBinCount - 1,
+                (uint32_t)std::max((ref.bounds.min[axis] - origin) * invBinSize, 0.f));
+            uint32_t last = std::min(kSpatialBinCount - 1,
+                (uint32_t)std::max((ref.bounds.max[axis] - origin) * invBinSize, 0.f));
+
+            last = std::max(first, last);
+
+            BuildReference rest = ref;
+
+            for (uint32_t b = first; b < last; b++)
+            {
+                BuildReference left, right;
+                splitReference(sc, rest, axis, origin + binSize * (b + 1), &left, &right);
+
+                if (validAabb(left.bounds))
+                    growAabb(bins[b].bounds, left.bounds);
+
+                rest = right;
+            }
+
+            if (validAabb(rest.bounds))
+                growAabb(bins[last].bounds, rest.bounds);
+
+            bins[first].enter++;
+            bins[last].exit++;
+        }
+
+        float rightArea[kSpatialBinCount];
+        uint32_t rightCount[kSpatialBinCount];
+
+        Aabb acc = emptyAabb();
+        uint32_t count = 0;
+
+        for (uint32_t b = kSpatialBinCount - 1; b > 0; b--)
+        {
+            growAabb(acc, bins[b].bounds);
+            count += bins[b].exit;
+
+            rightArea[b] = aabbArea(acc);
+            rightCount[b] = count;
+        }
+
+        acc = emptyAabb();
+        count = 0;
+
+        for (uint32_t b = 0; b < kSpatialBinCount - 1; b++)
+        {
+            growAabb(acc, bins[b].bounds);
+            count += bins[b].enter;
+
+            if (count == 0 || rightCount[b + 1] == 0)
+                continue;
+
+            float cost = sc.pBuild->traversalCost +
+                (aabbArea(acc) * count + rightArea[b + 1] * rightCount[b + 1]) * invArea;
+
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestPlane = origin + binSize * (b + 1);
+            }
+        }
+    }
+
+    *pAxis = bestAxis;
+    *pPlane = bestPlane;
+    *pCost = bestCost;
+
+    return bestAxis >= 0;
+}
+
+// Splits refs (emptied) into left and right at the plane.  Returns false,
+// leaving refs alone, if a side would be empty or the budget runs out.
+static bool partitionSpatial(SpatialContext& sc, std::vector<BuildReference>& refs, int axis, float plane,
+    std::vector<BuildReference>& leftRefs, std::vector<BuildReference>& rightRefs)
+{
+    uint32_t straddling = 0;
+    uint32_t leftCount = 0;
+    uint32_t rightCount = 0;
+
+    for (auto& ref : refs)
+    {
+        if (ref.bounds.max[axis] <= plane)
+            leftCount++;
+        else if (ref.bounds.min[axis] >= plane)
+            rightCount++;
+        else
+            straddling++;
+    }
+
+    if (sc.referenceCount + straddling > sc.maxReferences ||
+        leftCount + straddling == 0 || rightCount + straddling == 0)
+        return false;
+
+    for (auto& ref : refs)
+    {
+        if (ref.bounds.max[axis] <= plane)
+        {
+            leftRefs.push_back(ref);
+        }
+        else if (ref.bounds.min[axis] >= plane)
+        {
+            rightRefs.push_back(ref);
+        }
+        else
+        {
+            BuildReference left, right;
+            splitReference(sc, ref, axis, plane, &left, &right);
+
+            bool leftValid = validAabb(left.bounds);
+            bool rightValid = validAabb(right.bounds);
+
+            if (leftValid)
+                leftRefs.push_back(left);
+
+            if (rightValid)
+                rightRefs.push_back(right);
+
+            if (leftValid && rightValid)
+                sc.referenceCount++;
+            else if (!leftValid && !rightValid)
+                leftRefs.push_back(ref);
+        }
+    }
+
+    if (leftRefs.empty() || rightRefs.empty())
+    {
+        leftRefs.clear();
+        rightRefs.clear();
+        return false;
+    }
+
+    refs.clear();
+    refs.shrink_to_fit();
+
+    return true;
+}
+
+static uint32_t buildSpatialNode(SpatialContext& sc, std::vector<BuildReference>& refs, uint32_t depth)
+{
+    BuildContext& ctx = *sc.pBuild;
+    BvhCpu& bvh = *ctx.pBvh;
+
+    uint32_t nodeIndex = (uint32_t)bvh.nodes.size();
+    bvh.nodes.push_back({});
+
+    Aabb bounds = emptyAabb();
+    Aabb centroidBounds = emptyAabb();
+
+    for (auto& ref : refs)
+    {
+        growAabb(bounds, ref.bounds);
+        growAabb(centroidBounds, (ref.bounds.min + ref.bounds.max) * 0.5f);
+    }
+
+    bvh.nodes[nodeIndex].boundsMin = bounds.min;
+    bvh.nodes[nodeIndex].boundsMax = bounds.max;
+
+    uint32_t count = (uint32_t)refs.size();
+
+    bvh.stats.maxDepth = std::max(bvh.stats.maxDepth, depth);
+
+    bool canSplit = count > 1 && depth + 1 < kMaxBvhDepth;
+
+    int axis = -1;
+    uint32_t bin = 0;
+    float splitCost = FLT_MAX;
+    Aabb leftBounds, rightBounds;
+
+    if (canSplit)
+    {
+        findBinnedSplit(count,
+            [&](uint32_t i) -> const Aabb& { return refs[i].bounds; },
+            [&](uint32_t i) { return (refs[i].bounds.min + refs[i].bounds.max) * 0.5f; },
+            ctx.binCount, ctx.traversalCost, bounds, centroidBounds, &axis, &bin, &splitCost,
+            &leftBounds, &rightBounds);
+    }
+
+    std::vector<BuildReference> leftRefs;
+    std::vector<BuildReference> rightRefs;
+
+    float leafCost = (float)count;
+
+    // Spatial split if the object split children overlap.  Nodes that may
+    // become leaves only split when that beats the leaf, so no references
+    // are duplicated for nothing.
+    bool spatial = false;
+    float spatialCost = FLT_MAX;
+
+    if (canSplit && sc.referenceCount < sc.maxReferences)
+    {
+        Aabb overlap = axis >= 0 ? overlapAabb(leftBounds, rightBounds) : bounds;
+
+        if (validAabb(overlap) && aabbArea(overlap) > sc.minOverlapArea)
+        {
+            int spatialAxis;
+            float plane, cost;
+
+            if (findSpatialSplit(sc, refs, bounds, &spatialAxis, &plane, &cost) &&
+                cost < splitCost && (count > ctx.maxLeafSize || cost < leafCost))
+            {
+                spatial = partitionSpatial(sc, refs, spatialAxis, plane, leftRefs, rightRefs);
+
+                if (spatial)
+                    spatialCost = cost;
+            }
+        }
+    }
+
+    bool makeLeaf = !spatial && (!canSplit ||
+        (count <= ctx.maxLeafSize && (axis < 0 || leafCost <= std::min(splitCost, spatialCost))));
+
+    if (makeLeaf)
+    {
+        bvh.nodes[nodeIndex].primCount = count;
+        bvh.nodes[nodeIndex].offset = (uint32_t)bvh.primIndices.size();
+
+        for (auto& ref : refs)
+            bvh.primIndices.push_back(ref.prim);
+
+        return nodeIndex;
+    }
+
+    if (!spatial)
+    {
+        if (axis >= 0)
+        {
+            float cmin = centroidBounds.min[axis];
+            float scale = ctx.binCount * (1.f - 1e-6f) / (centroidBounds.max[axis] - cmin);
+
+            for (auto& ref : refs)
+            {
+                float centroid = (ref.bounds.min[axis] + ref.bounds.max[axis]) * 0.5f;
+                uint32_t b = std::min(ctx.binCount - 1, (uint32_t)((centroid - cmin) * scale));
+
+                (b <= bin ? leftRefs : rightRefs).push_back(ref);
+            }
+        }
+
+        // All centroids in the same spot, split in the middle
+        if (leftRefs.empty() || rightRefs.empty())
+        {
+            leftRefs.assign(refs.begin(), refs.begin() + count / 2);
+            rightRefs.assign(refs.begin() + count / 2, refs.end());
+        }
+
+        refs.clear();
+        refs.shrink_to_fit();
+    }
+
+    buildSpatialNode(sc, leftRefs, depth + 1);
+    uint32_t right = buildSpatialNode(sc, rightRefs, depth + 1);
+
+    bvh.nodes[nodeIndex].primCount = 0;
+    bvh.nodes[nodeIndex].offset = right;
+
+    return nodeIndex;
+}
+
+static void buildSbvh(BuildContext& ctx, const BvhCpuCreateInfo& ci)
+{
+    BvhCpu& bvh = *ctx.pBvh;
+    uint32_t primCount = bvh.stats.primCount;
+
+    SpatialContext sc;
+    sc.pBuild = &ctx;
+    sc.positions = ci.positions;
+    sc.indices = ci.indices;
+    sc.referenceCount = primCount;
+
+    float splitBudget = ci.splitBudget > 0.f ? ci.splitBudget : 0.5f;
+    sc.maxReferences = primCount + (uint32_t)(primCount * splitBudget);
+
+    // Worst case of the finished BVH is two nodes and one index per reference
+    if (ci.maxMemoryBytes > 0)
+    {
+        size_t bytesPerReference = 2 * sizeof(BvhNode) + sizeof(uint32_t);
+        sc.maxReferences = std::max(primCount,
+            (uint32_t)std::min<size_t>(sc.maxReferences, ci.maxMemoryBytes / bytesPerReference));
+    }
+
+    std::vector<BuildReference> refs(primCount);
+    Aabb rootBounds = emptyAabb();
+
+    for (uint32_t i = 0; i < primCount; i++)
+    {
+        refs[i] = { ctx.primBounds[i], i };
+        growAabb(rootBounds, ctx.primBounds[i]);
+    }
+
+    sc.minOverlapArea = kSpatialSplitAlpha * aabbArea(rootBounds);
+
+    bvh.primIndices.clear();
+    bvh.primIndices.reserve(sc.maxReferences);
+    bvh.nodes.reserve(2 * (size_t)primCount);
+
+    buildSpatialNode(sc, refs, 0);
+
+    bvh.primIndices.shrink_to_fit();
+}
+
+// LBVH.  Primitives are sorted by the 30 bit Morton code of their centroid,
+// then ranges are split where the highest differing bit changes.  The top
+// of the hierarchy is split on the calling thread, the subtrees below it are
+// independent jobs and get copied into depth first order at the end.
+
+const uint32_t kLbvhChunkSize = 16384;
+
+// fn(chunk, begin, end) over [0, count) in chunks of kLbvhChunkSize
+template <typename Function>
+static void forEachChunk(JobSystem* pJobSystem, uint32_t count, const Function& fn)
+{
+    uint32_t chunkCount = (count + kLbvhChunkSize - 1) / kLbvhChunkSize;
+
+    auto job = [&](uint32_t chunk, uint32_t) {
+        uint32_t begin = chunk * kLbvhChunkSize;
+        fn(chunk, begin, std::min(begin + kLbvhChunkSize, count));
+    };
+
+    if (pJobSystem)
+    {
+        parallelFor(*pJobSystem, chunkCount, job);
+    }
+    else
+    {
+        for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+            job(chunk, 0);
+    }
+}
+
+// 10 bits to every third bit
+static uint32_t expandBits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// Stable LSD radix sort of the codes, 8 bits per pass, values move along.
+// Each chunk counts its digits, then scatters to its own offsets.
+static void radixSortCodes(JobSystem* pJobSystem, std::vector<uint32_t>& codes, std::vector<uint32_t>& values)
+{
+    uint32_t count = (uint32_t)codes.size();
+    uint32_t chunkCount = (count + kLbvhChunkSize - 1) / kLbvhChunkSize;
+
+    std::vector<uint32_t> sortedCodes(count);
+    std::vector<uint32_t> sortedValues(count);
+    std::vector<uint32_t> offsets(chunkCount * 256);
+
+    for (uint32_t shift = 0; shift < 32; shift += 8)
+    {
+        forEachChunk(pJobSystem, count, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+            uint32_t* histogram = &offsets[chunk * 256];
+            memset(histogram, 0, 256 * sizeof(uint32_t));
+
+            for (uint32_t i = begin; i < end; i++)
+                histogram[(codes[i] >> shift) & 0xFF]++;
+        });
+
+        // Digit major, chunk minor
+        uint32_t sum = 0;
+
+        for (uint32_t digit = 0; digit < 256; digit++)
+        {
+            for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+            {
+                uint32_t digitCount = offsets[chunk * 256 + digit];
+                offsets[chunk * 256 + digit] = sum;
+                sum += digitCount;
+            }
+        }
+
+        forEachChunk(pJobSystem, count, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+            uint32_t* chunkOffsets = &offsets[chunk * 256];
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                uint32_t dst = chunkOffsets[(codes[i] >> shift) & 0xFF]++;
+                sortedCodes[dst] = codes[i];
+                sortedValues[dst] = values[i];
+            }
+        });
+
+        codes.swap(sortedCodes);
+        values.swap(sortedValues);
+    }
+}
+
+// First index of the upper half of [begin, end)
+static uint32_t findMortonSplit(const uint32_t* codes, uint32_t begin, uint32_t end)
+{
+    uint32_t first = codes[begin];
+    uint32_t last = codes[end - 1];
+
+    if (first == last)
+        return begin + (end - begin) / 2;
+
+    unsigned long bit;
+    _BitScanReverse(&bit, first ^ last);
+
+    // All codes in the range share the bits above, so the ones without the
+    // bit come first
+    const uint32_t* split = std::partition_point(codes + begin, codes + end,
+        [&](uint32_t code) { return (code & (1u << bit)) == 0; });
+
+    return (uint32_t)(split - codes);
+}
+
+struct LbvhTopNode
+{
+    uint32_t left;
+    uint32_t right;
+    int task; // >= 0: subtree built by a job
+};
+
+struct LbvhTask
+{
+    uint32_t begin;
+    uint32_t end;
+    uint32_t depth;
+
+    std::vector<BvhNode> nodes;
+    uint32_t maxDepth;
+};
+
+struct LbvhContext
+{
+    BuildContext* pBuild;
+    BvhBuildMode mode;
+
+    const uint32_t* codes;
+    uint32_t taskSize;
+
+    std::vector<LbvhTopNode> topNodes;
+    std::vector<LbvhTask> tasks;
+    uint32_t topDepth;
+};
+
+static uint32_t splitTop(LbvhContext& lc, uint32_t begin, uint32_t end, uint32_t depth)
+{
+    uint32_t topIndex = (uint32_t)lc.topNodes.size();
+    lc.topNodes.push_back({ 0, 0, -1 });
+
+    lc.topDepth = std::max(lc.topDepth, depth);
+
+    if (end - begin <= lc.taskSize || depth + 1 >= kMaxBvhDepth / 2)
+    {
+        lc.topNodes[topIndex].task = (int)lc.tasks.size();
+        lc.tasks.push_back({ begin, end, depth });
+        return topIndex;
+    }
+
+    uint32_t mid = findMortonSplit(lc.codes, begin, end);
+
+    uint32_t left = splitTop(lc, begin, mid, depth + 1);
+    uint32_t right = splitTop(lc, mid, end, depth + 1);
+
+    lc.topNodes[topIndex].left = left;
+    lc.topNodes[topIndex].right = right;
+
+    return topIndex;
+}
+
+static uint32_t buildLbvhNode(const LbvhContext& lc, std::vector<BvhNode>& nodes,
+    uint32_t begin, uint32_t end, uint32_t depth, uint32_t* pMaxDepth)
+{
+    BuildContext& ctx = *lc.pBuild;
+    uint32_t count = end - begin;
+
+    if (lc.mode == BVH_BUILD_LBVH_SAH && count <= kLbvhRefineSize)
+        return buildNode(ctx, nodes, begin, end, depth, pMaxDepth);
+
+    uint32_t nodeIndex = (uint32_t)nodes.size();
+    nodes.push_back({});
+
+    *pMaxDepth = std::max(*pMaxDepth, depth);
+
+    if (count <= ctx.maxLeafSize || depth + 1 >= kMaxBvhDepth)
+    {
+        const uint32_t* primIndices = ctx.pBvh->primIndices.data();
+
+        Aabb bounds = emptyAabb();
+
+        for (uint32_t i = begin; i < end; i++)
+            growAabb(bounds, ctx.primBounds[primIndices[i]]);
+
+        nodes[nodeIndex] = { bounds.min, count, bounds.max, begin };
+
+        return nodeIndex;
+    }
+
+    uint32_t mid = findMortonSplit(lc.codes, begin, end);
+
+    uint32_t left = buildLbvhNode(lc, nodes, begin, mid, depth + 1, pMaxDepth);
+    uint32_t right = buildLbvhNode(lc, nodes, mid, end, depth + 1, pMaxDepth);
+
+    nodes[nodeIndex].boundsMin = glm::min(nodes[left].boundsMin, nodes[right].boundsMin);
+    nodes[nodeIndex].boundsMax = glm::max(nodes[left].boundsMax, nodes[right].boundsMax);
+    nodes[nodeIndex].primCount = 0;
+    nodes[nodeIndex].offset = right;
+
+    return nodeIndex;
+}
+
+// Depth first copy of the top nodes and the subtrees into nodes
+static uint32_t emitLbvhNode(LbvhContext& lc, uint32_t topIndex, std::vector<BvhNode>& nodes)
+{
+    const LbvhTopNode& top = lc.topNodes[topIndex];
+
+    uint32_t nodeIndex = (uint32_t)nodes.size();
+
+    if (top.task >= 0)
+    {
+        for (const BvhNode& node : lc.tasks[top.task].nodes)
+        {
+            nodes.push_back(node);
+
+            if (node.primCount == 0)
+                nodes.back().offset += nodeIndex;
+        }
+
+        return nodeIndex;
+    }
+
+    nodes.push_back({});
+
+    uint32_t left = emitLbvhNode(lc, top.left, nodes);
+    uint32_t right = emitLbvhNode(lc, top.right, nodes);
+
+    nodes[nodeIndex].boundsMin = glm::min(nodes[left].boundsMin, nodes[right].boundsMin);
+    nodes[nodeIndex].boundsMax = glm::max(nodes[left].boundsMax, nodes[right].boundsMax);
+    nodes[nodeIndex].primCount = 0;
+    nodes[nodeIndex].offset = right;
+
+    return nodeIndex;
+}
+
+static void buildLbvh(BuildContext& ctx, BvhBuildMode mode, JobSystem* pJobSystem)
+{
+    BvhCpu& bvh = *ctx.pBvh;
+    uint32_t primCount = bvh.stats.primCount;
+    uint32_t chunkCount = (primCount + kLbvhChunkSize - 1) / kLbvhChunkSize;
+
+    // Morton codes on a 1024^3 grid over the centroid bounds
+    std::vector<Aabb> chunkBounds(chunkCount, emptyAabb());
+
+    forEachChunk(pJobSystem, primCount, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+            growAabb(chunkBounds[chunk], ctx.centroids[i]);
+    });
+
+    Aabb centroidBounds = emptyAabb();
+
+    for (auto& b : chunkBounds)
+        growAabb(centroidBounds, b);
+
+    glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+    glm::vec3 scale;
+
+    for (int axis = 0; axis < 3; axis++)
+        scale[axis] = extent[axis] > 0.f ? 1023.f / extent[axis] : 0.f;
+
+    std::vector<uint32_t> codes(primCount);
+
+    forEachChunk(pJobSystem, primCount, [&](uint32_t, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            glm::vec3 p = (ctx.centroids[i] - centroidBounds.min) * scale;
+
+            codes[i] = expandBits((uint32_t)p.x) | (expandBits((uint32_t)p.y) << 1) |
+                (expandBits((uint32_t)p.z) << 2);
+        }
+    });
+
+    radixSortCodes(pJobSystem, codes, bvh.primIndices);
+
+    // Enough subtrees for the job system to balance them
+    uint32_t threadCount = pJobSystem ? pJobSystem->threadCount : 1;
+
+    LbvhContext lc;
+    lc.pBuild = &ctx;
+    lc.mode = mode;
+    lc.codes = codes.data();
+    lc.taskSize = std::max(primCount / (threadCount * 8), 4096u);
+    lc.topDepth = 0;
+
+    splitTop(lc, 0, primCount, 0);
+
+    auto buildTask = [&](uint32_t taskIndex, uint32_t) {
+        LbvhTask& task = lc.tasks[taskIndex];
+
+        task.maxDepth = 0;
+        task.nodes.reserve(2 * (task.end - task.begin));
+
+        buildLbvhNode(lc, task.nodes, task.begin, task.end, task.depth, &task.maxDepth);
+    };
+
+    if (pJobSystem)
+    {
+        parallelFor(*pJobSystem, (uint32_t)lc.tasks.size(), buildTask);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < (uint32_t)lc.tasks.size(); i++)
+            buildTask(i, 0);
+    }
+
+    size_t nodeCount = lc.topNodes.size();
+    bvh.stats.maxDepth = lc.topDepth;
+
+    for (auto& task : lc.tasks)
+    {
+        nodeCount += task.nodes.size();
+        bvh.stats.maxDepth = std::max(bvh.stats.maxDepth, task.maxDepth);
+    }
+
+    bvh.nodes.reserve(nodeCount);
+
+    emitLbvhNode(lc, 0, bvh.nodes);
+}
+
+bool createBvhCpu(const BvhCpuCreateInfo& ci, BvhCpu* pBvh)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    BvhCpu& bvh = *pBvh;
+
+    bvh.nodes.clear();
+    bvh.primIndices.clear();
+    bvh.pNodes = nullptr;
+    bvh.pPrimIndices = nullptr;
+    bvh.nodeCount = 0;
+    bvh.mappedFile = {};
+    bvh.triangleRecords.clear();
+    bvh.positions = ci.primBounds ? nullptr : ci.positions;
+    bvh.indices = ci.primBounds ? nullptr : ci.indices;
+    bvh.traversalCost = ci.traversalCost > 0.f ? ci.traversalCost : 1.f;
+    bvh.stats = {};
+
+    uint32_t primCount = ci.primBounds ? ci.primCount : ci.indexCount / 3;
+    bvh.stats.primCount = primCount;
+
+    if (primCount == 0)
+        return false;
+
+    BuildContext ctx;
+    ctx.binCount = ci.binCount > 0 ? std::min(ci.binCount, kMaxBinCount) : 32;
+    ctx.maxLeafSize = ci.maxLeafSize > 0 ? ci.maxLeafSize : 8;
+    ctx.traversalCost = bvh.traversalCost;
+    ctx.pBvh = &bvh;
+
+    BASSERT(ctx.binCount >= 2);
+
+    // Spatial splits need triangles
+    BvhBuildMode mode = ci.mode == BVH_BUILD_SBVH && ci.primBounds ? BVH_BUILD_BINNED_SAH : ci.mode;
+
+    // Binned SAH and SBVH stay on the calling thread
+    bool lbvh = mode == BVH_BUILD_LBVH || mode == BVH_BUILD_LBVH_SAH;
+    JobSystem* pJobSystem = lbvh ? ci.pJobSystem : nullptr;
+
+    ctx.primBounds.resize(primCount);
+    ctx.centroids.resize(primCount);
+    bvh.primIndices.resize(primCount);
+
+    forEachChunk(pJobSystem, primCount, [&](uint32_t, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            Aabb& b = ctx.primBounds[i];
+
+            if (ci.primBounds)
+            {
+                b.min = ci.primBounds[2 * i + 0];
+                b.max = ci.primBounds[2 * i + 1];
+            }
+            else
+            {
+                b = emptyAabb();
+                growAabb(b, ci.positions[ci.indices[3 * i + 0]]);
+                growAabb(b, ci.positions[ci.indices[3 * i + 1]]);
+                growAabb(b, ci.positions[ci.indices[3 * i + 2]]);
+            }
+
+            ctx.centroids[i] = (b.min + b.max) * 0.5f;
+            bvh.primIndices[i] = i;
+        }
+    });
+
+    if (lbvh)
+    {
+        buildLbvh(ctx, mode, pJobSystem);
+    }
+    else if (mode == BVH_BUILD_SBVH)
+    {
+        buildSbvh(ctx, ci);
+    }
+    else
+    {
+        // Worst case is one leaf per primitive
+        bvh.nodes.reserve(2 * primCount - 1);
+
+        buildNode(ctx, bvh.nodes, 0, primCount, 0, &bvh.stats.maxDepth);
+    }
+
+    bvh.nodes.shrink_to_fit();
+
+    bvh.pNodes = bvh.nodes.data();
+    bvh.pPrimIndices = bvh.primIndices.data();
+    bvh.nodeCount = (uint32_t)bvh.nodes.size();
+
+    computeStats(bvh, ctx.traversalCost);
+
+    bvh.stats.builtSahCost = bvh.stats.sahCost;
+    bvh.stats.refitCount = 0;
+
+    if (ci.triangleRecords && !ci.primBounds)
+        computeTriangleRecords(bvh);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    bvh.stats.buildTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+    return true;
+}
+
+void destroyBvhCpu(BvhCpu& bvh)
+{
+    unmapFile(bvh.mappedFile);
+
+    bvh.pNodes = nullptr;
+    bvh.pPrimIndices = nullptr;
+    bvh.nodeCount = 0;
+
+    bvh.nodes.clear();
+    bvh.nodes.shrink_to_fit();
+    bvh.primIndices.clear();
+    bvh.primIndices.shrink_to_fit();
+    bvh.triangleRecords.clear();
+    bvh.triangleRecords.shrink_to_fit();
+}
+
+void computeTriangleRecords(BvhCpu& bvh)
+{
+    uint32_t count = bvh.stats.referenceCount;
+
+    bvh.triangleRecords.resize(count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t prim = bvh.pPrimIndices[i];
+
+        bvh.triangleRecords[i] = makeTriangleRecord(
+            bvh.positions[bvh.indices[3 * prim + 0]],
+            bvh.positions[bvh.indices[3 * prim + 1]],
+            bvh.positions[bvh.indices[3 * prim + 2]]);
+    }
+
+    bvh.stats.triangleRecordBytes = count * sizeof(TriangleRecord);
+}
+
+template <bool kCountSteps>
+static bool traverseBvh(const BvhCpu& bvh, const RayCpu& ray, bool anyHit, HitCpu* pHit,
+    BvhTraversalStats* pStats)
+{
+    if (bvh.nodeCount == 0)
+        return false;
+
+    const BvhNode* nodes = bvh.pNodes;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+    const uint32_t* indices = bvh.indices;
+    const glm::vec3* positions = bvh.positions;
+    const TriangleRecord* records = bvh.triangleRecords.empty() ? nullptr : bvh.triangleRecords.data();
+
+    glm::vec3 invDirection = 1.f / ray.direction;
+    float tmax = ray.tmax;
+    bool found = false;
+
+    if (!intersectAabb(nodes[0].boundsMin, nodes[0].boundsMax,
+        ray.origin, invDirection, ray.tmin, tmax))
+        return false;
+
+    // Entry distance is kept so nodes behind the closest hit can be skipped
+    struct StackEntry
+    {
+        uint32_t node;
+        float enter;
+    };
+
+    StackEntry stack[kMaxBvhDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    for (;;)
+    {
+        const BvhNode& node = nodes[nodeIndex];
+
+        if (kCountSteps)
+            pStats->nodeVisits++;
+
+        if (node.primCount > 0)
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.primCount; i++)
+            {
+                if (kCountSteps)
+                    pStats->primTests++;
+
+                float t, u, v;
+
+                if (records)
+                {
+                    if (!intersectTriangleRecord(ray.origin, ray.direction, records[i],
+                        ray.tmin, tmax, &t, &u, &v))
+                        continue;
+                }
+                else
+                {
+                    uint32_t prim = primIndices[i];
+
+                    if (!intersectTriangle(ray.origin, ray.direction,
+                        positions[indices[3 * prim + 0]],
+                        positions[indices[3 * prim + 1]],
+                        positions[indices[3 * prim + 2]],
+                        ray.tmin, tmax, &t, &u, &v))
+                        continue;
+                }
+
+                tmax = t;
+                found = true;
+
+                pHit->t = t;
+                pHit->u = u;
+                pHit->v = v;
+                pHit->primitiveID = primIndices[i];
+
+                if (anyHit)
+                    return true;
+            }
+        }
+        else
+        {
+            uint32_t left = nodeIndex + 1;
+            uint32_t right = node.offset;
+
+            float enterLeft, enterRight;
+
+            bool hitLeft = intersectAabb(nodes[left].boundsMin, nodes[left].boundsMax,
+                ray.origin, invDirection, ray.tmin, tmax, &enterLeft);
+            bool hitRight = intersectAabb(nodes[right].boundsMin, nodes[right].boundsMax,
+                ray.origin, invDirection, ray.tmin, tmax, &enterRight);
+
+            if (hitLeft && hitRight)
+            {
+                // Nearest first
+                if (enterRight < enterLeft)
+                {
+                    std::swap(left, right);
+                    std::swap(enterLeft, enterRight);
+                }
+
+                stack[stackSize++] = { right, enterRight };
+                nodeIndex = left;
+                continue;
+            }
+
+            if (hitLeft || hitRight)
+            {
+                nodeIndex = hitLeft ? left : right;
+                continue;
+            }
+        }
+
+        // Pop, skipping nodes that start behind the closest hit
+        for (;;)
+        {
+            if (stackSize == 0)
+                return found;
+
+            StackEntry& entry = stack[--stackSize];
+
+            if (entry.enter <= tmax)
+            {
+                nodeIndex = entry.node;
+                break;
+            }
+        }
+    }
+}
+
+bool intersectBvhCpu(const BvhCpu& bvh, const RayCpu& ray, bool anyHit, HitCpu* pHit)
+{
+    return traverseBvh<false>(bvh, ray, anyHit, pHit, nullptr);
+}
+
+bool intersectBvhCpu(const BvhCpu& bvh, const RayCpu& ray, bool anyHit, HitCpu* pHit,
+    BvhTraversalStats* pStats)
+{
+    return traverseBvh<true>(bvh, ray, anyHit, pHit, pStats);
+}
+
+bool occludedBvhCpu(const BvhCpu& bvh, const RayCpu& ray)
+{
+    if (bvh.nodeCount == 0)
+        return false;
+
+    const BvhNode* nodes = bvh.pNodes;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+    const uint32_t* indices = bvh.indices;
+    const glm::vec3* positions = bvh.positions;
+    const TriangleRecord* records = bvh.triangleRecords.empty() ? nullptr : bvh.triangleRecords.data();
+
+    glm::vec3 invDirection = 1.f / ray.direction;
+
+    uint32_t stack[kMaxBvhDepth];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const BvhNode& node = nodes[stack[--stackSize]];
+
+        if (!intersectAabb(node.boundsMin, node.boundsMax,
+            ray.origin, invDirection, ray.tmin, ray.tmax))
+            continue;
+
+        if (node.primCount == 0)
+        {
+            // Left child ends up on top, the next node in memory
+            uint32_t left = (uint32_t)(&node - nodes) + 1;
+            stack[stackSize++] = node.offset;
+            stack[stackSize++] = left;
+            continue;
+        }
+
+        for (uint32_t i = node.offset; i < node.offset + node.primCount; i++)
+        {
+            if (records)
+            {
+                float t, u, v;
+
+                if (intersectTriangleRecord(ray.origin, ray.direction, records[i], ray.tmin, ray.tmax, &t, &u, &v))
+                    return true;
+
+                continue;
+            }
+
+            uint32_t prim = primIndices[i];
+
+            if (occludesTriangle(ray.origin, ray.direction,
+                positions[indices[3 * prim + 0]],
+                positions[indices[3 * prim + 1]],
+                positions[indices[3 * prim + 2]],
+                ray.tmin, ray.tmax))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+const char* getBvhBuildModeName(BvhBuildMode mode)
+{
+    static const char* names[] = { "binned SAH", "LBVH", "LBVH+SAH", "SBVH" };
+    static_assert(sizeof(names) / sizeof(names[0]) == BVH_BUILD_MODE_COUNT, "");
+
+    return mode < BVH_BUILD_MODE_COUNT ? names[mode] : "unknown";
+}
+
+void refitBvhCpu(BvhCpu& bvh, const glm::vec3* positions, const glm::vec3* primBounds)
+{
+    if (bvh.nodeCount == 0)
+        return;
+
+    // A BVH from the cache is read only, refits work on a copy
+    if (bvh.mappedFile.pData)
+    {
+        bvh.nodes.assign(bvh.pNodes, bvh.pNodes + bvh.nodeCount);
+        bvh.primIndices.assign(bvh.pPrimIndices, bvh.pPrimIndices + bvh.stats.referenceCount);
+        bvh.pNodes = bvh.nodes.data();
+        bvh.pPrimIndices = bvh.primIndices.data();
+
+        unmapFile(bvh.mappedFile);
+    }
+
+    if (positions)
+        bvh.positions = positions;
+
+    BASSERT(bvh.positions || primBounds);
+
+    // Children always come after their parent, so one backwards pass sees
+    // every child before its parent
+    for (size_t i = bvh.nodes.size(); i-- > 0;)
+    {
+        BvhNode& node = bvh.nodes[i];
+        Aabb bounds = emptyAabb();
+
+        if (node.primCount > 0)
+        {
+            for (uint32_t j = node.offset; j < node.offset + node.primCount; j++)
+            {
+                uint32_t prim = bvh.primIndices[j];
+
+                if (primBounds)
+                {
+                    growAabb(bounds, Aabb{ primBounds[2 * prim + 0], primBounds[2 * prim + 1] });
+                }
+                else
+                {
+                    // SBVH references grow back to the whole triangle
+                    growAabb(bounds, bvh.positions[bvh.indices[3 * prim + 0]]);
+                    growAabb(bounds, bvh.positions[bvh.indices[3 * prim + 1]]);
+                    growAabb(bounds, bvh.positions[bvh.indices[3 * prim + 2]]);
+                }
+            }
+        }
+        else
+        {
+            const BvhNode& left = bvh.nodes[i + 1];
+            const BvhNode& right = bvh.nodes[node.offset];
+
+            bounds.min = glm::min(left.boundsMin, right.boundsMin);
+            bounds.max = glm::max(left.boundsMax, right.boundsMax);
+        }
+
+        node.boundsMin = bounds.min;
+        node.boundsMax = bounds.max;
+    }
+
+    computeStats(bvh, bvh.traversalCost);
+    bvh.stats.refitCount++;
+
+    if (!bvh.triangleRecords.empty())
+        computeTriangleRecords(bvh);
+}
+
+bool shouldRebuildBvhCpu(const BvhCpu& bvh, float maxSahRatio)
+{
+    if (maxSahRatio <= 0.f)
+        maxSahRatio = kBvhRebuildSahRatio;
+
+    return bvh.stats.sahCost > bvh.stats.builtSahCost * maxSahRatio;
+}
+
+void printBvhStats(const BvhBuildStats& stats, const char* name)
+{
+    size_t memoryBytes = stats.nodeCount * sizeof(BvhNode) + stats.referenceCount * sizeof(uint32_t) +
+        stats.triangleRecordBytes;
+
+    char records[64] = "";
+
+    if (stats.triangleRecordBytes > 0)
+        snprintf(records, sizeof(records), " (%.1f KB triangle records)", stats.triangleRecordBytes / 1024.);
+
+    DebugPrint("BVH %s: %u prims (%u refs), %.2f ms, %u nodes (%u leaves), depth %u, "
+        "leaf prims avg %.2f max %u, SAH %.2f, %.1f KB%s, %.1f bytes/prim\n",
+        name, stats.primCount, stats.referenceCount, stats.buildTimeMs, stats.nodeCount, stats.leafCount,
+        stats.maxDepth, stats.avgLeafPrims, stats.maxLeafPrims, stats.sahCost,
+        memoryBytes / 1024., records, (float)memoryBytes / std::max(stats.primCount, 1u));
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include "RayCpu.h"
+#include "MappedFile.h"
+
+// Bottom level BVH over one Mesh (CPU equivalent of Mesh::blas).
+//
+// Nodes are stored depth first: the left child of an interior node is the
+// next node in the array and only the right child index is stored, so a
+// traversal that goes left first walks memory linearly.
+
+// Also the traversal stack size
+const uint32_t kMaxBvhDepth = 64;
+
+struct JobSystem;
+
+enum BvhBuildMode
+{
+    // Top down binned SAH, single threaded, best trace performance
+    BVH_BUILD_BINNED_SAH,
+
+    // Linear BVH: primitives sorted by the Morton code of their centroid and
+    // split at the highest differing bit.  Parallel and much faster to
+    // build, but the trees are worse to trace.
+    BVH_BUILD_LBVH,
+
+    // LBVH for the upper levels, subtrees of up to kLbvhRefineSize
+    // primitives rebuilt with binned SAH
+    BVH_BUILD_LBVH_SAH,
+
+    // Binned SAH plus spatial splits that clip triangles straddling the
+    // plane into both children (primIndices can repeat a triangle).  For
+    // large overlapping triangles, triangle meshes only.
+    BVH_BUILD_SBVH,
+
+    BVH_BUILD_MODE_COUNT
+};
+
+const uint32_t kLbvhRefineSize = 1024;
+
+// 32 bytes, two nodes per cache line
+struct BvhNode
+{
+    glm::vec3 boundsMin;
+    uint32_t primCount; // 0 -> interior node
+    glm::vec3 boundsMax;
+    uint32_t offset;    // interior: right child index, leaf: first index into primIndices
+};
+
+struct BvhBuildStats
+{
+    double buildTimeMs;
+
+    uint32_t primCount;
+    uint32_t referenceCount; // primIndices entries, > primCount with spatial splits
+    uint32_t nodeCount;
+    uint32_t leafCount;
+    uint32_t maxDepth;
+    uint32_t maxLeafPrims;
+    float avgLeafPrims;
+
+    // Expected cost of a random ray hitting the root, in units of one
+    // triangle test (see BvhCpuCreateInfo::traversalCost)
+    float sahCost;
+    float builtSahCost;  // sahCost right after the build, refits only update sahCost
+    uint32_t refitCount; // since the build
+
+    size_t triangleRecordBytes; // 0 without triangle records
+};
+
+struct BvhCpu
+{
+    // Storage of built BVHs, empty for BVHs loaded from the cache
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> primIndices; // triangle (or box) index, in leaf order
+
+    // What traversal reads: the arrays above or the mapped cache file
+    const BvhNode* pNodes;
+    const uint32_t* pPrimIndices; // stats.referenceCount entries
+    uint32_t nodeCount;
+
+    MappedFile mappedFile; // see BvhCache.h
+
+    // Optional, one per primIndices entry in the same order, so leaves test
+    // contiguous records instead of fetching indices and then positions.
+    // primIndices is only read for hits.
+    std::vector<TriangleRecord> triangleRecords;
+
+    // Geometry the BVH was built over, not owned.  Null when built from boxes.
+    const glm::vec3* positions;
+    const uint32_t* indices;
+
+    float traversalCost; // as built, for the SAH cost of refits
+
+    BvhBuildStats stats;
+};
+
+struct BvhCpuCreateInfo
+{
+    const glm::vec3* positions;
+    uint32_t vertexCount;
+    const uint32_t* indices;
+    uint32_t indexCount;
+
+    // Build over arbitrary boxes instead of triangles (e.g. TLAS instances).
+    // primBounds holds primCount min/max pairs, positions/indices are ignored.
+    const glm::vec3* primBounds;
+    uint32_t primCount;
+
+    uint32_t binCount;    // 0 -> 32
+    uint32_t maxLeafSize; // 0 -> 8
+    float traversalCost;  // cost of a node visit relative to a triangle test, 0 -> 1
+
+    BvhBuildMode mode;
+
+    // SBVH: extra references from spatial splits as a fraction of the
+    // triangle count (0 -> 0.5), and a cap on the size of the finished BVH
+    // (0 -> none)
+    float splitBudget;
+    size_t maxMemoryBytes;
+
+    // Fill BvhCpu::triangleRecords (triangle BVHs only)
+    bool triangleRecords;
+
+    // LBVH modes run on the job system, null -> calling thread only.  Must not
+    // be called from one of its jobs.
+    JobSystem* pJobSystem;
+};
+
+bool createBvhCpu(const BvhCpuCreateInfo& ci, BvhCpu* pBvh);
+
+void destroyBvhCpu(BvhCpu& bvh);
+
+// (Re)computes BvhCpu::triangleRecords from the current positions
+void computeTriangleRecords(BvhCpu& bvh);
+
+// Ray in the space the BVH was built in.  Fills t, u, v and primitiveID.
+// anyHit returns on the first hit found (gl_RayFlagsTerminateOnFirstHitNV).
+bool intersectBvhCpu(const BvhCpu& bvh, const RayCpu& ray, bool anyHit, HitCpu* pHit);
+
+struct BvhTraversalStats
+{
+    uint64_t nodeVisits;
+    uint64_t primTests;
+};
+
+// Same, adding the traversal steps to pStats
+bool intersectBvhCpu(const BvhCpu& bvh, const RayCpu& ray, bool anyHit, HitCpu* pHit,
+    BvhTraversalStats* pStats);
+
+// Occlusion only (gl_RayFlagsTerminateOnFirstHitNV with a boolean result):
+// stops at the first hit, visits children in memory order and keeps no hit
+// record.
+bool occludedBvhCpu(const BvhCpu& bvh, const RayCpu& ray);
+
+// Refits grow the SAH cost as the geometry moves away from the build.  Past
+// this ratio a rebuild pays off.
+const float kBvhRebuildSahRatio = 1.3f;
+
+// Recomputes the node bounds bottom up after the geometry moved, keeping the
+// tree.  positions replaces BvhCpu::positions (same vertex count and indices,
+// null -> changed in place); box BVHs take the new primBounds min/max pairs
+// instead.  Updates stats.sahCost.
+void refitBvhCpu(BvhCpu& bvh, const glm::vec3* positions, const glm::vec3* primBounds);
+
+// True once refits have degraded the SAH cost past maxSahRatio times the
+// cost of the build (0 -> kBvhRebuildSahRatio)
+bool shouldRebuildBvhCpu(const BvhCpu& bvh, float maxSahRatio);
+
+void printBvhStats(const BvhBuildStats& stats, const char* name);
+
+const char* getBvhBuildModeName(BvhBuildMode mode);
@@ -0,0 +1,425 @@
+#include "pch.h"
+
+#include "App.h"
+#include "logging.h"
+#include "CookedScene.h"
+#include "VertexFormat.h"
+
+const uint32_t kCookedSceneMagic = 0x4E435352; // "RSCN"
+
+const uint64_t kCookedSceneAlignment = 64;
+
+enum CookedSection
+{
+    COOKED_SECTION_NODES,
+    COOKED_SECTION_NODE_NAMES,    // chars, not null terminated
+    COOKED_SECTION_MESHES,
+    COOKED_SECTION_MATERIALS,
+    COOKED_SECTION_BASE_COLOR_TEXTURE_IDS,
+    COOKED_SECTION_TEXTURES,
+    COOKED_SECTION_DATA,          // mesh and texture data
+    COOKED_SECTION_COUNT
+};
+
+// From the start of the file
+struct CookedSectionRange
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct CookedSceneHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t fileSize;
+
+    CookedSectionRange sections[COOKED_SECTION_COUNT];
+
+    // As the loader left it, the defaults if the scene has no camera
+    glm::vec3 cameraPosition;
+    glm::vec3 cameraForward;
+    glm::vec3 cameraUp;
+};
+
+struct CookedNode
+{
+    glm::mat4 matrix;
+    glm::quat rotation;
+    glm::vec3 translation;
+    glm::vec3 scale;
+
+    int32_t meshID;
+    uint32_t matrixValid;
+
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t pad[2];
+};
+
+static_assert(sizeof(CookedNode) == 128, "CookedNode layout changed, bump kCookedSceneVersion");
+
+struct CookedMesh
+{
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    int32_t materialID;
+    int32_t geometryID;
+    uint32_t format; // MeshFormatFlags, sizes the normals and UVs
+    uint32_t pad;
+
+    // From the start of the file, 0 for meshes sharing another one's geometry
+    uint64_t positionsOffset;
+    uint64_t normalsOffset;
+    uint64_t uvsOffset;
+    uint64_t indicesOffset;
+};
+
+struct CookedTexture
+{
+    uint32_t width;
+    uint32_t height;
+    uint64_t pixelsOffset;
+};
+
+static uint64_t alignOffset(uint64_t offset)
+{
+    return (offset + kCookedSceneAlignment - 1) & ~(kCookedSceneAlignment - 1);
+}
+
+// Copies size bytes to the next aligned offset of file, returns the offset
+static uint64_t appendAligned(std::vector<uint8_t>& file, const void* pData, size_t size)
+{
+    uint64_t offset = alignOffset(file.size());
+    file.resize(offset + size, 0);
+
+    if (size > 0)
+        memcpy(file.data() + offset, pData, size);
+
+    return offset;
+}
+
+bool writeCookedScene(const char* filename, const Scene& scene)
+{
+    std::vector<uint8_t> file(sizeof(CookedSceneHeader), 0);
+
+    CookedSceneHeader header;
+    memset(&header, 0, sizeof(header));
+
+    header.magic = kCookedSceneMagic;
+    header.version = kCookedSceneVersion;
+    header.cameraPosition = scene.camera.position;
+    header.cameraForward = scene.camera.forward;
+    header.cameraUp = scene.camera.up;
+
+    // The data first, the records need its offsets
+    uint64_t dataOffset = alignOffset(file.size());
+
+    std::vector<CookedMesh> meshes(scene.meshes.size());
+
+    for (size_t i = 0; i < scene.meshes.size(); i++)
+    {
+        const Mesh& mesh = scene.meshes[i];
+        CookedMesh& cooked = meshes[i];
+
+        cooked.vertexCount = mesh.vertexCount;
+        cooked.indexCount = mesh.indexCount;
+        cooked.materialID = mesh.materialID;
+        cooked.geometryID = mesh.geometryID;
+        cooked.format = mesh.format;
+
+        if (mesh.geometryID != (int)i)
+            continue;
+
+        const void* pNormals = mesh.format & MESH_FORMAT_OCT_NORMALS ?
+            (const void*)mesh.octNormalData : (const void*)mesh.normalData;
+        const void* pUvs = mesh.format & MESH_FORMAT_HALF_UVS ? (const void*)mesh.halfUvData : (const void*)mesh.uvData;
+
+        cooked.positionsOffset = appendAligned(file, mesh.positionData, mesh.vertexCount * sizeof(glm::vec3));
+        cooked.normalsOffset = appendAligned(file, pNormals, mesh.vertexCount * getNormalSize(mesh.format));
+        cooked.uvsOffset = appendAligned(file, pUvs, mesh.vertexCount * getUvSize(mesh.format));
+        cooked.indicesOffset = appendAligned(file, mesh.indexData, mesh.indexCount * sizeof(uint32_t));
+    }
+
+    std::vector<CookedTexture> textures(scene.textureData.size());
+
+    for (size_t i = 0; i < scene.textureData.size(); i++)
+    {
+        const TextureData& data = scene.textureData[i];
+
+        textures[i].width = data.width;
+        textures[i].height = data.height;
+        textures[i].pixelsOffset = appendAligned(file, data.pixels, (size_t)data.width * data.height * 4);
+    }
+
+    header.sections[COOKED_SECTION_DATA] = { dataOffset, file.size() - dataOffset };
+
+    // SceneNode::children are glTF node indices, most of them not in
+    // scene.nodes, and nothing follows them yet, so they aren't cooked
+    std::vector<CookedNode> nodes(scene.nodes.size());
+    std::string names;
+
+    for (size_t i = 0; i < scene.nodes.size(); i++)
+    {
+        const SceneNode& node = scene.nodes[i];
+        CookedNode& cooked = nodes[i];
+
+        cooked.matrix = node.matrix;
+        cooked.rotation = node.rotation;
+        cooked.translation = node.translation;
+        cooked.scale = node.scale;
+        cooked.meshID = node.meshID;
+        cooked.matrixValid = node.matrixValid;
+
+        cooked.nameOffset = (uint32_t)names.size();
+        cooked.nameLength = (uint32_t)node.name.size();
+        names += node.name;
+    }
+
+    auto addSection = [&](CookedSection section, const void* pData, size_t size) {
+        header.sections[section] = { appendAligned(file, pData, size), size };
+    };
+
+    addSection(COOKED_SECTION_NODES, nodes.data(), nodes.size() * sizeof(CookedNode));
+    addSection(COOKED_SECTION_NODE_NAMES, names.data(), names.size());
+    addSection(COOKED_SECTION_MESHES, meshes.data(), meshes.size() * sizeof(CookedMesh));
+    addSection(COOKED_SECTION_MATERIALS, scene.materials.data(), scene.materials.size() * sizeof(Material));
+    addSection(COOKED_SECTION_BASE_COLOR_TEXTURE_IDS, scene.baseColorTextureIDs.data(),
+        scene.baseColorTextureIDs.size() * sizeof(int));
+    addSection(COOKED_SECTION_TEXTURES, textures.data(), textures.size() * sizeof(CookedTexture));
+
+    header.fileSize = file.size();
+    memcpy(file.data(), &header, sizeof(header));
+
+    std::ofstream out(filename, std::ios::binary);
+    out.write((const char*)file.data(), file.size());
+
+    if (!out)
+    {
+        DebugPrint("Error: could not write %s\n", filename);
+        return false;
+    }
+
+    DebugPrint("Cooked %s: %zu meshes, %zu textures, %.1f KB\n", filename, meshes.size(), textures.size(),
+        file.size() / 1024.);
+
+    return true;
+}
+
+// Aligned and inside the file
+static bool isValidRange(const MappedFile& file, uint64_t offset, uint64_t size)
+{
+    return offset % kCookedSceneAlignment == 0 && offset <= file.size && size <= file.size - offset;
+}
+
+template <typename T>
+static bool getSection(const MappedFile& file, const CookedSceneHeader& header, CookedSection section,
+    const T** ppRecords, size_t* pCount)
+{
+    const CookedSectionRange& range = header.sections[section];
+
+    if (!isValidRange(file, range.offset, range.size) || range.size % sizeof(T) != 0)
+        return false;
+
+    *ppRecords = (const T*)(file.pData + range.offset);
+    *pCount = (size_t)(range.size / sizeof(T));
+
+    return true;
+}
+
+// The records and the IDs in them, the data they point at is used as is
+static bool isValidCookedScene(const MappedFile& file, const CookedSceneHeader& header)
+{
+    const CookedNode* pNodes;
+    const char* pNames;
+    const CookedMesh* pMeshes;
+    const Material* pMaterials;
+    const int* pBaseColorTextureIDs;
+    const CookedTexture* pTextures;
+
+    size_t nodeCount, nameSize, meshCount, materialCount, baseColorTextureIDCount, textureCount;
+
+    if (!getSection(file, header, COOKED_SECTION_NODES, &pNodes, &nodeCount) ||
+        !getSection(file, header, COOKED_SECTION_NODE_NAMES, &pNames, &nameSize) ||
+        !getSection(file, header, COOKED_SECTION_MESHES, &pMeshes, &meshCount) ||
+        !getSection(file, header, COOKED_SECTION_MATERIALS, &pMaterials, &materialCount) ||
+        !getSection(file, header, COOKED_SECTION_BASE_COLOR_TEXTURE_IDS, &pBaseColorTextureIDs,
+            &baseColorTextureIDCount) ||
+        !getSection(file, header, COOKED_SECTION_TEXTURES, &pTextures, &textureCount))
+        return false;
+
+    if (meshCount == 0 || baseColorTextureIDCount != materialCount)
+        return false;
+
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        const CookedNode& node = pNodes[i];
+
+        if (node.meshID < 0 || node.meshID >= (int)meshCount ||
+            node.nameOffset > nameSize || node.nameLength > nameSize - node.nameOffset)
+            return false;
+    }
+
+    // Material and texture IDs are -1 for none
+    for (size_t i = 0; i < materialCount; i++)
+    {
+        if (pBaseColorTextureIDs[i] < -1 || pBaseColorTextureIDs[i] >= (int)textureCount)
+            return false;
+    }
+
+    for (size_t i = 0; i < meshCount; i++)
+    {
+        const CookedMesh& mesh = pMeshes[i];
+
+        const uint32_t kKnownFormats = MESH_FORMAT_OCT_NORMALS | MESH_FORMAT_HALF_UVS | MESH_FORMAT_INDEX16;
+
+        if (mesh.materialID < -1 || mesh.materialID >= (int)materialCount)
+            return false;
+
+        if ((mesh.format & ~kKnownFormats) != 0 ||
+            ((mesh.format & MESH_FORMAT_INDEX16) && mesh.vertexCount > 0x10000))
+            return false;
+
+        // Shared geometry belongs to an earlier mesh that owns it
+        if (mesh.geometryID != (int)i)
+        {
+            if (mesh.geometryID < 0 || mesh.geometryID >= (int)i ||
+                pMeshes[mesh.geometryID].geometryID != mesh.geometryID)
+                return false;
+
+            continue;
+        }
+
+        if (!isValidRange(file, mesh.positionsOffset, mesh.vertexCount * sizeof(glm::vec3)) ||
+            !isValidRange(file, mesh.normalsOffset, mesh.vertexCount * getNormalSize(mesh.format)) ||
+            !isValidRange(file, mesh.uvsOffset, mesh.vertexCount * getUvSize(mesh.format)) ||
+            !isValidRange(file, mesh.indicesOffset, mesh.indexCount * sizeof(uint32_t)))
+            return false;
+    }
+
+    for (size_t i = 0; i < textureCount; i++)
+    {
+        const CookedTexture& texture = pTextures[i];
+
+        if (!isValidRange(file, texture.pixelsOffset, (uint64_t)texture.width * texture.height * 4))
+            return false;
+    }
+
+    return true;
+}
+
+bool mapCookedScene(const char* filename, Scene* pScene)
+{
+    MappedFile file;
+
+    if (!mapFile(filename, &file))
+    {
+        DebugPrint("Error: could not map %s\n", filename);
+        return false;
+    }
+
+    const CookedSceneHeader& header = *(const CookedSceneHeader*)file.pData;
+
+    if (file.size < sizeof(CookedSceneHeader) || header.magic != kCookedSceneMagic ||
+        header.version != kCookedSceneVersion || header.fileSize != file.size)
+    {
+        DebugPrint("Error: %s is not a version %u cooked scene\n", filename, kCookedSceneVersion);
+        unmapFile(file);
+        return false;
+    }
+
+    if (!isValidCookedScene(file, header))
+    {
+        DebugPrint("Error: %s: inconsistent cooked scene\n", filename);
+        unmapFile(file);
+        return false;
+    }
+
+    const CookedNode* pNodes;
+    const char* pNames;
+    const CookedMesh* pMeshes;
+    const Material* pMaterials;
+    const int* pBaseColorTextureIDs;
+    const CookedTexture* pTextures;
+
+    size_t nodeCount, nameSize, meshCount, materialCount, baseColorTextureIDCount, textureCount;
+
+    getSection(file, header, COOKED_SECTION_NODES, &pNodes, &nodeCount);
+    getSection(file, header, COOKED_SECTION_NODE_NAMES, &pNames, &nameSize);
+    getSection(file, header, COOKED_SECTION_MESHES, &pMeshes, &meshCount);
+    getSection(file, header, COOKED_SECTION_MATERIALS, &pMaterials, &materialCount);
+    getSection(file, header, COOKED_SECTION_BASE_COLOR_TEXTURE_IDS, &pBaseColorTextureIDs,
+        &baseColorTextureIDCount);
+    getSection(file, header, COOKED_SECTION_TEXTURES, &pTextures, &textureCount);
+
+    // Nodes own their name, so these are built; the rest are
+    // pointers into the mapping or plain copies
+    pScene->nodes.resize(nodeCount);
+
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+        const CookedNode& cooked = pNodes[i];
+        SceneNode& node = pScene->nodes[i];
+
+        node.name.assign(pNames + cooked.nameOffset, cooked.nameLength);
+        node.translation = cooked.translation;
+        node.scale = cooked.scale;
+        node.rotation = cooked.rotation;
+        node.matrix = cooked.matrix;
+        node.meshID = cooked.meshID;
+        node.matrixValid = cooked.matrixValid != 0;
+    }
+
+    pScene->meshes.resize(meshCount);
+
+    for (size_t i = 0; i < meshCount; i++)
+    {
+        const CookedMesh& cooked = pMeshes[i];
+        Mesh& mesh = pScene->meshes[i];
+
+        mesh.vertexCount = cooked.vertexCount;
+        mesh.indexCount = cooked.indexCount;
+        mesh.materialID = cooked.materialID;
+        mesh.geometryID = cooked.geometryID;
+        mesh.format = cooked.format;
+
+        if (mesh.geometryID != (int)i)
+            continue;
+
+        mesh.positionData = (const glm::vec3*)(file.pData + cooked.positionsOffset);
+        mesh.indexData = (const uint32_t*)(file.pData + cooked.indicesOffset);
+
+        if (mesh.format & MESH_FORMAT_OCT_NORMALS)
+            mesh.octNormalData = (const uint32_t*)(file.pData + cooked.normalsOffset);
+        else
+            mesh.normalData = (const glm::vec3*)(file.pData + cooked.normalsOffset);
+
+        if (mesh.format & MESH_FORMAT_HALF_UVS)
+            mesh.halfUvData = (const uint32_t*)(file.pData + cooked.uvsOffset);
+        else
+            mesh.uvData = (const glm::vec2*)(file.pData + cooked.uvsOffset);
+    }
+
+    pScene->materials.assign(pMaterials, pMaterials + materialCount);
+    pScene->baseColorTextureIDs.assign(pBaseColorTextureIDs, pBaseColorTextureIDs + baseColorTextureIDCount);
+
+    pScene->textureData.resize(textureCount);
+
+    for (size_t i = 0; i < textureCount; i++)
+    {
+        TextureData& data = pScene->textureData[i];
+
+        data.width = pTextures[i].width;
+        data.height = pTextures[i].height;
+        data.pixels = file.pData + pTextures[i].pixelsOffset;
+    }
+
+    pScene->camera.position = header.cameraPosition;
+    pScene->camera.forward = header.cameraForward;
+    pScene->camera.up = header.cameraUp;
+    cameraUpdateView(pScene->camera);
+
+    pScene->cookedFile = file;
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+struct Scene;
+
+// Pre-baked scene: what loadGltfFile leaves in a Scene (nodes, meshes,
+// materials, decoded RGBA8 textures and the camera) in one file that is
+// mapped rather than parsed.  The mesh and texture data go to the GPU
+// upload and the CPU raytracer straight from the mapping, and the pages
+// stay in the OS file cache for the next run.
+//
+// File: CookedSceneHeader with a table of sections, the mesh and texture
+// data, then packed arrays of fixed size records pointing into it.
+// Everything is 64 byte aligned.  Node children aren't stored.  Files of
+// another version are rejected, cook them again from the glTF.
+
+const uint32_t kCookedSceneVersion = 3;
+
+const char* const kCookedSceneExtension = ".rtscene";
+
+// Writes the CPU side of scene, as loaded from any scene file
+bool writeCookedScene(const char* filename, const Scene& scene);
+
+// Maps filename into pScene->cookedFile and fills the CPU side of pScene
+// from it: the meshes and textures point into the mapping, the nodes and
+// materials are copied.  Nothing is uploaded.  False if the file is
+// missing, of another version or inconsistent, pScene is untouched then.
+bool mapCookedScene(const char* filename, Scene* pScene);
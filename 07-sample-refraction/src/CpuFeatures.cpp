@@ -0,0 +1,46 @@
+#include "pch.h"
+
+#include "CpuFeatures.h"
+
+SimdLevel detectSimdLevel()
+{
+    // SSE2 is part of x64
+    int info[4];
+
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    // The OS has to save the YMM registers
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+        return SIMD_LEVEL_SSE;
+
+    if (maxLeaf < 7)
+        return SIMD_LEVEL_AVX;
+
+    __cpuidex(info, 7, 0);
+
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+
+    return avx2 ? SIMD_LEVEL_AVX2 : SIMD_LEVEL_AVX;
+}
+
+const char* getSimdLevelName(SimdLevel level)
+{
+    static const char* names[] = { "scalar", "SSE", "AVX", "AVX2" };
+    static_assert(sizeof(names) / sizeof(names[0]) == SIMD_LEVEL_COUNT, "");
+
+    return names[level];
+}
+
+bool hasSsse3()
+{
+    int info[4];
+    __cpuid(info, 1);
+
+    return (info[2] & (1 << 9)) != 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+// Instruction set levels for picking the SIMD kernels at run time
+
+enum SimdLevel
+{
+    SIMD_LEVEL_SCALAR,
+    SIMD_LEVEL_SSE,
+    SIMD_LEVEL_AVX,  // 8 wide float
+    SIMD_LEVEL_AVX2, // 8 wide integer
+    SIMD_LEVEL_COUNT
+};
+
+// Best level supported by the CPU (and OS, for AVX state)
+SimdLevel detectSimdLevel();
+
+const char* getSimdLevelName(SimdLevel level);
+
+// Not implied by SIMD_LEVEL_SSE or SIMD_LEVEL_AVX
+bool hasSsse3();
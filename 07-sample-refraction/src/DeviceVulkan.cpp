@@ -310,33 +310,41 @@ bool createDeviceVulkan(const DeviceVulkanCreateInfo& ci, DeviceVulkan* deviceVu
     return true;
 }
 
+// Also undoes a createDeviceVulkan that failed part way
 void destroyDeviceVulkan(DeviceVulkan& vk)
 {
-    vkDeviceWaitIdle(vk.device);
+    if (vk.device)
+    {
+        vkDeviceWaitIdle(vk.device);
 
-    vkDestroySemaphore(vk.device, vk.semaphoreRenderFinished, nullptr);
-    vkDestroySemaphore(vk.device, vk.semaphoreImageAcquired, nullptr);
+        vkDestroySemaphore(vk.device, vk.semaphoreRenderFinished, nullptr);
+        vkDestroySemaphore(vk.device, vk.semaphoreImageAcquired, nullptr);
 
-    vkFreeCommandBuffers(vk.device, vk.commandPool, uint32_t(vk.commandBuffers.size()),
-        vk.commandBuffers.data());
-    vkDestroyCommandPool(vk.device, vk.commandPool, nullptr);
+        if (!vk.commandBuffers.empty())
+            vkFreeCommandBuffers(vk.device, vk.commandPool, uint32_t(vk.commandBuffers.size()),
+                vk.commandBuffers.data());
+        vkDestroyCommandPool(vk.device, vk.commandPool, nullptr);
 
-    for (auto& fence : vk.waitForFrameFences)
-        vkDestroyFence(vk.device, fence, nullptr);
+        for (auto& fence : vk.waitForFrameFences)
+            vkDestroyFence(vk.device, fence, nullptr);
 
-    for (auto& view : vk.swapchainImageViews)
-        vkDestroyImageView(vk.device, view, nullptr);
+        for (auto& view : vk.swapchainImageViews)
+            vkDestroyImageView(vk.device, view, nullptr);
 
-    vkDestroySwapchainKHR(vk.device, vk.swapchain, nullptr);
+        vkDestroySwapchainKHR(vk.device, vk.swapchain, nullptr);
 
-    vkDestroySurfaceKHR(vk.instance, vk.surface, nullptr);
+        vkDestroyDevice(vk.device, nullptr);
+    }
 
-    vkDestroyDevice(vk.device, nullptr);
+    if (vk.instance)
+    {
+        vkDestroySurfaceKHR(vk.instance, vk.surface, nullptr);
 
-    if (vk.debugCallback)
-        vkDestroyDebugReportCallbackEXT(vk.instance, vk.debugCallback, nullptr);
+        if (vk.debugCallback)
+            vkDestroyDebugReportCallbackEXT(vk.instance, vk.debugCallback, nullptr);
 
-    vkDestroyInstance(vk.instance, nullptr);
+        vkDestroyInstance(vk.instance, nullptr);
+    }
 
     vk = {};
 }
@@ -380,16 +388,19 @@ bool createBufferVulkan(const DeviceVulkan& vk, const BufferVulkanCreateInfo& ci
     VK_CHECK(vkBindBufferMemory(vk.device, buff.buffer, buff.memory, 0));
 
     if (ci.pSrc)
-    {
-        void* mem = nullptr;
-        VK_CHECK(vkMapMemory(vk.device, buff.memory, 0, buff.size, 0, &mem));
+        writeBufferVulkan(vk, buff, ci.pSrc);
 
-        memcpy(mem, ci.pSrc, buff.size);
+    return true;
+}
 
-        vkUnmapMemory(vk.device, buff.memory);
-    }
+void writeBufferVulkan(const DeviceVulkan& vk, const BufferVulkan& buffer, const void* pSrc)
+{
+    void* mem = nullptr;
+    VK_CHECK(vkMapMemory(vk.device, buffer.memory, 0, buffer.size, 0, &mem));
 
-    return true;
+    memcpy(mem, pSrc, buffer.size);
+
+    vkUnmapMemory(vk.device, buffer.memory);
 }
 
 void destroyBufferVulkan(const DeviceVulkan& vk, BufferVulkan& buffer)
@@ -104,6 +104,10 @@ uint32_t getMemoryTypeVulkan(const DeviceVulkan& vk, VkMemoryRequirements& memor
 
 bool createBufferVulkan(const DeviceVulkan& vk, const BufferVulkanCreateInfo& ci, BufferVulkan* pBuffer);
 
+// Copies buffer.size bytes to a host visible buffer.  Different buffers can
+// be written from different threads.
+void writeBufferVulkan(const DeviceVulkan& vk, const BufferVulkan& buffer, const void* pSrc);
+
 void destroyBufferVulkan(const DeviceVulkan& vk, BufferVulkan& buffer);
 
 bool createImageVulkan(const DeviceVulkan& vk, const ImageVulkanCreateInfo& ci, ImageVulkan* pImage);
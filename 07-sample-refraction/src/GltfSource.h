@@ -0,0 +1,34 @@
+#pragma once
+
+#include "App.h"
+#include "MappedFile.h"
+
+// The parsed model and where its buffer data lives.  Buffer 0 of a .glb
+// is its BIN chunk, read from the file mapping; tinygltf only sees a one
+// byte placeholder for it, so the chunk is never copied.
+//
+// Only the accessors, buffer views, buffers, meshes and scenes of the
+// model are used.  Nodes and materials are read into the tables below,
+// which the streaming parser fills without going through the model.
+struct GltfSource
+{
+    tinygltf::Model model;
+
+    MappedFile glbFile;
+    const uint8_t* pBin; // null unless buffer 0 is the BIN chunk
+    size_t binSize;
+
+    // The "images" array, kept from tinygltf so loadImages can decode them
+    // as jobs.  External files are relative to baseDirectory.
+    nlohmann::json images;
+    std::string baseDirectory;
+
+    // Every node of the file; the roots of the default scene end up in
+    // Scene::nodes.  nodeCameras has the camera of each node, or -1.
+    std::vector<SceneNode> nodes;
+    std::vector<int> nodeCameras;
+
+    // Per material, texture IDs are -1 for none
+    std::vector<Material> materials;
+    std::vector<int> baseColorTextureIDs;
+};
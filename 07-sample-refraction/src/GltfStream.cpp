@@ -0,0 +1,547 @@
+#include "pch.h"
+
+#include "logging.h"
+#include "Base64.h"
+#include "GltfSource.h"
+#include "GltfStream.h"
+
+// Top level arrays the parser reads, everything else is skipped
+enum GltfSection
+{
+    GLTF_SECTION_OTHER,
+    GLTF_SECTION_ACCESSORS,
+    GLTF_SECTION_BUFFER_VIEWS,
+    GLTF_SECTION_BUFFERS,
+    GLTF_SECTION_IMAGES,
+    GLTF_SECTION_MATERIALS,
+    GLTF_SECTION_MESHES,
+    GLTF_SECTION_NODES,
+    GLTF_SECTION_SCENES,
+    GLTF_SECTION_SCENE // the default scene index
+};
+
+static GltfSection getGltfSection(const std::string& key)
+{
+    static const std::pair<const char*, GltfSection> sections[] = {
+        { "accessors", GLTF_SECTION_ACCESSORS },
+        { "bufferViews", GLTF_SECTION_BUFFER_VIEWS },
+        { "buffers", GLTF_SECTION_BUFFERS },
+        { "images", GLTF_SECTION_IMAGES },
+        { "materials", GLTF_SECTION_MATERIALS },
+        { "meshes", GLTF_SECTION_MESHES },
+        { "nodes", GLTF_SECTION_NODES },
+        { "scenes", GLTF_SECTION_SCENES },
+        { "scene", GLTF_SECTION_SCENE },
+    };
+
+    for (auto& section : sections)
+    {
+        if (key == section.first)
+            return section.second;
+    }
+
+    return GLTF_SECTION_OTHER;
+}
+
+static int getAccessorType(const std::string& type)
+{
+    static const std::pair<const char*, int> types[] = {
+        { "SCALAR", TINYGLTF_TYPE_SCALAR },
+        { "VEC2", TINYGLTF_TYPE_VEC2 },
+        { "VEC3", TINYGLTF_TYPE_VEC3 },
+        { "VEC4", TINYGLTF_TYPE_VEC4 },
+        { "MAT2", TINYGLTF_TYPE_MAT2 },
+        { "MAT3", TINYGLTF_TYPE_MAT3 },
+        { "MAT4", TINYGLTF_TYPE_MAT4 },
+    };
+
+    for (auto& t : types)
+    {
+        if (type == t.first)
+            return t.second;
+    }
+
+    return -1;
+}
+
+// nlohmann::json SAX interface.  A stack of the enclosing objects and
+// arrays locates each value: frames[0] is the root object with the section
+// as its key, frames[1] the section array, frames[2] the element with the
+// field as its key and so on.  Elements are appended when their object
+// starts, so the current one is always the last; elements that aren't
+// objects fail the parse.
+struct GltfSaxHandler
+{
+    struct Frame
+    {
+        bool isArray;
+        int index;       // of the current element, arrays only
+        std::string key; // of the current value, objects only
+    };
+
+    GltfSource* pSrc;
+    const char* fn;
+
+    GltfSection section;
+    std::vector<Frame> frames;
+
+    // Buffers to read from files once the parse is done
+    std::vector<size_t> externalBuffers;
+
+    // Data URI buffers, checked against their byteLength (SIZE_MAX if
+    // missing) once the parse is done
+    std::vector<size_t> dataUriBuffers;
+    std::vector<size_t> bufferByteLengths;
+
+    bool failed;
+
+    bool isField(size_t depth, const char* key) const
+    {
+        return frames.size() > depth && !frames[depth].isArray && frames[depth].key == key;
+    }
+
+    // Inside an element of a section, which beginElement appended
+    bool inElement() const
+    {
+        return frames.size() >= 3 && frames[1].isArray && !frames[2].isArray;
+    }
+
+    // Array frames count their elements as they start
+    void beginValue(bool isObject = false)
+    {
+        if (!frames.empty() && frames.back().isArray)
+            frames.back().index++;
+
+        if (frames.size() == 2 && frames[1].isArray && section != GLTF_SECTION_OTHER && !isObject)
+        {
+            DebugPrint("Error: %s: element %d of a section is not an object\n", fn, frames[1].index);
+            failed = true;
+        }
+    }
+
+    void beginElement()
+    {
+        tinygltf::Model& model = pSrc->model;
+
+        switch (section)
+        {
+        case GLTF_SECTION_ACCESSORS:
+            model.accessors.push_back({});
+            break;
+        case GLTF_SECTION_BUFFER_VIEWS:
+            model.bufferViews.push_back({});
+            break;
+        case GLTF_SECTION_BUFFERS:
+            model.buffers.push_back({});
+            bufferByteLengths.push_back(SIZE_MAX);
+            break;
+        case GLTF_SECTION_IMAGES:
+            pSrc->images.push_back(nlohmann::json::object());
+            break;
+        case GLTF_SECTION_MATERIALS:
+            // glTF defaults
+            pSrc->materials.push_back({ glm::vec4(1.f), 1.f, 1.f });
+            pSrc->baseColorTextureIDs.push_back(-1);
+            break;
+        case GLTF_SECTION_MESHES:
+            model.meshes.push_back({});
+            break;
+        case GLTF_SECTION_NODES:
+        {
+            SceneNode node = {};
+            node.scale = glm::vec3(1.f);
+            node.rotation = glm::quat(1.f, 0.f, 0.f, 0.f);
+            node.matrix = glm::mat4(1.f);
+            node.meshID = -1;
+
+            pSrc->nodes.push_back(std::move(node));
+            pSrc->nodeCameras.push_back(-1);
+            break;
+        }
+        case GLTF_SECTION_SCENES:
+            model.scenes.push_back({});
+            break;
+        default:
+            break;
+        }
+    }
+
+    void setNumber(double value)
+    {
+        size_t depth = frames.size();
+
+        if (depth == 1 && section == GLTF_SECTION_SCENE)
+        {
+            pSrc->model.defaultScene = (int)value;
+            return;
+        }
+
+        if (!inElement())
+            return;
+
+        const std::string& field = frames[2].key;
+
+        tinygltf::Model& model = pSrc->model;
+
+        switch (section)
+        {
+        case GLTF_SECTION_ACCESSORS:
+        {
+            if (depth != 3)
+                break;
+
+            auto& accessor = model.accessors.back();
+
+            if (field == "bufferView")
+                accessor.bufferView = (int)value;
+            else if (field == "byteOffset")
+                accessor.byteOffset = (size_t)value;
+            else if (field == "componentType")
+                accessor.componentType = (int)value;
+            else if (field == "count")
+                accessor.count = (size_t)value;
+            break;
+        }
+        case GLTF_SECTION_BUFFER_VIEWS:
+        {
+            if (depth != 3)
+                break;
+
+            auto& bv = model.bufferViews.back();
+
+            if (field == "buffer")
+                bv.buffer = (int)value;
+            else if (field == "byteOffset")
+                bv.byteOffset = (size_t)value;
+            else if (field == "byteLength")
+                bv.byteLength = (size_t)value;
+            else if (field == "byteStride")
+                bv.byteStride = (size_t)value;
+            else if (field == "target")
+                bv.target = (int)value;
+            break;
+        }
+        case GLTF_SECTION_BUFFERS:
+            if (depth == 3 && field == "byteLength")
+                bufferByteLengths.back() = (size_t)value;
+            break;
+        case GLTF_SECTION_IMAGES:
+            if (depth == 3)
+                pSrc->images.back()[field] = (int)value;
+            break;
+        case GLTF_SECTION_MATERIALS:
+        {
+            // pbrMetallicRoughness only, like loadMaterials
+            if (field != "pbrMetallicRoughness" || depth < 4)
+                break;
+
+            Material& mat = pSrc->materials.back();
+
+            if (depth == 4 && isField(3, "metallicFactor"))
+                mat.metalness = (float)value;
+            else if (depth == 4 && isField(3, "roughnessFactor"))
+                mat.roughness = (float)value;
+            else if (depth == 5 && isField(3, "baseColorFactor") && frames[4].index < 4)
+                mat.baseColorFactor[frames[4].index] = (float)value;
+            else if (depth == 5 && isField(3, "baseColorTexture") && isField(4, "index"))
+                pSrc->baseColorTextureIDs.back() = (int)value;
+            break;
+        }
+        case GLTF_SECTION_MESHES:
+        {
+            // primitives[j].{indices, material, mode, attributes.NAME}
+            if (field != "primitives" || depth < 5 || model.meshes.back().primitives.empty())
+                break;
+
+            auto& primitive = model.meshes.back().primitives.back();
+            const std::string& primitiveField = frames[4].key;
+
+            if (depth == 5 && primitiveField == "indices")
+                primitive.indices = (int)value;
+            else if (depth == 5 && primitiveField == "material")
+                primitive.material = (int)value;
+            else if (depth == 5 && primitiveField == "mode")
+                primitive.mode = (int)value;
+            else if (depth == 6 && primitiveField == "attributes")
+                primitive.attributes[frames[5].key] = (int)value;
+            break;
+        }
+        case GLTF_SECTION_NODES:
+        {
+            SceneNode& node = pSrc->nodes.back();
+
+            if (depth == 3)
+            {
+                if (field == "mesh")
+                    node.meshID = (int)value;
+                else if (field == "camera")
+                    pSrc->nodeCameras.back() = (int)value;
+                break;
+            }
+
+            if (depth != 4)
+                break;
+
+            int i = frames[3].index;
+
+            if (field == "children")
+            {
+                node.children.push_back((int)value);
+            }
+            else if (field == "translation" && i < 3)
+            {
+                node.translation[i] = (float)value;
+            }
+            else if (field == "scale" && i < 3)
+            {
+                node.scale[i] = (float)value;
+            }
+            else if (field == "rotation" && i < 4)
+            {
+                // glTF is x, y, z, w
+                float* q[] = { &node.rotation.x, &node.rotation.y, &node.rotation.z, &node.rotation.w };
+                *q[i] = (float)value;
+            }
+            else if (field == "matrix" && i < 16)
+            {
+                node.matrixValid = true;
+                glm::value_ptr(node.matrix)[i] = (float)value;
+            }
+            break;
+        }
+        case GLTF_SECTION_SCENES:
+            if (depth == 4 && field == "nodes")
+                model.scenes.back().nodes.push_back((int)value);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void setString(std::string& value)
+    {
+        if (frames.size() != 3 || !inElement())
+            return;
+
+        const std::string& field = frames[2].key;
+
+        switch (section)
+        {
+        case GLTF_SECTION_ACCESSORS:
+            if (field == "type")
+                pSrc->model.accessors.back().type = getAccessorType(value);
+            break;
+        case GLTF_SECTION_BUFFERS:
+            if (field == "uri")
+                setBufferUri(value);
+            break;
+        case GLTF_SECTION_IMAGES:
+            pSrc->images.back()[field] = std::move(value);
+            break;
+        case GLTF_SECTION_NODES:
+            if (field == "name")
+                pSrc->nodes.back().name = std::move(value);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void setBufferUri(std::string& uri)
+    {
+        size_t bufferID = pSrc->model.buffers.size() - 1;
+        tinygltf::Buffer& buffer = pSrc->model.buffers.back();
+
+        if (uri.compare(0, 5, "data:") != 0)
+        {
+            buffer.uri = std::move(uri);
+            externalBuffers.push_back(bufferID);
+            return;
+        }
+
+        size_t comma = uri.find(',');
+
+        if (comma == std::string::npos || comma < 7 || uri.compare(comma - 7, 7, ";base64") != 0 ||
+            !decodeBase64(uri.data() + comma + 1, uri.size() - comma - 1, buffer.data))
+        {
+            DebugPrint("Error: %s: invalid data URI in buffer %zu\n", fn, bufferID);
+            failed = true;
+            return;
+        }
+
+        // Without the payload, which is in data now
+        buffer.uri.assign(uri, 0, comma + 1);
+        dataUriBuffers.push_back(bufferID);
+    }
+
+    // Events, false stops the parse
+
+    bool null()
+    {
+        beginValue();
+        return !failed;
+    }
+
+    bool boolean(bool)
+    {
+        beginValue();
+        return !failed;
+    }
+
+    bool number_integer(int64_t value)
+    {
+        beginValue();
+        setNumber((double)value);
+        return !failed;
+    }
+
+    bool number_unsigned(uint64_t value)
+    {
+        beginValue();
+        setNumber((double)value);
+        return !failed;
+    }
+
+    bool number_float(double value, const std::string&)
+    {
+        beginValue();
+        setNumber(value);
+        return !failed;
+    }
+
+    bool string(std::string& value)
+    {
+        beginValue();
+        setString(value);
+        return !failed;
+    }
+
+    template <typename Binary>
+    bool binary(Binary&)
+    {
+        beginValue();
+        return !failed;
+    }
+
+    bool start_object(size_t)
+    {
+        beginValue(true);
+
+        // An element of a section, or a primitive of a mesh
+        if (frames.size() == 2 && frames[1].isArray)
+            beginElement();
+        else if (frames.size() == 4 && section == GLTF_SECTION_MESHES && inElement() && isField(2, "primitives"))
+        {
+            tinygltf::Primitive primitive;
+            primitive.mode = TINYGLTF_MODE_TRIANGLES;
+            pSrc->model.meshes.back().primitives.push_back(std::move(primitive));
+        }
+
+        frames.push_back({ false, -1, std::string() });
+        return true;
+    }
+
+    bool key(std::string& key)
+    {
+        frames.back().key = key;
+
+        if (frames.size() == 1)
+            section = getGltfSection(key);
+
+        return true;
+    }
+
+    bool end_object()
+    {
+        frames.pop_back();
+        return true;
+    }
+
+    bool start_array(size_t)
+    {
+        beginValue();
+        frames.push_back({ true, -1, std::string() });
+        return !failed;
+    }
+
+    bool end_array()
+    {
+        frames.pop_back();
+        return true;
+    }
+
+    template <typename Exception>
+    bool parse_error(size_t position, const std::string&, const Exception& e)
+    {
+        DebugPrint("Error: %s: invalid JSON at byte %zu: %s\n", fn, position, e.what());
+        return false;
+    }
+};
+
+bool parseGltfStream(const char* fn, const char* pJson, size_t size, GltfSource* pSrc)
+{
+    pSrc->model.defaultScene = -1;
+    pSrc->images = nlohmann::json::array();
+
+    GltfSaxHandler handler = {};
+    handler.pSrc = pSrc;
+    handler.fn = fn;
+
+    if (!nlohmann::json::sax_parse(pJson, pJson + size, &handler) || handler.failed)
+        return false;
+
+    // The node references the loader follows
+    int nodeCount = (int)pSrc->nodes.size();
+
+    auto isNodeID = [nodeCount](int id) { return id >= 0 && id < nodeCount; };
+
+    for (auto& scene : pSrc->model.scenes)
+    {
+        if (!std::all_of(scene.nodes.begin(), scene.nodes.end(), isNodeID))
+        {
+            DebugPrint("Error: %s: scene refers to a missing node\n", fn);
+            return false;
+        }
+    }
+
+    for (auto& node : pSrc->nodes)
+    {
+        if (!std::all_of(node.children.begin(), node.children.end(), isNodeID))
+        {
+            DebugPrint("Error: %s: node %s refers to a missing child\n", fn, node.name.c_str());
+            return false;
+        }
+    }
+
+    for (size_t bufferID : handler.dataUriBuffers)
+    {
+        // As tinygltf checks the data URIs it decodes
+        if (pSrc->model.buffers[bufferID].data.size() != handler.bufferByteLengths[bufferID])
+        {
+            DebugPrint("Error: %s: data URI of buffer %zu doesn't match its byteLength\n", fn, bufferID);
+            return false;
+        }
+    }
+
+    for (size_t bufferID : handler.externalBuffers)
+    {
+        tinygltf::Buffer& buffer = pSrc->model.buffers[bufferID];
+        std::ifstream in(pSrc->baseDirectory + buffer.uri, std::ios::binary);
+
+        if (!in)
+        {
+            DebugPrint("Error: %s: could not read buffer %s\n", fn, buffer.uri.c_str());
+            return false;
+        }
+
+        buffer.data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+        if (buffer.data.size() != handler.bufferByteLengths[bufferID])
+        {
+            DebugPrint("Error: %s: size of buffer %s doesn't match its byteLength\n", fn, buffer.uri.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+struct GltfSource;
+
+// One pass SAX parse of glTF JSON, without building a DOM.  Fills the
+// model's accessors, buffer views, buffers, meshes and scenes, the node and
+// material tables and the images of pSrc as the values go by.  Base64 data
+// URI buffers are decoded on the spot and external buffers are read from
+// pSrc->baseDirectory afterwards, both must match their byteLength; a
+// buffer without uri (the BIN chunk of a .glb) is left empty.
+bool parseGltfStream(const char* fn, const char* pJson, size_t size, GltfSource* pSrc);
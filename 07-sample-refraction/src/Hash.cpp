@@ -0,0 +1,77 @@
+#include "pch.h"
+
+#include "Hash.h"
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+static uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t load64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input)
+{
+    return rotl64(acc + input * kPrime2, 31) * kPrime1;
+}
+
+static uint64_t mergeRound64(uint64_t acc, uint64_t lane)
+{
+    return (acc ^ round64(0, lane)) * kPrime1 + kPrime4;
+}
+
+uint64_t hashBytes(const void* pData, size_t size, uint64_t seed)
+{
+    const uint8_t* p = (const uint8_t*)pData;
+    const uint8_t* end = p + size;
+
+    uint64_t h;
+
+    if (size >= 32)
+    {
+        // Four independent lanes over 32 byte blocks
+        uint64_t lanes[4] = { seed + kPrime1 + kPrime2, seed + kPrime2, seed, seed - kPrime1 };
+
+        for (; p + 32 <= end; p += 32)
+        {
+            for (int i = 0; i < 4; i++)
+                lanes[i] = round64(lanes[i], load64(p + 8 * i));
+        }
+
+        h = rotl64(lanes[0], 1) + rotl64(lanes[1], 7) + rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+
+        for (int i = 0; i < 4; i++)
+            h = mergeRound64(h, lanes[i]);
+    }
+    else
+    {
+        h = seed + kPrime5;
+    }
+
+    h += size;
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl64(h ^ round64(0, load64(p)), 27) * kPrime1 + kPrime4;
+
+    for (; p < end; p++)
+        h = rotl64(h ^ (*p * kPrime5), 11) * kPrime1;
+
+    // Avalanche
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+
+    return h;
+}
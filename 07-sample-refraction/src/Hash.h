@@ -0,0 +1,6 @@
+#pragma once
+
+// 64 bit non-cryptographic hash (XXH64 style, 8 bytes per step), for content
+// keys of meshes and caches.  Chain calls by passing the previous result
+// as seed.
+uint64_t hashBytes(const void* pData, size_t size, uint64_t seed);
@@ -0,0 +1,222 @@
+#include "pch.h"
+
+#include "JobSystem.h"
+
+static uint64_t packRange(uint32_t begin, uint32_t end)
+{
+    return (uint64_t)begin | ((uint64_t)end << 32);
+}
+
+static bool popJob(JobQueue& queue, uint32_t* pIndex)
+{
+    uint64_t range = queue.range.load();
+
+    for (;;)
+    {
+        uint32_t begin = (uint32_t)range;
+        uint32_t end = (uint32_t)(range >> 32);
+
+        if (begin >= end)
+            return false;
+
+        if (queue.range.compare_exchange_weak(range, packRange(begin + 1, end)))
+        {
+            *pIndex = begin;
+            return true;
+        }
+    }
+}
+
+// Moves the back half of another thread's range into the (empty) queue of
+// threadIndex.  Only the owner refills its own queue and thieves never touch
+// empty ones, so a plain store is enough.
+static bool stealJobs(JobSystem& js, uint32_t threadIndex)
+{
+    for (uint32_t i = 1; i < js.threadCount; i++)
+    {
+        JobQueue& victim = js.queues[(threadIndex + i) % js.threadCount];
+
+        uint64_t range = victim.range.load();
+
+        for (;;)
+        {
+            uint32_t begin = (uint32_t)range;
+            uint32_t end = (uint32_t)(range >> 32);
+
+            if (begin >= end)
+                break;
+
+            uint32_t split = end - (end - begin + 1) / 2;
+
+            if (victim.range.compare_exchange_weak(range, packRange(begin, split)))
+            {
+                js.queues[threadIndex].range.store(packRange(split, end));
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void runJobs(JobSystem& js, const JobFunction& fn, uint32_t threadIndex)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    JobThreadStats stats = {};
+
+    for (;;)
+    {
+        uint32_t index;
+
+        if (popJob(js.queues[threadIndex], &index))
+        {
+            fn(index, threadIndex);
+            stats.jobCount++;
+            continue;
+        }
+
+        if (!stealJobs(js, threadIndex))
+            break;
+
+        stats.stealCount++;
+    }
+
+    // A worker that woke up after everything was done must not touch the
+    // stats, parallelFor may already be reading them.
+    if (stats.jobCount == 0)
+        return;
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    stats.busyMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+    js.threadStats[threadIndex] = stats;
+}
+
+static void workerMain(JobSystem* pJobSystem, uint32_t threadIndex)
+{
+    JobSystem& js = *pJobSystem;
+
+    uint64_t lastBatchID = 0;
+
+    for (;;)
+    {
+        const JobFunction* pFunction = nullptr;
+
+        {
+            std::unique_lock<std::mutex> lock(js.mutex);
+            js.wakeCondition.wait(lock, [&]() { return js.quit || js.batchID != lastBatchID; });
+
+            if (js.quit)
+                return;
+
+            lastBatchID = js.batchID;
+            pFunction = js.pFunction;
+            js.activeWorkers++;
+        }
+
+        runJobs(js, *pFunction, threadIndex);
+
+        {
+            std::lock_guard<std::mutex> lock(js.mutex);
+            js.activeWorkers--;
+
+            if (js.activeWorkers == 0)
+                js.doneCondition.notify_one();
+        }
+    }
+}
+
+bool createJobSystem(const JobSystemCreateInfo& ci, JobSystem* pJobSystem)
+{
+    JobSystem& js = *pJobSystem;
+
+    js.threadCount = ci.threadCount;
+
+    if (js.threadCount == 0)
+        js.threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    js.pFunction = nullptr;
+    js.jobCount = 0;
+    js.batchID = 0;
+    js.activeWorkers = 0;
+    js.quit = false;
+
+    js.queues = std::vector<JobQueue>(js.threadCount);
+    js.threadStats.assign(js.threadCount, {});
+
+    for (auto& queue : js.queues)
+        queue.range = 0;
+
+    js.workers.reserve(js.threadCount - 1);
+
+    for (uint32_t i = 1; i < js.threadCount; i++)
+        js.workers.emplace_back(workerMain, &js, i);
+
+    return true;
+}
+
+void destroyJobSystem(JobSystem& js)
+{
+    {
+        std::lock_guard<std::mutex> lock(js.mutex);
+        js.quit = true;
+    }
+
+    js.wakeCondition.notify_all();
+
+    for (auto& t : js.workers)
+        t.join();
+
+    js.workers.clear();
+}
+
+void parallelFor(JobSystem& js, uint32_t count, const JobFunction& fn)
+{
+    if (count == 0)
+        return;
+
+    js.threadStats.assign(js.threadCount, {});
+
+    if (js.workers.empty() || count == 1)
+    {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        for (uint32_t i = 0; i < count; i++)
+            fn(i, 0);
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+
+        js.threadStats[0].jobCount = count;
+        js.threadStats[0].busyMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+        return;
+    }
+
+    {
+        // A worker can still be leaving the previous batch (it woke up after
+        // all of its jobs were already taken).
+        std::unique_lock<std::mutex> lock(js.mutex);
+        js.doneCondition.wait(lock, [&]() { return js.activeWorkers == 0; });
+
+        for (uint32_t t = 0; t < js.threadCount; t++)
+        {
+            uint32_t begin = (uint32_t)((uint64_t)count * t / js.threadCount);
+            uint32_t end = (uint32_t)((uint64_t)count * (t + 1) / js.threadCount);
+
+            js.queues[t].range = packRange(begin, end);
+        }
+
+        js.pFunction = &fn;
+        js.jobCount = count;
+        js.batchID++;
+    }
+
+    js.wakeCondition.notify_all();
+
+    runJobs(js, fn, 0);
+
+    // Workers that joined this batch may still be running their last job.
+    std::unique_lock<std::mutex> lock(js.mutex);
+    js.doneCondition.wait(lock, [&]() { return js.activeWorkers == 0; });
+}
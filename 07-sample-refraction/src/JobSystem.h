@@ -0,0 +1,58 @@
+#pragma once
+
+// fn(index, threadIndex).  threadIndex is in [0, threadCount) and can be used
+// to index per-thread scratch data.  The calling thread is threadIndex 0.
+typedef std::function<void(uint32_t, uint32_t)> JobFunction;
+
+// Jobs of a batch are split into one contiguous range per thread.  A thread
+// runs its own range front to back and, once it is empty, steals the back
+// half of another thread's range.
+struct alignas(64) JobQueue
+{
+    std::atomic<uint64_t> range; // begin | end << 32
+};
+
+struct JobThreadStats
+{
+    uint32_t jobCount;
+    uint32_t stealCount;
+    double busyMs; // time spent running and looking for jobs
+};
+
+struct JobSystem
+{
+    uint32_t threadCount; // including the calling thread
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+
+    // Current batch.  Only changed under the mutex while no worker is active.
+    const JobFunction* pFunction;
+    uint32_t jobCount;
+    uint64_t batchID;
+    uint32_t activeWorkers;
+
+    std::vector<JobQueue> queues; // one per thread
+
+    // Of the last parallelFor
+    std::vector<JobThreadStats> threadStats;
+
+    bool quit;
+};
+
+struct JobSystemCreateInfo
+{
+    uint32_t threadCount; // 0 -> std::thread::hardware_concurrency()
+};
+
+bool createJobSystem(const JobSystemCreateInfo& ci, JobSystem* pJobSystem);
+
+void destroyJobSystem(JobSystem& js);
+
+// Runs fn for every index in [0, count) and returns when all are done.
+// Thread t starts with indices [count * t / threadCount, count * (t + 1) / threadCount),
+// so neighbouring indices tend to run on the same thread.
+void parallelFor(JobSystem& js, uint32_t count, const JobFunction& fn);
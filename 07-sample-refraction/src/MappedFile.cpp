@@ -0,0 +1,60 @@
+#include "pch.h"
+
+#include "MappedFile.h"
+
+bool mapFile(const char* filename, MappedFile* pFile)
+{
+    MappedFile& file = *pFile;
+    file = {};
+
+    HANDLE fileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+
+    // Empty files can't be mapped
+    if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (!mappingHandle)
+    {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    void* pData = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+
+    if (!pData)
+    {
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    file.pData = (const uint8_t*)pData;
+    file.size = (size_t)size.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mappingHandle = mappingHandle;
+
+    return true;
+}
+
+void unmapFile(MappedFile& file)
+{
+    if (!file.pData)
+        return;
+
+    UnmapViewOfFile(file.pData);
+    CloseHandle((HANDLE)file.mappingHandle);
+    CloseHandle((HANDLE)file.fileHandle);
+
+    file = {};
+}
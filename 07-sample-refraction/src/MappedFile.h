@@ -0,0 +1,18 @@
+#pragma once
+
+// Read only memory mapping of a whole file.  The pages are loaded on first
+// touch and shared with the OS file cache, so nothing is copied up front.
+
+struct MappedFile
+{
+    const uint8_t* pData; // null if not mapped
+    size_t size;
+
+    void* fileHandle;
+    void* mappingHandle;
+};
+
+bool mapFile(const char* filename, MappedFile* pFile);
+
+// Does nothing for a file that isn't mapped
+void unmapFile(MappedFile& file);
@@ -0,0 +1,711 @@
+#include "pch.h"
+
+#include "logging.h"
+#include "PacketCpu.h"
+
+// Bounds of the packet rays, for the conservative whole-packet test
+struct PacketFrustum
+{
+    float originMin[3];
+    float originMax[3];
+    float invDirectionMin[3];
+    float invDirectionMax[3];
+    bool positive[3]; // sign of the directions on each axis
+
+    float tmin;
+};
+
+struct PacketStackEntry
+{
+    uint32_t node;
+    uint32_t mask;
+};
+
+static uint32_t lowestBit(uint32_t mask)
+{
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (uint32_t)index;
+}
+
+static bool computeFrustum(const RayPacketCpu& packet, PacketFrustum* pFrustum)
+{
+    PacketFrustum& f = *pFrustum;
+
+    f.tmin = FLT_MAX;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        f.originMin[axis] = FLT_MAX;
+        f.originMax[axis] = -FLT_MAX;
+        f.invDirectionMin[axis] = FLT_MAX;
+        f.invDirectionMax[axis] = -FLT_MAX;
+    }
+
+    uint32_t negativeMask[3] = {};
+    uint32_t mask = packet.activeMask;
+
+    while (mask)
+    {
+        uint32_t i = lowestBit(mask);
+        mask &= mask - 1;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float invDirection = packet.invDirection[axis][i];
+
+            // Zero components make the interval products NaN
+            if (std::isinf(invDirection))
+                return false;
+
+            f.originMin[axis] = std::min(f.originMin[axis], packet.origin[axis][i]);
+            f.originMax[axis] = std::max(f.originMax[axis], packet.origin[axis][i]);
+            f.invDirectionMin[axis] = std::min(f.invDirectionMin[axis], invDirection);
+            f.invDirectionMax[axis] = std::max(f.invDirectionMax[axis], invDirection);
+
+            negativeMask[axis] |= (invDirection < 0.f ? 1u : 0u) << i;
+        }
+
+        f.tmin = std::min(f.tmin, packet.tmin[i]);
+    }
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (negativeMask[axis] != 0 && negativeMask[axis] != packet.activeMask)
+            return false;
+
+        f.positive[axis] = negativeMask[axis] == 0;
+    }
+
+    return true;
+}
+
+// preparePacketCpu, also returning the frustum it checked
+static bool preparePacket(RayPacketCpu& packet, PacketFrustum* pFrustum)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (uint32_t i = 0; i < kPacketSize; i++)
+            packet.invDirection[axis][i] = 1.f / packet.direction[axis][i];
+    }
+
+    return packet.activeMask != 0 && computeFrustum(packet, pFrustum);
+}
+
+bool preparePacketCpu(RayPacketCpu& packet)
+{
+    PacketFrustum frustum;
+    return preparePacket(packet, &frustum);
+}
+
+// True if no ray of the packet can hit the box
+static bool frustumMissesAabb(const PacketFrustum& f, const glm::vec3& boundsMin,
+    const glm::vec3& boundsMax, float tmax)
+{
+    float enter = f.tmin;
+    float exit = tmax;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float nearPlane = f.positive[axis] ? boundsMin[axis] : boundsMax[axis];
+        float farPlane = f.positive[axis] ? boundsMax[axis] : boundsMin[axis];
+
+        // [plane - originMax, plane - originMin] * [invDirectionMin, invDirectionMax]
+        float n0 = (nearPlane - f.originMax[axis]) * f.invDirectionMin[axis];
+        float n1 = (nearPlane - f.originMax[axis]) * f.invDirectionMax[axis];
+        float n2 = (nearPlane - f.originMin[axis]) * f.invDirectionMin[axis];
+        float n3 = (nearPlane - f.originMin[axis]) * f.invDirectionMax[axis];
+
+        float f0 = (farPlane - f.originMax[axis]) * f.invDirectionMin[axis];
+        float f1 = (farPlane - f.originMax[axis]) * f.invDirectionMax[axis];
+        float f2 = (farPlane - f.originMin[axis]) * f.invDirectionMin[axis];
+        float f3 = (farPlane - f.originMin[axis]) * f.invDirectionMax[axis];
+
+        enter = std::max(enter, std::min(std::min(n0, n1), std::min(n2, n3)));
+        exit = std::min(exit, std::max(std::max(f0, f1), std::max(f2, f3)));
+    }
+
+    return enter > exit;
+}
+
+// Slab test of every active ray, 4 at a time
+static uint32_t intersectPacketAabb(const RayPacketCpu& packet, uint32_t mask,
+    const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    const __m128 bminX = _mm_set1_ps(boundsMin.x);
+    const __m128 bminY = _mm_set1_ps(boundsMin.y);
+    const __m128 bminZ = _mm_set1_ps(boundsMin.z);
+    const __m128 bmaxX = _mm_set1_ps(boundsMax.x);
+    const __m128 bmaxY = _mm_set1_ps(boundsMax.y);
+    const __m128 bmaxZ = _mm_set1_ps(boundsMax.z);
+
+    uint32_t result = 0;
+
+    for (uint32_t base = 0; base < kPacketSize; base += 4)
+    {
+        if (((mask >> base) & 0xF) == 0)
+            continue;
+
+        __m128 ox = _mm_load_ps(&packet.origin[0][base]);
+        __m128 oy = _mm_load_ps(&packet.origin[1][base]);
+        __m128 oz = _mm_load_ps(&packet.origin[2][base]);
+        __m128 idx = _mm_load_ps(&packet.invDirection[0][base]);
+        __m128 idy = _mm_load_ps(&packet.invDirection[1][base]);
+        __m128 idz = _mm_load_ps(&packet.invDirection[2][base]);
+
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(bminX, ox), idx);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(bminY, oy), idy);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(bminZ, oz), idz);
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(bmaxX, ox), idx);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(bmaxY, oy), idy);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(bmaxZ, oz), idz);
+
+        __m128 enter = _mm_max_ps(
+            _mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+            _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_load_ps(&packet.tmin[base])));
+        __m128 exit = _mm_min_ps(
+            _mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+            _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_load_ps(&packet.tmax[base])));
+
+        result |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(enter, exit)) << base;
+    }
+
+    return result & mask;
+}
+
+// intersectTriangleEdges() for every ray of mask, 4 lanes at a time.  The
+// comparisons are negated like the scalar early outs, so NaNs pass the same
+// way.  Returns the lanes that hit and, if pT isn't null, their t/u/v.
+static uint32_t intersectPacketTriangle(const RayPacketCpu& packet, uint32_t mask,
+    const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float* pT, float* pU, float* pV)
+{
+    const glm::vec3 e1 = p1 - p0;
+    const glm::vec3 e2 = p2 - p0;
+
+    const __m128 p0x = _mm_set1_ps(p0.x);
+    const __m128 p0y = _mm_set1_ps(p0.y);
+    const __m128 p0z = _mm_set1_ps(p0.z);
+    const __m128 e1x = _mm_set1_ps(e1.x);
+    const __m128 e1y = _mm_set1_ps(e1.y);
+    const __m128 e1z = _mm_set1_ps(e1.z);
+    const __m128 e2x = _mm_set1_ps(e2.x);
+    const __m128 e2y = _mm_set1_ps(e2.y);
+    const __m128 e2z = _mm_set1_ps(e2.z);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+
+    uint32_t result = 0;
+
+    for (uint32_t base = 0; base < kPacketSize; base += 4)
+    {
+        if (((mask >> base) & 0xF) == 0)
+            continue;
+
+        __m128 dx = _mm_load_ps(&packet.direction[0][base]);
+        __m128 dy = _mm_load_ps(&packet.direction[1][base]);
+        __m128 dz = _mm_load_ps(&packet.direction[2][base]);
+
+        // pvec = cross(direction, e2), det = dot(e1, pvec)
+        __m128 pvx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(e2y, dz));
+        __m128 pvy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(e2z, dx));
+        __m128 pvz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(e2x, dy));
+
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, pvx), _mm_mul_ps(e1y, pvy)), _mm_mul_ps(e1z, pvz));
+        __m128 invDet = _mm_div_ps(one, det);
+
+        __m128 tvx = _mm_sub_ps(_mm_load_ps(&packet.origin[0][base]), p0x);
+        __m128 tvy = _mm_sub_ps(_mm_load_ps(&packet.origin[1][base]), p0y);
+        __m128 tvz = _mm_sub_ps(_mm_load_ps(&packet.origin[2][base]), p0z);
+
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tvx, pvx), _mm_mul_ps(tvy, pvy)),
+            _mm_mul_ps(tvz, pvz)), invDet);
+
+        // qvec = cross(tvec, e1)
+        __m128 qvx = _mm_sub_ps(_mm_mul_ps(tvy, e1z), _mm_mul_ps(e1y, tvz));
+        __m128 qvy = _mm_sub_ps(_mm_mul_ps(tvz, e1x), _mm_mul_ps(e1z, tvx));
+        __m128 qvz = _mm_sub_ps(_mm_mul_ps(tvx, e1y), _mm_mul_ps(e1x, tvy));
+
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qvx), _mm_mul_ps(dy, qvy)),
+            _mm_mul_ps(dz, qvz)), invDet);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qvx), _mm_mul_ps(e2y, qvy)),
+            _mm_mul_ps(e2z, qvz)), invDet);
+
+        __m128 hit = _mm_cmpneq_ps(det, zero);
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpnlt_ps(u, zero), _mm_cmpngt_ps(u, one)));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpnlt_ps(v, zero), _mm_cmpngt_ps(_mm_add_ps(u, v), one)));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpnlt_ps(t, _mm_load_ps(&packet.tmin[base])),
+            _mm_cmpnge_ps(t, _mm_load_ps(&packet.tmax[base]))));
+
+        result |= (uint32_t)_mm_movemask_ps(hit) << base;
+
+        if (pT)
+        {
+            _mm_store_ps(&pT[base], t);
+            _mm_store_ps(&pU[base], u);
+            _mm_store_ps(&pV[base], v);
+        }
+    }
+
+    return result & mask;
+}
+
+static float maxActiveTmax(const RayPacketCpu& packet, uint32_t mask)
+{
+    float tmax = -FLT_MAX;
+
+    while (mask)
+    {
+        uint32_t i = lowestBit(mask);
+        mask &= mask - 1;
+
+        tmax = std::max(tmax, packet.tmax[i]);
+    }
+
+    return tmax;
+}
+
+// Packet version of intersectBvhCpu().  Updates packet.tmax and pHits for
+// the rays that found a closer hit and returns them.
+static uint32_t intersectPacketBvh(const BvhCpu& bvh, RayPacketCpu& packet,
+    const PacketFrustum& frustum, HitCpu* pHits)
+{
+    const BvhNode* nodes = bvh.pNodes;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+    const uint32_t* indices = bvh.indices;
+    const glm::vec3* positions = bvh.positions;
+
+    uint32_t hitMask = 0;
+
+    PacketStackEntry stack[kMaxBvhDepth];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = { 0, packet.activeMask };
+
+    while (stackSize > 0)
+    {
+        PacketStackEntry entry = stack[--stackSize];
+        const BvhNode& node = nodes[entry.node];
+
+        if (frustumMissesAabb(frustum, node.boundsMin, node.boundsMax,
+            maxActiveTmax(packet, entry.mask)))
+            continue;
+
+        uint32_t mask = intersectPacketAabb(packet, entry.mask, node.boundsMin, node.boundsMax);
+
+        if (mask == 0)
+            continue;
+
+        if (node.primCount > 0)
+        {
+            for (uint32_t p = node.offset; p < node.offset + node.primCount; p++)
+            {
+                uint32_t prim = primIndices[p];
+
+                const glm::vec3& p0 = positions[indices[3 * prim + 0]];
+                const glm::vec3& p1 = positions[indices[3 * prim + 1]];
+                const glm::vec3& p2 = positions[indices[3 * prim + 2]];
+
+                alignas(16) float t[kPacketSize];
+                alignas(16) float u[kPacketSize];
+                alignas(16) float v[kPacketSize];
+
+                uint32_t rays = intersectPacketTriangle(packet, mask, p0, p1, p2, t, u, v);
+
+                while (rays)
+                {
+                    uint32_t i = lowestBit(rays);
+                    rays &= rays - 1;
+
+                    packet.tmax[i] = t[i];
+                    hitMask |= 1u << i;
+
+                    pHits[i].t = t[i];
+                    pHits[i].u = u[i];
+                    pHits[i].v = v[i];
+                    pHits[i].primitiveID = prim;
+                }
+            }
+
+            continue;
+        }
+
+        uint32_t left = entry.node + 1;
+        uint32_t right = node.offset;
+
+        // Near child first, judged by the packet direction along the axis
+        // that separates the children most.
+        glm::vec3 delta = (nodes[right].boundsMin + nodes[right].boundsMax) -
+            (nodes[left].boundsMin + nodes[left].boundsMax);
+        glm::vec3 absDelta = glm::abs(delta);
+
+        int axis = absDelta.x > absDelta.y ? (absDelta.x > absDelta.z ? 0 : 2) : (absDelta.y > absDelta.z ? 1 : 2);
+
+        if ((delta[axis] > 0.f) != frustum.positive[axis])
+            std::swap(left, right);
+
+        stack[stackSize++] = { right, mask };
+        stack[stackSize++] = { left, mask };
+    }
+
+    return hitMask;
+}
+
+// Any hit version of intersectPacketBvh(): the active rays blocked by a
+// triangle, traversal stops for each ray at its first hit
+static uint32_t occludedPacketBvh(const BvhCpu& bvh, const RayPacketCpu& packet,
+    const PacketFrustum& frustum)
+{
+    const BvhNode* nodes = bvh.pNodes;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+    const uint32_t* indices = bvh.indices;
+    const glm::vec3* positions = bvh.positions;
+
+    uint32_t occluded = 0;
+
+    PacketStackEntry stack[kMaxBvhDepth];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = { 0, packet.activeMask };
+
+    while (stackSize > 0)
+    {
+        PacketStackEntry entry = stack[--stackSize];
+        const BvhNode& node = nodes[entry.node];
+
+        uint32_t live = entry.mask & ~occluded;
+
+        if (live == 0 || frustumMissesAabb(frustum, node.boundsMin, node.boundsMax, maxActiveTmax(packet, live)))
+            continue;
+
+        uint32_t mask = intersectPacketAabb(packet, live, node.boundsMin, node.boundsMax);
+
+        if (mask == 0)
+            continue;
+
+        if (node.primCount > 0)
+        {
+            for (uint32_t p = node.offset; p < node.offset + node.primCount && (mask & ~occluded); p++)
+            {
+                uint32_t prim = primIndices[p];
+
+                const glm::vec3& p0 = positions[indices[3 * prim + 0]];
+                const glm::vec3& p1 = positions[indices[3 * prim + 1]];
+                const glm::vec3& p2 = positions[indices[3 * prim + 2]];
+
+                occluded |= intersectPacketTriangle(packet, mask & ~occluded, p0, p1, p2, nullptr, nullptr, nullptr);
+            }
+
+            if (occluded == packet.activeMask)
+                break;
+
+            continue;
+        }
+
+        stack[stackSize++] = { node.offset, mask };
+        stack[stackSize++] = { entry.node + 1, mask };
+    }
+
+    return occluded;
+}
+
+static RayCpu getPacketRay(const RayPacketCpu& packet, uint32_t i)
+{
+    RayCpu ray;
+    ray.origin = glm::vec3(packet.origin[0][i], packet.origin[1][i], packet.origin[2][i]);
+    ray.direction = glm::vec3(packet.direction[0][i], packet.direction[1][i], packet.direction[2][i]);
+    ray.tmin = packet.tmin[i];
+    ray.tmax = packet.tmax[i];
+
+    return ray;
+}
+
+// Same transform as the single ray path, so t is the same in both spaces
+static void transformPacket(const TlasInstanceCpu& instance, const RayPacketCpu& packet, uint32_t mask,
+    RayPacketCpu* pObjectPacket)
+{
+    RayPacketCpu& objectPacket = *pObjectPacket;
+    objectPacket.activeMask = mask;
+
+    for (uint32_t i = 0; i < kPacketSize; i++)
+    {
+        glm::vec3 origin(packet.origin[0][i], packet.origin[1][i], packet.origin[2][i]);
+        glm::vec3 direction(packet.direction[0][i], packet.direction[1][i], packet.direction[2][i]);
+
+        origin = transformPoint3x4(instance.worldToObject, origin);
+        direction = transformVector3x4(instance.worldToObject, direction);
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            objectPacket.origin[axis][i] = origin[axis];
+            objectPacket.direction[axis][i] = direction[axis];
+        }
+
+        objectPacket.tmin[i] = packet.tmin[i];
+        objectPacket.tmax[i] = packet.tmax[i];
+    }
+}
+
+static uint32_t intersectPacketInstance(const TlasCpu& tlas, uint32_t instanceID,
+    RayPacketCpu& packet, uint32_t mask, HitCpu* pHits)
+{
+    const TlasInstanceCpu& instance = tlas.instances[instanceID];
+    const BvhCpu& blas = tlas.pBlas[instance.blasIndex];
+
+    RayPacketCpu objectPacket;
+    transformPacket(instance, packet, mask, &objectPacket);
+
+    uint32_t hitMask = 0;
+
+    PacketFrustum frustum;
+
+    if (preparePacket(objectPacket, &frustum))
+    {
+        hitMask = intersectPacketBvh(blas, objectPacket, frustum, pHits);
+    }
+    else
+    {
+        // The transform made the packet incoherent, trace the rays one by one
+        uint32_t rays = mask;
+
+        while (rays)
+        {
+            uint32_t i = lowestBit(rays);
+            rays &= rays - 1;
+
+            if (intersectBvhCpu(blas, getPacketRay(objectPacket, i), false, &pHits[i]))
+            {
+                objectPacket.tmax[i] = pHits[i].t;
+                hitMask |= 1u << i;
+            }
+        }
+    }
+
+    uint32_t rays = hitMask;
+
+    while (rays)
+    {
+        uint32_t i = lowestBit(rays);
+        rays &= rays - 1;
+
+        packet.tmax[i] = objectPacket.tmax[i];
+        pHits[i].instanceID = instanceID;
+    }
+
+    return hitMask;
+}
+
+uint32_t intersectPacketTlasCpu(const TlasCpu& tlas, const RayPacketCpu& worldPacket,
+    uint32_t cullMask, HitCpu* pHits)
+{
+    const BvhCpu& bvh = tlas.bvh;
+
+    if (bvh.nodeCount == 0 || worldPacket.activeMask == 0)
+        return 0;
+
+    RayPacketCpu packet = worldPacket;
+
+    PacketFrustum frustum;
+    bool coherent = computeFrustum(packet, &frustum);
+
+    BASSERT(coherent);
+
+    if (!coherent)
+        return 0;
+
+    const BvhNode* nodes = bvh.pNodes;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+
+    uint32_t hitMask = 0;
+
+    PacketStackEntry stack[kMaxBvhDepth];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = { 0, packet.activeMask };
+
+    while (stackSize > 0)
+    {
+        PacketStackEntry entry = stack[--stackSize];
+        const BvhNode& node = nodes[entry.node];
+
+        if (frustumMissesAabb(frustum, node.boundsMin, node.boundsMax,
+            maxActiveTmax(packet, entry.mask)))
+            continue;
+
+        uint32_t mask = intersectPacketAabb(packet, entry.mask, node.boundsMin, node.boundsMax);
+
+        if (mask == 0)
+            continue;
+
+        if (node.primCount > 0)
+        {
+            for (uint32_t p = node.offset; p < node.offset + node.primCount; p++)
+            {
+                uint32_t instanceID = primIndices[p];
+
+                if ((tlas.instances[instanceID].mask & cullMask) == 0)
+                    continue;
+
+                hitMask |= intersectPacketInstance(tlas, instanceID, packet, mask, pHits);
+            }
+
+            continue;
+        }
+
+        uint32_t left = entry.node + 1;
+        uint32_t right = node.offset;
+
+        glm::vec3 delta = (nodes[right].boundsMin + nodes[right].boundsMax) -
+            (nodes[left].boundsMin + nodes[left].boundsMax);
+        glm::vec3 absDelta = glm::abs(delta);
+
+        int axis = absDelta.x > absDelta.y ? (absDelta.x > absDelta.z ? 0 : 2) : (absDelta.y > absDelta.z ? 1 : 2);
+
+        if ((delta[axis] > 0.f) != frustum.positive[axis])
+            std::swap(left, right);
+
+        stack[stackSize++] = { right, mask };
+        stack[stackSize++] = { left, mask };
+    }
+
+    return hitMask;
+}
+
+// The rays of mask the instance blocks
+static uint32_t occludedPacketInstance(const TlasCpu& tlas, uint32_t instanceID,
+    const RayPacketCpu& packet, uint32_t mask)
+{
+    const TlasInstanceCpu& instance = tlas.instances[instanceID];
+
+    RayPacketCpu objectPacket;
+    transformPacket(instance, packet, mask, &objectPacket);
+
+    PacketFrustum frustum;
+
+    if (preparePacket(objectPacket, &frustum))
+        return occludedPacketBvh(tlas.pBlas[instance.blasIndex], objectPacket, frustum);
+
+    uint32_t occluded = 0;
+    uint32_t rays = mask;
+
+    while (rays)
+    {
+        uint32_t i = lowestBit(rays);
+        rays &= rays - 1;
+
+        RayCpu ray = getPacketRay(objectPacket, i);
+
+        bool blocked = tlas.pWideBlas ?
+            occludedWideBvhCpu(tlas.pWideBlas[instance.blasIndex], ray) :
+            occludedBvhCpu(tlas.pBlas[instance.blasIndex], ray);
+
+        occluded |= blocked ? 1u << i : 0u;
+    }
+
+    return occluded;
+}
+
+// Every instance node is fetched once for the packet, rays drop out as soon
+// as they are blocked
+static uint32_t occludedPacketTlas(const TlasCpu& tlas, const RayPacketCpu& packet,
+    const PacketFrustum& frustum, uint32_t cullMask)
+{
+    const BvhCpu& bvh = tlas.bvh;
+
+    if (bvh.nodeCount == 0)
+        return 0;
+
+    const BvhNode* nodes = bvh.pNodes;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+
+    uint32_t occluded = 0;
+
+    PacketStackEntry stack[kMaxBvhDepth];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = { 0, packet.activeMask };
+
+    while (stackSize > 0)
+    {
+        PacketStackEntry entry = stack[--stackSize];
+        const BvhNode& node = nodes[entry.node];
+
+        uint32_t live = entry.mask & ~occluded;
+
+        if (live == 0 || frustumMissesAabb(frustum, node.boundsMin, node.boundsMax, maxActiveTmax(packet, live)))
+            continue;
+
+        uint32_t mask = intersectPacketAabb(packet, live, node.boundsMin, node.boundsMax);
+
+        if (mask == 0)
+            continue;
+
+        if (node.primCount > 0)
+        {
+            for (uint32_t p = node.offset; p < node.offset + node.primCount && (mask & ~occluded); p++)
+            {
+                uint32_t instanceID = primIndices[p];
+
+                if ((tlas.instances[instanceID].mask & cullMask) == 0)
+                    continue;
+
+                occluded |= occludedPacketInstance(tlas, instanceID, packet, mask & ~occluded);
+            }
+
+            if (occluded == packet.activeMask)
+                break;
+
+            continue;
+        }
+
+        stack[stackSize++] = { node.offset, mask };
+        stack[stackSize++] = { entry.node + 1, mask };
+    }
+
+    return occluded;
+}
+
+void occludedPacketsCpu(const TlasCpu& tlas, const RayCpu* pRays, uint32_t rayCount,
+    uint32_t cullMask, uint32_t* pOccludedMask)
+{
+    static_assert(32 % kPacketSize == 0, "packets must not straddle mask words");
+
+    memset(pOccludedMask, 0, (rayCount + 31) / 32 * sizeof(uint32_t));
+
+    for (uint32_t base = 0; base < rayCount; base += kPacketSize)
+    {
+        uint32_t count = std::min(kPacketSize, rayCount - base);
+
+        // Unused lanes repeat the last ray so every lane holds a valid ray
+        RayPacketCpu packet;
+        packet.activeMask = (1u << count) - 1;
+
+        for (uint32_t i = 0; i < kPacketSize; i++)
+        {
+            const RayCpu& ray = pRays[base + std::min(i, count - 1)];
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                packet.origin[axis][i] = ray.origin[axis];
+                packet.direction[axis][i] = ray.direction[axis];
+            }
+
+            packet.tmin[i] = ray.tmin;
+            packet.tmax[i] = ray.tmax;
+        }
+
+        uint32_t occluded = 0;
+        PacketFrustum frustum;
+
+        if (preparePacket(packet, &frustum))
+        {
+            occluded = occludedPacketTlas(tlas, packet, frustum, cullMask);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < count; i++)
+                occluded |= occludedTlasCpu(tlas, pRays[base + i], cullMask) ? 1u << i : 0u;
+        }
+
+        pOccludedMask[base / 32] |= occluded << (base % 32);
+    }
+}
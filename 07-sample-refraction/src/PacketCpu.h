@@ -0,0 +1,41 @@
+#pragma once
+
+#include "TlasCpu.h"
+
+// Packets of coherent rays (4x4 pixels of primary rays) traced together
+// through the TLAS and BLASes.  Each node is first tested against the
+// whole packet with interval arithmetic (a conservative frustum test), then
+// against the rays that are still active.
+
+const uint32_t kPacketWidth = 4;
+const uint32_t kPacketHeight = 4;
+const uint32_t kPacketSize = kPacketWidth * kPacketHeight;
+
+struct alignas(16) RayPacketCpu
+{
+    float origin[3][kPacketSize];
+    float direction[3][kPacketSize];
+    float invDirection[3][kPacketSize];
+    float tmin[kPacketSize];
+    float tmax[kPacketSize];
+
+    uint32_t activeMask; // rays outside the image are inactive
+};
+
+// Rays in the packet must have been set, fills invDirection.  Returns false
+// if the directions don't share their signs per axis, in which case the
+// frustum test doesn't hold and the rays should be traced one by one.
+bool preparePacketCpu(RayPacketCpu& packet);
+
+// Closest hits for the active rays.  pHits has kPacketSize entries, the
+// returned mask has a bit set for every ray that hit.
+uint32_t intersectPacketTlasCpu(const TlasCpu& tlas, const RayPacketCpu& packet,
+    uint32_t cullMask, HitCpu* pHits);
+
+// Occlusion for a batch of rays, e.g. the shadow rays of a tile.  Runs of
+// kPacketSize rays whose directions share their signs (rays towards one
+// light do) are traced as packets, the others one by one.  Bit i of
+// pOccludedMask, which has (rayCount + 31) / 32 words, is set if pRays[i]
+// is blocked.
+void occludedPacketsCpu(const TlasCpu& tlas, const RayCpu* pRays, uint32_t rayCount,
+    uint32_t cullMask, uint32_t* pOccludedMask);
@@ -0,0 +1,201 @@
+#pragma once
+
+// Ray/hit types and intersection primitives shared by the CPU raytracer.
+
+struct RayCpu
+{
+    glm::vec3 origin;
+    float tmin;
+    glm::vec3 direction;
+    float tmax;
+};
+
+// Same data the hit shaders get: gl_HitTNV, HitAttribs, gl_InstanceID and
+// gl_PrimitiveID.
+struct HitCpu
+{
+    float t;
+    float u;
+    float v;
+    uint32_t instanceID;
+    uint32_t primitiveID;
+};
+
+// Moller-Trumbore, no backface culling (matches the opaque, non-culled
+// geometry in the TLAS).  u/v are the barycentrics of p1 and p2, as in
+// HitAttribs.  Accepts t in [tmin, tmax).  e1 = p1 - p0, e2 = p2 - p0.
+inline bool intersectTriangleEdges(const glm::vec3& origin, const glm::vec3& direction,
+    const glm::vec3& p0, const glm::vec3& e1, const glm::vec3& e2,
+    float tmin, float tmax, float* pT, float* pU, float* pV)
+{
+    glm::vec3 pvec = glm::cross(direction, e2);
+    float det = glm::dot(e1, pvec);
+
+    if (det == 0.f)
+        return false;
+
+    float invDet = 1.f / det;
+
+    glm::vec3 tvec = origin - p0;
+    float u = glm::dot(tvec, pvec) * invDet;
+
+    if (u < 0.f || u > 1.f)
+        return false;
+
+    glm::vec3 qvec = glm::cross(tvec, e1);
+    float v = glm::dot(direction, qvec) * invDet;
+
+    if (v < 0.f || u + v > 1.f)
+        return false;
+
+    float t = glm::dot(e2, qvec) * invDet;
+
+    if (t < tmin || t >= tmax)
+        return false;
+
+    *pT = t;
+    *pU = u;
+    *pV = v;
+
+    return true;
+}
+
+// Hit/no hit only: the tests are scaled by det instead of dividing, and no
+// barycentrics or t are returned.
+inline bool occludesTriangle(const glm::vec3& origin, const glm::vec3& direction,
+    const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float tmin, float tmax)
+{
+    glm::vec3 e1 = p1 - p0;
+    glm::vec3 e2 = p2 - p0;
+
+    glm::vec3 pvec = glm::cross(direction, e2);
+    float det = glm::dot(e1, pvec);
+
+    if (det == 0.f)
+        return false;
+
+    float sign = det < 0.f ? -1.f : 1.f;
+    float absDet = det * sign;
+
+    glm::vec3 tvec = origin - p0;
+    float u = glm::dot(tvec, pvec) * sign;
+
+    if (u < 0.f || u > absDet)
+        return false;
+
+    glm::vec3 qvec = glm::cross(tvec, e1);
+    float v = glm::dot(direction, qvec) * sign;
+
+    if (v < 0.f || u + v > absDet)
+        return false;
+
+    float t = glm::dot(e2, qvec) * sign;
+
+    return t >= tmin * absDet && t < tmax * absDet;
+}
+
+inline bool intersectTriangle(const glm::vec3& origin, const glm::vec3& direction,
+    const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+    float tmin, float tmax, float* pT, float* pU, float* pV)
+{
+    return intersectTriangleEdges(origin, direction, p0, p1 - p0, p2 - p0, tmin, tmax, pT, pU, pV);
+}
+
+// Precomputed triangle (Baldwin-Weber style): rows of the affine transform
+// into a space where the triangle is the unit triangle in the z = 0 plane,
+// p0 at the origin, p1 at x = 1 and p2 at y = 1.  x and y of a point in that
+// space are the barycentrics u and v.  xyz = row, w = translation.
+struct TriangleRecord
+{
+    glm::vec4 rows[3];
+};
+
+// Degenerate triangles get an all zero record, which never hits
+inline TriangleRecord makeTriangleRecord(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+{
+    glm::vec3 e1 = p1 - p0;
+    glm::vec3 e2 = p2 - p0;
+    glm::vec3 n = glm::cross(e1, e2);
+
+    TriangleRecord record = {};
+
+    if (glm::dot(n, n) == 0.f)
+        return record;
+
+    // Rows of the inverse of the matrix with columns e1, e2, n
+    float invDet = 1.f / glm::dot(e1, glm::cross(e2, n));
+
+    glm::vec3 rows[3] = {
+        glm::cross(e2, n) * invDet,
+        glm::cross(n, e1) * invDet,
+        n * invDet,
+    };
+
+    for (int i = 0; i < 3; i++)
+        record.rows[i] = glm::vec4(rows[i], -glm::dot(rows[i], p0));
+
+    return record;
+}
+
+// Same conventions as intersectTriangle(): u/v of p1 and p2, t in [tmin, tmax)
+inline bool intersectTriangleRecord(const glm::vec3& origin, const glm::vec3& direction,
+    const TriangleRecord& record, float tmin, float tmax, float* pT, float* pU, float* pV)
+{
+    const glm::vec4& r0 = record.rows[0];
+    const glm::vec4& r1 = record.rows[1];
+    const glm::vec4& r2 = record.rows[2];
+
+    float oz = r2.x * origin.x + r2.y * origin.y + r2.z * origin.z + r2.w;
+    float dz = r2.x * direction.x + r2.y * direction.y + r2.z * direction.z;
+
+    float t = -oz / dz;
+
+    // Also rejects the NaN of parallel rays and degenerate triangles
+    if (!(t >= tmin && t < tmax))
+        return false;
+
+    glm::vec3 p = origin + direction * t;
+
+    float u = r0.x * p.x + r0.y * p.y + r0.z * p.z + r0.w;
+
+    if (u < 0.f || u > 1.f)
+        return false;
+
+    float v = r1.x * p.x + r1.y * p.y + r1.z * p.z + r1.w;
+
+    if (v < 0.f || u + v > 1.f)
+        return false;
+
+    *pT = t;
+    *pU = u;
+    *pV = v;
+
+    return true;
+}
+
+// Slab test.  invDirection = 1 / direction (inf for zero components).
+// pEnter receives the distance at which the ray enters the box.
+inline bool intersectAabb(const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+    const glm::vec3& origin, const glm::vec3& invDirection, float tmin, float tmax,
+    float* pEnter)
+{
+    glm::vec3 t0 = (boundsMin - origin) * invDirection;
+    glm::vec3 t1 = (boundsMax - origin) * invDirection;
+
+    glm::vec3 tnear = glm::min(t0, t1);
+    glm::vec3 tfar = glm::max(t0, t1);
+
+    float enter = std::max(std::max(tnear.x, tnear.y), std::max(tnear.z, tmin));
+    float exit = std::min(std::min(tfar.x, tfar.y), std::min(tfar.z, tmax));
+
+    *pEnter = enter;
+
+    return enter <= exit;
+}
+
+inline bool intersectAabb(const glm::vec3& boundsMin, const glm::vec3& boundsMax,
+    const glm::vec3& origin, const glm::vec3& invDirection, float tmin, float tmax)
+{
+    float enter;
+    return intersectAabb(boundsMin, boundsMax, origin, invDirection, tmin, tmax, &enter);
+}
@@ -0,0 +1,1292 @@
+#include "pch.h"
+
+#include "App.h"
+#include "logging.h"
+#include "gltfLoader.h"
+#include "JobSystem.h"
+#include "BvhCpu.h"
+#include "PacketCpu.h"
+#include "BvhCache.h"
+#include "VertexFormat.h"
+#include "RaytracerCpu.h"
+
+#pragma warning(push)
+#pragma warning(disable : 4996) // sprintf unsafe
+#include "stb_image_write.h"
+#pragma warning(pop)
+
+const uint32_t kTileSize = 16;
+
+// Meshes with fewer triangles are built concurrently, one per job
+const uint32_t kParallelBvhMinPrims = 1 << 16;
+
+static const glm::vec3 kSkyBlue = glm::vec3(0.529f, 0.808f, 0.922f);
+static const glm::vec3 kToLight = glm::normalize(glm::vec3(1.f, 1.f, 1.f));
+
+// shader-common.h
+struct RayPayload
+{
+    glm::vec4 colorDistance;
+    glm::vec4 normal;
+    int depth;
+};
+
+struct alignas(64) ThreadContext
+{
+    const RaytracerCpu* pRaytracer;
+    RaytracerCpuStats stats;
+};
+
+static glm::vec3 srgbToLinear(const glm::vec3& c)
+{
+    return glm::pow(c, glm::vec3(2.2f));
+}
+
+static glm::vec3 linearToSrgb(const glm::vec3& c)
+{
+    return glm::pow(c, glm::vec3(1.f / 2.2f));
+}
+
+static glm::vec3 transformVector(const glm::mat4& m, const glm::vec3& v)
+{
+    return glm::vec3(m * glm::vec4(v, 0.f));
+}
+
+static glm::vec3 fetchTexel(const TextureData& tex, int x, int y)
+{
+    // VK_SAMPLER_ADDRESS_MODE_REPEAT
+    x %= (int)tex.width;
+    y %= (int)tex.height;
+    x = x < 0 ? x + (int)tex.width : x;
+    y = y < 0 ? y + (int)tex.height : y;
+
+    const uint8_t* p = &tex.pixels[((size_t)y * tex.width + x) * 4];
+
+    return glm::vec3(p[0], p[1], p[2]) * (1.f / 255.f);
+}
+
+// Bilinear, single mip (loadImages doesn't generate mips)
+static glm::vec3 sampleTexture(const TextureData& tex, const glm::vec2& uv)
+{
+    float x = uv.x * tex.width - 0.5f;
+    float y = uv.y * tex.height - 0.5f;
+
+    float fx = floorf(x);
+    float fy = floorf(y);
+
+    int x0 = (int)fx;
+    int y0 = (int)fy;
+
+    float ax = x - fx;
+    float ay = y - fy;
+
+    glm::vec3 t00 = fetchTexel(tex, x0, y0);
+    glm::vec3 t10 = fetchTexel(tex, x0 + 1, y0);
+    glm::vec3 t01 = fetchTexel(tex, x0, y0 + 1);
+    glm::vec3 t11 = fetchTexel(tex, x0 + 1, y0 + 1);
+
+    return glm::mix(glm::mix(t00, t10, ax), glm::mix(t01, t11, ax), ay);
+}
+
+// traceNV(Scene, flags, cullMask, ...)
+static bool intersectScene(const RaytracerCpu& rt, const RayCpu& ray, uint32_t cullMask,
+    bool anyHit, HitCpu* pHit)
+{
+    return intersectTlasCpu(rt.tlas, ray, cullMask, anyHit, pHit);
+}
+
+// traceNV with gl_RayFlagsTerminateOnFirstHitNV and no closest hit shader
+static bool occludedScene(const RaytracerCpu& rt, const RayCpu& ray, uint32_t cullMask)
+{
+    return occludedTlasCpu(rt.tlas, ray, cullMask);
+}
+
+static void traceRay(ThreadContext& ctx, const RayCpu& ray, RayPayload& payload);
+
+// Everything chit.rchit computes before deciding whether to recurse
+struct SurfaceHit
+{
+    glm::vec3 color;
+    glm::vec3 normal; // N, flipped to face the ray
+
+    // Reflective or transmissive, secondary is the ray chit.rchit would
+    // trace (if the depth allows it).
+    bool bounce;
+    RayCpu secondary;
+};
+
+static void evaluateSurface(const RaytracerCpu& rt, const RayCpu& ray, const HitCpu& hit,
+    SurfaceHit* pSurface)
+{
+    const Scene& scene = *rt.pScene;
+    const InstanceCpu& instance = rt.instances[hit.instanceID];
+    const Mesh& mesh = scene.meshes[instance.meshID];
+
+    // getFaceIndex()
+    uint32_t i0 = mesh.indexData[3 * hit.primitiveID + 0];
+    uint32_t i1 = mesh.indexData[3 * hit.primitiveID + 1];
+    uint32_t i2 = mesh.indexData[3 * hit.primitiveID + 2];
+
+    // getBarycentric()
+    glm::vec3 barycentric(1.f - hit.u - hit.v, hit.u, hit.v);
+
+    glm::vec3 baseColor = glm::vec3(1.f, 1.f, 1.f);
+
+    int materialID = instance.materialID;
+
+    glm::vec2 uv =
+        getVertexUv(mesh, i0) * barycentric.x +
+        getVertexUv(mesh, i1) * barycentric.y +
+        getVertexUv(mesh, i2) * barycentric.z;
+
+    bool transmissive = false;
+
+    if (materialID >= 0)
+    {
+        int textureID = scene.baseColorTextureIDs[materialID];
+
+        glm::vec3 baseColorSample = textureID >= 0 ?
+            sampleTexture(scene.textureData[textureID], uv) : glm::vec3(1.f);
+        baseColorSample = srgbToLinear(baseColorSample);
+
+        const Material& m = scene.materials[materialID];
+        baseColor = baseColorSample * glm::vec3(m.baseColorFactor);
+
+        // Treat as transmissive
+        if (m.baseColorFactor.a < 0.5f)
+            transmissive = true;
+    }
+
+    // getGeometricNormalWS()
+    glm::vec3 p0 = mesh.positionData[i0];
+    glm::vec3 p1 = mesh.positionData[i1];
+    glm::vec3 p2 = mesh.positionData[i2];
+
+    glm::vec3 geoN = glm::normalize(glm::cross(p1 - p0, p2 - p0));
+    geoN = glm::normalize(transformVector(instance.objectToWorld, geoN));
+
+    // getNormalWS()
+    glm::vec3 n = glm::normalize(
+        getVertexNormal(mesh, i0) * barycentric.x +
+        getVertexNormal(mesh, i1) * barycentric.y +
+        getVertexNormal(mesh, i2) * barycentric.z);
+
+    glm::vec3 N = glm::normalize(transformVector(instance.objectToWorld, n));
+
+    bool inside = false;
+
+    if (glm::dot(geoN, ray.direction) > 0.f)
+    {
+        N = -N;
+        inside = true;
+    }
+
+    float ndotl = std::max(0.f, glm::dot(N, kToLight));
+
+    if (inside)
+        ndotl = 1.f;
+
+    SurfaceHit& surface = *pSurface;
+
+    surface.color = glm::vec3(ndotl * baseColor + 0.1f);
+    surface.normal = N;
+    surface.bounce = baseColor.r < 1.f || transmissive;
+
+    if (!surface.bounce)
+        return;
+
+    glm::vec3 hitPos = ray.origin + ray.direction * hit.t;
+
+    RayCpu& secondary = surface.secondary;
+    secondary.tmin = 0.001f;
+    secondary.tmax = 1000.f;
+
+    if (transmissive)
+    {
+        // Air -> Heavy flint glass
+        float eta = 1.0029f / 1.65f;
+
+        glm::vec3 worldDir = glm::normalize(ray.direction);
+
+        eta = inside ? 1.f / eta : eta;
+
+        secondary.origin = hitPos;
+        secondary.direction = glm::refract(worldDir, N, eta);
+
+        float chk = glm::dot(secondary.direction, glm::vec3(1.f));
+
+        // Total Internal Reflection.  The shader also clears the payload
+        // color here, but the traceNV that follows overwrites it.
+        if (!(fabsf(chk) > 0.f))
+        {
+            secondary.origin = hitPos + N * 0.01f;
+            secondary.direction = glm::reflect(ray.direction, N);
+        }
+    }
+    else
+    {
+        secondary.origin = hitPos + N * 0.01f;
+        secondary.direction = glm::reflect(ray.direction, N);
+    }
+}
+
+// chit.rchit
+static void closestHit(ThreadContext& ctx, const RayCpu& ray, const HitCpu& hit, RayPayload& payload)
+{
+    SurfaceHit surface;
+    evaluateSurface(*ctx.pRaytracer, ray, hit, &surface);
+
+    payload.depth += 1;
+
+    if (surface.bounce && payload.depth < kMaxDepth)
+    {
+        traceRay(ctx, surface.secondary, payload);
+
+        payload.colorDistance *= glm::vec4(surface.color, 1.f);
+
+        ctx.stats.secondaryRays++;
+    }
+    else
+    {
+        payload.colorDistance = glm::vec4(surface.color, hit.t);
+        payload.normal = glm::vec4(surface.normal, 0.f);
+    }
+
+    payload.depth -= 1;
+}
+
+// Either chit.rchit or miss.rmiss, pHit is null on a miss
+static void shadeRay(ThreadContext& ctx, const RayCpu& ray, const HitCpu* pHit, RayPayload& payload)
+{
+    if (pHit)
+    {
+        closestHit(ctx, ray, *pHit, payload);
+    }
+    else
+    {
+        // miss.rmiss
+        payload.colorDistance = glm::vec4(kSkyBlue, -1.f);
+    }
+}
+
+// traceNV(Scene, gl_RayFlagsOpaqueNV, 0xFF, 0, 0, 0, ...)
+static void traceRay(ThreadContext& ctx, const RayCpu& ray, RayPayload& payload)
+{
+    HitCpu hit;
+    bool found = intersectScene(*ctx.pRaytracer, ray, 0xFF, false, &hit);
+
+    shadeRay(ctx, ray, found ? &hit : nullptr, payload);
+}
+
+// raygen.rgen, up to traceNV
+static RayCpu makePrimaryRay(const RaytracerCpu& rt, const CameraUniformData& cameraData,
+    uint32_t x, uint32_t y)
+{
+    glm::vec2 pixelRaster = glm::vec2((float)x, (float)y);
+    glm::vec2 imageSize = glm::vec2((float)rt.width, (float)rt.height);
+
+    glm::vec2 pixelNDC = (pixelRaster + glm::vec2(0.5f)) / imageSize;
+
+    glm::vec2 pixelSS = pixelNDC * 2.f - 1.f;
+    pixelSS.y = 1.f - 2.f * pixelNDC.y;
+
+    glm::vec4 pixelCS = cameraData.projInverse * glm::vec4(pixelSS.x, pixelSS.y, 0.f, 1.f);
+
+    glm::vec4 directionCS = glm::vec4(glm::normalize(glm::vec3(pixelCS)), 0.f);
+
+    glm::vec4 directionWS = cameraData.viewInverse * directionCS;
+    glm::vec4 originWS = cameraData.viewInverse * glm::vec4(0.f, 0.f, 0.f, 1.f);
+
+    RayCpu primary;
+    primary.origin = glm::vec3(originWS);
+    primary.direction = glm::vec3(directionWS);
+    primary.tmin = 0.001f;
+    primary.tmax = 10000.f;
+
+    return primary;
+}
+
+// raygen.rgen, from the primary hit on
+static glm::vec3 shadePrimary(ThreadContext& ctx, const RayCpu& primary, const HitCpu* pHit)
+{
+    const RaytracerCpu& rt = *ctx.pRaytracer;
+
+    RayPayload payload = {};
+    payload.depth = 0;
+
+    shadeRay(ctx, primary, pHit, payload);
+    ctx.stats.primaryRays++;
+
+    glm::vec3 hitColor = glm::vec3(payload.colorDistance);
+    float hitDistance = payload.colorDistance.w;
+
+    if (hitDistance >= 0.f)
+    {
+        glm::vec3 hitPos = primary.origin + primary.direction * hitDistance;
+
+        RayCpu shadow;
+        shadow.origin = hitPos;
+        shadow.direction = kToLight;
+        shadow.tmin = 2.f; // ?? adjusted for colored-sphere scene
+        shadow.tmax = 10000.f;
+
+        if (occludedScene(rt, shadow, 0xFF))
+        {
+            // In shadow
+            hitColor *= 0.3f;
+        }
+
+        ctx.stats.shadowRays++;
+    }
+
+    return linearToSrgb(hitColor);
+}
+
+static uint32_t packColor(const glm::vec3& c)
+{
+    glm::vec3 v = glm::clamp(c, 0.f, 1.f) * 255.f + 0.5f;
+
+    return (uint32_t)v.x | ((uint32_t)v.y << 8) | ((uint32_t)v.z << 16) | 0xFF000000;
+}
+
+// Calls fn(x, y, ray, pHit) for every pixel of the tile, pHit is null on a
+// miss.  Primary rays go in 4x4 packets when enabled.
+template<typename PixelFunction>
+static void tracePrimaryTile(ThreadContext& ctx, const CameraUniformData& cameraData,
+    uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, PixelFunction fn)
+{
+    const RaytracerCpu& rt = *ctx.pRaytracer;
+
+    if (!rt.packets)
+    {
+        for (uint32_t y = y0; y < y1; y++)
+        {
+            for (uint32_t x = x0; x < x1; x++)
+            {
+                RayCpu primary = makePrimaryRay(rt, cameraData, x, y);
+
+                HitCpu hit;
+                bool found = intersectScene(rt, primary, 0xFF, false, &hit);
+
+                fn(x, y, primary, found ? &hit : nullptr);
+            }
+        }
+
+        return;
+    }
+
+    for (uint32_t py = y0; py < y1; py += kPacketHeight)
+    {
+        for (uint32_t px = x0; px < x1; px += kPacketWidth)
+        {
+            RayPacketCpu packet;
+            packet.activeMask = 0;
+
+            RayCpu rays[kPacketSize];
+
+            for (uint32_t i = 0; i < kPacketSize; i++)
+            {
+                uint32_t x = px + i % kPacketWidth;
+                uint32_t y = py + i / kPacketWidth;
+
+                if (x < x1 && y < y1)
+                    packet.activeMask |= 1u << i;
+
+                // Lanes outside the tile repeat an edge pixel and are ignored
+                rays[i] = makePrimaryRay(rt, cameraData, std::min(x, x1 - 1), std::min(y, y1 - 1));
+
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    packet.origin[axis][i] = rays[i].origin[axis];
+                    packet.direction[axis][i] = rays[i].direction[axis];
+                }
+
+                packet.tmin[i] = rays[i].tmin;
+                packet.tmax[i] = rays[i].tmax;
+            }
+
+            HitCpu hits[kPacketSize];
+            uint32_t hitMask = 0;
+
+            if (preparePacketCpu(packet))
+            {
+                hitMask = intersectPacketTlasCpu(rt.tlas, packet, 0xFF, hits);
+                ctx.stats.primaryPackets++;
+            }
+            else
+            {
+                for (uint32_t i = 0; i < kPacketSize; i++)
+                {
+                    if ((packet.activeMask & (1u << i)) &&
+                        intersectScene(rt, rays[i], 0xFF, false, &hits[i]))
+                        hitMask |= 1u << i;
+                }
+
+                ctx.stats.packetFallbacks++;
+            }
+
+            for (uint32_t i = 0; i < kPacketSize; i++)
+            {
+                if (!(packet.activeMask & (1u << i)))
+                    continue;
+
+                fn(px + i % kPacketWidth, py + i / kPacketWidth, rays[i],
+                    (hitMask & (1u << i)) ? &hits[i] : nullptr);
+            }
+        }
+    }
+}
+
+static uint32_t compactBits(uint32_t v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+
+// d -> (x, y) on a n x n Hilbert curve, n a power of two
+static void hilbertToXY(uint32_t n, uint32_t d, uint32_t* pX, uint32_t* pY)
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+
+    for (uint32_t s = 1; s < n; s *= 2)
+    {
+        uint32_t rx = 1 & (d / 2);
+        uint32_t ry = 1 & (d ^ rx);
+
+        if (ry == 0)
+        {
+            if (rx == 1)
+            {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+
+            std::swap(x, y);
+        }
+
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+
+    *pX = x;
+    *pY = y;
+}
+
+static void computeTileOrder(uint32_t tilesX, uint32_t tilesY, TileOrder order,
+    std::vector<uint32_t>& tiles)
+{
+    tiles.clear();
+    tiles.reserve(tilesX * tilesY);
+
+    if (order == TILE_ORDER_ROWS)
+    {
+        for (uint32_t y = 0; y < tilesY; y++)
+            for (uint32_t x = 0; x < tilesX; x++)
+                tiles.push_back(x | (y << 16));
+
+        return;
+    }
+
+    // Walk the curve over the enclosing power of two square, skipping the
+    // tiles outside the image.
+    uint32_t n = 1;
+
+    while (n < tilesX || n < tilesY)
+        n *= 2;
+
+    for (uint32_t d = 0; d < n * n; d++)
+    {
+        uint32_t x, y;
+
+        if (order == TILE_ORDER_MORTON)
+        {
+            x = compactBits(d);
+            y = compactBits(d >> 1);
+        }
+        else
+        {
+            hilbertToXY(n, d, &x, &y);
+        }
+
+        if (x < tilesX && y < tilesY)
+            tiles.push_back(x | (y << 16));
+    }
+
+    BASSERT(tiles.size() == tilesX * tilesY);
+}
+
+// Same instances as createScene(): one per node
+static void updateInstances(RaytracerCpu& rt, std::vector<VkGeometryInstance>& geometryInstances)
+{
+    const Scene& scene = *rt.pScene;
+
+    rt.instances.resize(scene.nodes.size());
+    geometryInstances.resize(scene.nodes.size());
+
+    for (size_t i = 0; i < scene.nodes.size(); i++)
+    {
+        const SceneNode& node = scene.nodes[i];
+        const Mesh& mesh = scene.meshes[node.meshID];
+        InstanceCpu& instance = rt.instances[i];
+
+        // BONI TODO: handle child nodes
+        BASSERT(node.children.size() == 0);
+
+        // The geometry may be shared, the material is the node's mesh's
+        instance.objectToWorld = getNodeMatrix(node);
+        instance.meshID = mesh.geometryID;
+        instance.materialID = mesh.materialID;
+
+        glm::mat4 TRS = glm::transpose(instance.objectToWorld);
+
+        VkGeometryInstance& geometryInstance = geometryInstances[i];
+        memcpy(geometryInstance.transform, glm::value_ptr(TRS), sizeof(geometryInstance.transform));
+        geometryInstance.instanceCustomIndex = 0;
+        geometryInstance.mask = 0xFF;
+        geometryInstance.instanceOffset = 0;
+        geometryInstance.flags = 0;
+        geometryInstance.accelerationStructureHandle = mesh.geometryID;
+    }
+}
+
+bool createRaytracerCpu(const RaytracerCpuCreateInfo& ci, RaytracerCpu* pRaytracer)
+{
+    RaytracerCpu& rt = *pRaytracer;
+    const Scene& scene = *ci.pScene;
+
+    rt.pScene = ci.pScene;
+    rt.pJobSystem = ci.pJobSystem;
+    rt.width = ci.width;
+    rt.height = ci.height;
+    rt.packets = ci.packets;
+    rt.wavefront = ci.wavefront || ci.sortRays;
+    rt.sortRays = ci.sortRays;
+    rt.queues.resize(kMaxDepth + 1);
+
+    computeTileOrder((ci.width + kTileSize - 1) / kTileSize, (ci.height + kTileSize - 1) / kTileSize,
+        ci.tileOrder, rt.tiles);
+    rt.image.resize((size_t)ci.width * ci.height);
+    rt.stats = {};
+
+    // Mesh::blas equivalent.  Large meshes with an LBVH mode are built one
+    // after the other, each with the whole job system, every other mesh is
+    // one job of a parallelFor.  With a cache directory BLASes are mapped
+    // from there if possible, the built ones are added.  Meshes sharing
+    // another one's geometry (Mesh::geometryID) get no BLAS.
+    auto blasStartTime = std::chrono::high_resolution_clock::now();
+
+    uint32_t meshCount = (uint32_t)scene.meshes.size();
+
+    rt.blas.resize(meshCount);
+    rt.blasCreateInfos.resize(meshCount);
+
+    std::vector<uint8_t> blasBuilt(meshCount, 0);
+    std::vector<uint32_t> concurrentMeshes;
+
+    auto buildBlas = [&](uint32_t meshIndex, JobSystem* pJobSystem) {
+        const Mesh& mesh = scene.meshes[meshIndex];
+
+        BvhCpuCreateInfo bvhInfo = {};
+        bvhInfo.positions = mesh.positionData;
+        bvhInfo.vertexCount = mesh.vertexCount;
+        bvhInfo.indices = mesh.indexData;
+        bvhInfo.indexCount = mesh.indexCount;
+        bvhInfo.mode = ci.pMeshBuildModes ? ci.pMeshBuildModes[meshIndex] : ci.bvhBuildMode;
+        bvhInfo.pJobSystem = pJobSystem;
+        bvhInfo.splitBudget = ci.sbvhSplitBudget;
+        bvhInfo.maxMemoryBytes = ci.sbvhMaxMemoryBytes;
+        bvhInfo.triangleRecords = ci.triangleRecords;
+
+        rt.blasCreateInfos[meshIndex] = bvhInfo;
+        rt.blasCreateInfos[meshIndex].pJobSystem = nullptr;
+
+        if (ci.bvhCacheDirectory && loadBvhCache(ci.bvhCacheDirectory, bvhInfo, &rt.blas[meshIndex]))
+        {
+            blasBuilt[meshIndex] = 2;
+            return;
+        }
+
+        blasBuilt[meshIndex] = createBvhCpu(bvhInfo, &rt.blas[meshIndex]) ? 1 : 0;
+
+        if (blasBuilt[meshIndex] && ci.bvhCacheDirectory)
+            saveBvhCache(ci.bvhCacheDirectory, bvhInfo, rt.blas[meshIndex]);
+    };
+
+    for (uint32_t i = 0; i < meshCount; i++)
+    {
+        if (scene.meshes[i].geometryID != (int)i)
+            continue;
+
+        BvhBuildMode mode = ci.pMeshBuildModes ? ci.pMeshBuildModes[i] : ci.bvhBuildMode;
+
+        // Only the LBVH builders use the job system (createBvhCpu)
+        bool lbvh = mode == BVH_BUILD_LBVH || mode == BVH_BUILD_LBVH_SAH;
+
+        if (lbvh && scene.meshes[i].indexCount / 3 >= kParallelBvhMinPrims)
+            buildBlas(i, rt.pJobSystem);
+        else
+            concurrentMeshes.push_back(i);
+    }
+
+    parallelFor(*rt.pJobSystem, (uint32_t)concurrentMeshes.size(), [&](uint32_t index, uint32_t) {
+        buildBlas(concurrentMeshes[index], nullptr);
+    });
+
+    double blasTimeMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - blasStartTime).count();
+
+    uint32_t cachedCount = 0;
+    uint32_t blasCount = 0;
+
+    for (uint32_t i = 0; i < meshCount; i++)
+    {
+        if (scene.meshes[i].geometryID != (int)i)
+            continue;
+
+        if (!blasBuilt[i])
+        {
+            DebugPrint("Error: could not build BVH for mesh %u\n", i);
+            return false;
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "mesh %u (%s%s)", i,
+            getBvhBuildModeName(ci.pMeshBuildModes ? ci.pMeshBuildModes[i] : ci.bvhBuildMode),
+            blasBuilt[i] == 2 ? ", cached" : "");
+        printBvhStats(rt.blas[i].stats, name);
+
+        cachedCount += blasBuilt[i] == 2 ? 1 : 0;
+        blasCount++;
+    }
+
+    DebugPrint("BLAS: %u of %u meshes (%u from the cache) in %.2f ms\n", blasCount, meshCount, cachedCount,
+        blasTimeMs);
+
+    // Optional wide BVHs over the binary ones
+    rt.bvhWidth = ci.bvhWidth;
+    rt.quantizeBvh = ci.quantizeBvh;
+
+    if (ci.bvhWidth > 2)
+    {
+        rt.wideBlas.resize(rt.blas.size());
+
+        for (size_t i = 0; i < rt.blas.size(); i++)
+        {
+            if (scene.meshes[i].geometryID != (int)i)
+                continue;
+
+            if (!createWideBvhCpu({ &rt.blas[i], ci.bvhWidth, ci.quantizeBvh }, &rt.wideBlas[i]))
+            {
+                DebugPrint("Error: could not build wide BVH for mesh %zu\n", i);
+                return false;
+            }
+
+            char name[32];
+            snprintf(name, sizeof(name), "mesh %zu", i);
+            printWideBvhStats(rt.wideBlas[i], name);
+        }
+    }
+
+    std::vector<VkGeometryInstance> geometryInstances;
+    updateInstances(rt, geometryInstances);
+
+    if (!createTlasCpu({ geometryInstances.data(), (uint32_t)geometryInstances.size(),
+        rt.blas.data(), (uint32_t)rt.blas.size(),
+        rt.wideBlas.empty() ? nullptr : rt.wideBlas.data() }, &rt.tlas))
+    {
+        DebugPrint("Error: could not build TLAS\n");
+        return false;
+    }
+
+    return true;
+}
+
+void destroyRaytracerCpu(RaytracerCpu& rt)
+{
+    destroyTlasCpu(rt.tlas);
+
+    for (auto& wideBvh : rt.wideBlas)
+        destroyWideBvhCpu(wideBvh);
+
+    for (auto& bvh : rt.blas)
+        destroyBvhCpu(bvh);
+
+    rt.wideBlas.clear();
+    rt.blas.clear();
+    rt.blasCreateInfos.clear();
+    rt.instances.clear();
+    rt.image.clear();
+}
+
+bool updateRaytracerCpu(RaytracerCpu& rt, const RaytracerCpuUpdateInfo& ui, RaytracerCpuUpdateStats* pStats)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    const Scene& scene = *rt.pScene;
+    RaytracerCpuUpdateStats stats = {};
+
+    // Refit the deformed BLASes, or rebuild the ones whose SAH cost has
+    // degraded too far
+    std::vector<uint8_t> rebuilt(ui.meshCount, 0);
+
+    parallelFor(*rt.pJobSystem, ui.meshCount, [&](uint32_t index, uint32_t) {
+        uint32_t meshIndex = ui.pMeshIndices[index];
+        const Mesh& mesh = scene.meshes[meshIndex];
+        BvhCpu& blas = rt.blas[meshIndex];
+
+        BASSERT(mesh.geometryID == (int)meshIndex);
+
+        BASSERT(mesh.vertexCount == rt.blasCreateInfos[meshIndex].vertexCount);
+
+        refitBvhCpu(blas, mesh.positionData, nullptr);
+
+        if (shouldRebuildBvhCpu(blas, ui.maxSahRatio))
+        {
+            BvhCpuCreateInfo& bvhInfo = rt.blasCreateInfos[meshIndex];
+            bvhInfo.positions = mesh.positionData;
+
+            destroyBvhCpu(blas);
+            rebuilt[index] = createBvhCpu(bvhInfo, &blas) ? 1 : 2;
+        }
+
+        // The wide BVHs are collapsed from the binary ones again, which is
+        // about as cheap as a refit
+        if (!rt.wideBlas.empty())
+        {
+            destroyWideBvhCpu(rt.wideBlas[meshIndex]);
+
+            if (!createWideBvhCpu({ &blas, rt.bvhWidth, rt.quantizeBvh }, &rt.wideBlas[meshIndex]))
+                rebuilt[index] = 2;
+        }
+    });
+
+    for (uint32_t i = 0; i < ui.meshCount; i++)
+    {
+        if (rebuilt[i] == 2)
+        {
+            DebugPrint("Error: could not rebuild BVH for mesh %u\n", ui.pMeshIndices[i]);
+            return false;
+        }
+
+        if (rebuilt[i])
+            stats.blasRebuilds++;
+        else
+            stats.blasRefits++;
+    }
+
+    // The TLAS bounds depend on both the transforms and the BLAS roots
+    if (ui.nodesChanged || ui.meshCount > 0)
+    {
+        std::vector<VkGeometryInstance> geometryInstances;
+        updateInstances(rt, geometryInstances);
+
+        bool tlasRebuilt;
+
+        if (!refitTlasCpu(rt.tlas, geometryInstances.data(), (uint32_t)geometryInstances.size(),
+            ui.maxSahRatio, &tlasRebuilt))
+        {
+            DebugPrint("Error: could not rebuild TLAS\n");
+            return false;
+        }
+
+        stats.tlasRebuilt = tlasRebuilt;
+        stats.tlasSahCost = rt.tlas.bvh.stats.sahCost;
+        stats.tlasBuiltSahCost = rt.tlas.bvh.stats.builtSahCost;
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    stats.timeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+    if (pStats)
+        *pStats = stats;
+
+    return true;
+}
+
+// parallelFor that adds the job stats to the frame totals
+static void runStage(RaytracerCpu& rt, uint32_t count, const JobFunction& fn)
+{
+    JobSystem& js = *rt.pJobSystem;
+
+    parallelFor(js, count, fn);
+
+    for (uint32_t i = 0; i < js.threadCount; i++)
+    {
+        rt.threadJobStats[i].jobCount += js.threadStats[i].jobCount;
+        rt.threadJobStats[i].stealCount += js.threadStats[i].stealCount;
+        rt.threadJobStats[i].busyMs += js.threadStats[i].busyMs;
+    }
+}
+
+static void getTileRect(const RaytracerCpu& rt, uint32_t tileIndex,
+    uint32_t* pX0, uint32_t* pY0, uint32_t* pX1, uint32_t* pY1)
+{
+    *pX0 = (rt.tiles[tileIndex] & 0xFFFF) * kTileSize;
+    *pY0 = (rt.tiles[tileIndex] >> 16) * kTileSize;
+    *pX1 = std::min(*pX0 + kTileSize, rt.width);
+    *pY1 = std::min(*pY0 + kTileSize, rt.height);
+}
+
+static void resizeRayQueue(RayQueueCpu& queue, uint32_t capacity)
+{
+    for (int axis = 0; axis < 3; axis++)
+    {
+        queue.origin[axis].resize(capacity);
+        queue.direction[axis].resize(capacity);
+        queue.parentColor[axis].resize(capacity);
+    }
+
+    queue.tmin.resize(capacity);
+    queue.tmax.resize(capacity);
+    queue.pixel.resize(capacity);
+    queue.count = 0;
+}
+
+static RayCpu loadQueuedRay(const RayQueueCpu& queue, uint32_t index)
+{
+    RayCpu ray;
+    ray.origin = glm::vec3(queue.origin[0][index], queue.origin[1][index], queue.origin[2][index]);
+    ray.direction = glm::vec3(queue.direction[0][index], queue.direction[1][index], queue.direction[2][index]);
+    ray.tmin = queue.tmin[index];
+    ray.tmax = queue.tmax[index];
+
+    return ray;
+}
+
+// kRaySortCellBits bits per axis of Morton code over the scene bounds, below the direction
+// octant: rays in one bin start close together and go the same way, so
+// they tend to visit the same BVH nodes.
+const uint32_t kRaySortCellBits = 4;
+const uint32_t kRaySortBinCount = 8u << (3 * kRaySortCellBits);
+
+static uint32_t spreadBits3(uint32_t v)
+{
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+static uint32_t getRaySortKey(const RayQueueCpu& queue, uint32_t index,
+    const glm::vec3& boundsMin, const glm::vec3& cellScale)
+{
+    uint32_t key = 0;
+    uint32_t octant = 0;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float cell = (queue.origin[axis][index] - boundsMin[axis]) * cellScale[axis];
+        uint32_t c = (uint32_t)std::min(std::max(cell, 0.f), (float)((1 << kRaySortCellBits) - 1));
+
+        key |= spreadBits3(c) << axis;
+        octant |= (queue.direction[axis][index] < 0.f ? 1u : 0u) << axis;
+    }
+
+    return octant << (3 * kRaySortCellBits) | key;
+}
+
+// Counting sort of the queue by bin.  Pixels move with their rays, so the
+// order doesn't change the image.
+static void sortRayQueue(RaytracerCpu& rt, RayQueueCpu& queue)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    glm::vec3 boundsMin(0.f);
+    glm::vec3 cellScale(0.f);
+
+    if (rt.tlas.bvh.nodeCount > 0)
+    {
+        const BvhNode& root = rt.tlas.bvh.pNodes[0];
+        boundsMin = root.boundsMin;
+        cellScale = (float)(1 << kRaySortCellBits) / glm::max(root.boundsMax - root.boundsMin, glm::vec3(1e-6f));
+    }
+
+    std::vector<uint32_t>& keys = rt.sortKeys;
+    std::vector<uint32_t>& offsets = rt.sortOffsets;
+
+    keys.resize(queue.count);
+    offsets.assign(kRaySortBinCount, 0);
+
+    for (uint32_t i = 0; i < queue.count; i++)
+    {
+        keys[i] = getRaySortKey(queue, i, boundsMin, cellScale);
+        offsets[keys[i]]++;
+    }
+
+    uint32_t sum = 0;
+
+    for (uint32_t bin = 0; bin < kRaySortBinCount; bin++)
+    {
+        uint32_t count = offsets[bin];
+        offsets[bin] = sum;
+        sum += count;
+
+        rt.stats.sortBins += count > 0 ? 1 : 0;
+    }
+
+    RayQueueCpu& sorted = rt.sortQueue;
+    resizeRayQueue(sorted, queue.count);
+
+    for (uint32_t i = 0; i < queue.count; i++)
+    {
+        uint32_t dst = offsets[keys[i]]++;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            sorted.origin[axis][dst] = queue.origin[axis][i];
+            sorted.direction[axis][dst] = queue.direction[axis][i];
+            sorted.parentColor[axis][dst] = queue.parentColor[axis][i];
+        }
+
+        sorted.tmin[dst] = queue.tmin[i];
+        sorted.tmax[dst] = queue.tmax[i];
+        sorted.pixel[dst] = queue.pixel[i];
+    }
+
+    sorted.count = queue.count;
+    std::swap(queue, sorted);
+
+    rt.stats.sortedRays += queue.count;
+    rt.stats.sortTimeMs += std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - startTime).count();
+}
+
+// Rays spawned by one job, appended to the next queue in one go so the
+// queue stays compact without a lock per ray.
+struct QueueBatch
+{
+    RayCpu rays[kWavefrontChunkSize];
+    glm::vec3 colors[kWavefrontChunkSize];
+    uint32_t pixels[kWavefrontChunkSize];
+    uint32_t count;
+};
+
+static void flushQueueBatch(RayQueueCpu& queue, std::atomic<uint32_t>& queueCount, const QueueBatch& batch)
+{
+    if (batch.count == 0)
+        return;
+
+    uint32_t base = queueCount.fetch_add(batch.count);
+
+    for (uint32_t i = 0; i < batch.count; i++)
+    {
+        const RayCpu& ray = batch.rays[i];
+        uint32_t index = base + i;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            queue.origin[axis][index] = ray.origin[axis];
+            queue.direction[axis][index] = ray.direction[axis];
+            queue.parentColor[axis][index] = batch.colors[i][axis];
+        }
+
+        queue.tmin[index] = ray.tmin;
+        queue.tmax[index] = ray.tmax;
+        queue.pixel[index] = batch.pixels[i];
+    }
+}
+
+// Shared by every stage: terminal hits and misses write the pixel into
+// pixelColorDistance (RaytracerCpu::pixelColorDistance), bounces go to the
+// next queue.  depth is the payload depth after this hit.
+static void shadeQueuedHit(ThreadContext& ctx, const RayCpu& ray, const HitCpu* pHit,
+    uint32_t pixel, int depth, QueueBatch& batch, std::vector<glm::vec4>& pixelColorDistance)
+{
+    if (!pHit)
+    {
+        // miss.rmiss
+        pixelColorDistance[pixel] = glm::vec4(kSkyBlue, -1.f);
+        return;
+    }
+
+    SurfaceHit surface;
+    evaluateSurface(*ctx.pRaytracer, ray, *pHit, &surface);
+
+    if (surface.bounce && depth < kMaxDepth)
+    {
+        uint32_t i = batch.count++;
+        batch.rays[i] = surface.secondary;
+        batch.colors[i] = surface.color;
+        batch.pixels[i] = pixel;
+
+        ctx.stats.secondaryRays++;
+    }
+    else
+    {
+        pixelColorDistance[pixel] = glm::vec4(surface.color, pHit->t);
+    }
+}
+
+// Every bounce is a stage over a compacted queue: one pass intersects all
+// rays, the next shades them and fills the queue of the following bounce.
+// The colors are folded back into the pixels deepest stage first, which
+// gives the same products as the recursive traceRay().
+static void renderFrameWavefront(RaytracerCpu& rt, const CameraUniformData& cameraData,
+    std::vector<ThreadContext>& contexts)
+{
+    uint32_t pixelCount = rt.width * rt.height;
+
+    rt.pixelColorDistance.resize(pixelCount);
+
+    std::atomic<uint32_t> queueCount;
+
+    // Primary rays, depth 1
+    auto stageStart = std::chrono::high_resolution_clock::now();
+
+    RayQueueCpu& firstQueue = rt.queues[1];
+    resizeRayQueue(firstQueue, pixelCount);
+    queueCount = 0;
+
+    runStage(rt, (uint32_t)rt.tiles.size(), [&](uint32_t tileIndex, uint32_t threadIndex) {
+        ThreadContext& ctx = contexts[threadIndex];
+
+        uint32_t x0, y0, x1, y1;
+        getTileRect(rt, tileIndex, &x0, &y0, &x1, &y1);
+
+        static_assert(kTileSize * kTileSize <= kWavefrontChunkSize, "");
+
+        QueueBatch batch;
+        batch.count = 0;
+
+        tracePrimaryTile(ctx, cameraData, x0, y0, x1, y1,
+            [&](uint32_t x, uint32_t y, const RayCpu& primary, const HitCpu* pHit) {
+            shadeQueuedHit(ctx, primary, pHit, y * rt.width + x, 1, batch, rt.pixelColorDistance);
+            ctx.stats.primaryRays++;
+        });
+
+        flushQueueBatch(firstQueue, queueCount, batch);
+    });
+
+    firstQueue.count = queueCount;
+
+    rt.stats.stageRays[0] = pixelCount;
+    rt.stats.stageTimeMs[0] = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - stageStart).count();
+
+    // Secondary rays.  queues[depth] holds the rays spawned by hits at depth.
+    int lastDepth = 1;
+
+    for (int depth = 1; depth < kMaxDepth && rt.queues[depth].count > 0; depth++)
+    {
+        stageStart = std::chrono::high_resolution_clock::now();
+
+        RayQueueCpu& queue = rt.queues[depth];
+        RayQueueCpu& nextQueue = rt.queues[depth + 1];
+
+        if (rt.sortRays)
+            sortRayQueue(rt, queue);
+
+        uint32_t chunkCount = (queue.count + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+
+        rt.hits.resize(queue.count);
+
+        // Intersection
+        runStage(rt, chunkCount, [&](uint32_t chunk, uint32_t) {
+            uint32_t begin = chunk * kWavefrontChunkSize;
+            uint32_t end = std::min(begin + kWavefrontChunkSize, queue.count);
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                RayCpu ray = loadQueuedRay(queue, i);
+
+                if (!intersectScene(rt, ray, 0xFF, false, &rt.hits[i]))
+                    rt.hits[i].instanceID = ~0u;
+            }
+        });
+
+        // Shading
+        if (depth + 1 < kMaxDepth)
+            resizeRayQueue(nextQueue, queue.count);
+
+        queueCount = 0;
+
+        runStage(rt, chunkCount, [&](uint32_t chunk, uint32_t threadIndex) {
+            ThreadContext& ctx = contexts[threadIndex];
+
+            uint32_t begin = chunk * kWavefrontChunkSize;
+            uint32_t end = std::min(begin + kWavefrontChunkSize, queue.count);
+
+            QueueBatch batch;
+            batch.count = 0;
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const HitCpu& hit = rt.hits[i];
+
+                shadeQueuedHit(ctx, loadQueuedRay(queue, i),
+                    hit.instanceID != ~0u ? &hit : nullptr, queue.pixel[i], depth + 1, batch,
+                    rt.pixelColorDistance);
+            }
+
+            flushQueueBatch(nextQueue, queueCount, batch);
+        });
+
+        if (depth + 1 < kMaxDepth)
+            nextQueue.count = queueCount;
+
+        rt.stats.stageRays[depth] = queue.count;
+        rt.stats.stageTimeMs[depth] = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - stageStart).count();
+
+        lastDepth = depth + 1;
+    }
+
+    // payload.colorDistance *= vec4(color, 1) on the way back up.  A pixel
+    // is in each queue at most once, so the pixels of a stage don't race.
+    for (int depth = lastDepth - 1; depth >= 1; depth--)
+    {
+        const RayQueueCpu& queue = rt.queues[depth];
+
+        uint32_t chunkCount = (queue.count + kWavefrontChunkSize - 1) / kWavefrontChunkSize;
+
+        runStage(rt, chunkCount, [&](uint32_t chunk, uint32_t) {
+            uint32_t begin = chunk * kWavefrontChunkSize;
+            uint32_t end = std::min(begin + kWavefrontChunkSize, queue.count);
+
+            for (uint32_t i = begin; i < end; i++)
+            {
+                glm::vec3 color(queue.parentColor[0][i], queue.parentColor[1][i], queue.parentColor[2][i]);
+                rt.pixelColorDistance[queue.pixel[i]] *= glm::vec4(color, 1.f);
+            }
+        });
+    }
+
+    // Shadow rays and output
+    stageStart = std::chrono::high_resolution_clock::now();
+
+    runStage(rt, (uint32_t)rt.tiles.size(), [&](uint32_t tileIndex, uint32_t threadIndex) {
+        ThreadContext& ctx = contexts[threadIndex];
+
+        uint32_t x0, y0, x1, y1;
+        getTileRect(rt, tileIndex, &x0, &y0, &x1, &y1);
+
+        // Shadow rays of the tile, traced as packets: they share the light
+        // direction and their origins are close
+        RayCpu shadowRays[kTileSize * kTileSize];
+        uint32_t shadowPixels[kTileSize * kTileSize];
+        uint32_t occludedMask[kTileSize * kTileSize / 32];
+        uint32_t shadowCount = 0;
+
+        for (uint32_t y = y0; y < y1; y++)
+        {
+            for (uint32_t x = x0; x < x1; x++)
+            {
+                uint32_t pixel = y * rt.width + x;
+                float hitDistance = rt.pixelColorDistance[pixel].w;
+
+                if (hitDistance < 0.f)
+                    continue;
+
+                RayCpu primary = makePrimaryRay(rt, cameraData, x, y);
+
+                RayCpu& shadow = shadowRays[shadowCount];
+                shadow.origin = primary.origin + primary.direction * hitDistance;
+                shadow.direction = kToLight;
+                shadow.tmin = 2.f;
+                shadow.tmax = 10000.f;
+
+                shadowPixels[shadowCount++] = pixel;
+            }
+        }
+
+        occludedPacketsCpu(rt.tlas, shadowRays, shadowCount, 0xFF, occludedMask);
+
+        for (uint32_t i = 0; i < shadowCount; i++)
+        {
+            if (occludedMask[i / 32] & (1u << (i % 32)))
+                rt.pixelColorDistance[shadowPixels[i]] *= glm::vec4(0.3f, 0.3f, 0.3f, 1.f);
+        }
+
+        ctx.stats.shadowRays += shadowCount;
+
+        for (uint32_t y = y0; y < y1; y++)
+        {
+            for (uint32_t x = x0; x < x1; x++)
+            {
+                uint32_t pixel = y * rt.width + x;
+                rt.image[pixel] = packColor(linearToSrgb(glm::vec3(rt.pixelColorDistance[pixel])));
+            }
+        }
+    });
+
+    rt.stats.stageTimeMs[kMaxDepth] = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - stageStart).count();
+}
+
+void renderFrameCpu(RaytracerCpu& rt, const CameraUniformData& cameraData)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    JobSystem& js = *rt.pJobSystem;
+
+    std::vector<ThreadContext> contexts(js.threadCount);
+
+    for (auto& ctx : contexts)
+    {
+        ctx.pRaytracer = &rt;
+        ctx.stats = {};
+    }
+
+    rt.stats = {};
+    rt.threadJobStats.assign(js.threadCount, {});
+
+    if (rt.wavefront)
+    {
+        renderFrameWavefront(rt, cameraData, contexts);
+    }
+    else
+    {
+        runStage(rt, (uint32_t)rt.tiles.size(), [&](uint32_t tileIndex, uint32_t threadIndex) {
+            ThreadContext& ctx = contexts[threadIndex];
+
+            uint32_t x0, y0, x1, y1;
+            getTileRect(rt, tileIndex, &x0, &y0, &x1, &y1);
+
+            tracePrimaryTile(ctx, cameraData, x0, y0, x1, y1,
+                [&](uint32_t x, uint32_t y, const RayCpu& primary, const HitCpu* pHit) {
+                glm::vec3 color = shadePrimary(ctx, primary, pHit);
+                rt.image[(size_t)y * rt.width + x] = packColor(color);
+            });
+        });
+    }
+
+    rt.threadStats.resize(contexts.size());
+
+    for (size_t i = 0; i < contexts.size(); i++)
+    {
+        const ThreadContext& ctx = contexts[i];
+
+        rt.threadStats[i] = ctx.stats;
+
+        rt.stats.primaryRays += ctx.stats.primaryRays;
+        rt.stats.secondaryRays += ctx.stats.secondaryRays;
+        rt.stats.shadowRays += ctx.stats.shadowRays;
+        rt.stats.primaryPackets += ctx.stats.primaryPackets;
+        rt.stats.packetFallbacks += ctx.stats.packetFallbacks;
+    }
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    rt.stats.frameTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+bool writeImageCpu(const RaytracerCpu& rt, const char* filename)
+{
+    int res = stbi_write_png(filename, (int)rt.width, (int)rt.height, 4,
+        rt.image.data(), (int)rt.width * 4);
+
+    if (res == 0)
+    {
+        DebugPrint("Error: could not write %s\n", filename);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "RayCpu.h"
+#include "TlasCpu.h"
+#include "JobSystem.h"
+
+// Must match the shaders
+const int kMaxDepth = 8;
+
+// Rays per job in the wavefront stages
+const uint32_t kWavefrontChunkSize = 256;
+
+// CPU implementation of raygen.rgen / chit.rchit / miss.rmiss and the shadow
+// shaders.  Renders the same Scene (as loaded by loadGltfFile) into a RGBA8
+// buffer that is the equivalent of App::offscreenImage.
+
+// Shading data per instance, tracing only needs TlasCpu
+struct InstanceCpu
+{
+    glm::mat4 objectToWorld; // gl_ObjectToWorldNV
+
+    int meshID;     // Mesh::geometryID of the node's mesh, also the BLAS
+    int materialID; // MeshInstanceData::materialID
+};
+
+// Order in which the image tiles are handed out to the job system.  Each
+// thread starts on a contiguous run of this order, so curves keep a thread's
+// tiles (and the BVH nodes they touch) close together.
+enum TileOrder
+{
+    TILE_ORDER_ROWS,
+    TILE_ORDER_MORTON,
+    TILE_ORDER_HILBERT
+};
+
+struct RaytracerCpuStats
+{
+    uint64_t primaryRays;
+    uint64_t secondaryRays; // reflection + refraction
+    uint64_t shadowRays;
+
+    uint64_t primaryPackets;
+    uint64_t packetFallbacks; // incoherent packets traced ray by ray
+
+    // Wavefront mode: rays and time per bounce, the last entry is the
+    // shadow/output stage.
+    uint64_t stageRays[kMaxDepth];
+    double stageTimeMs[kMaxDepth + 1];
+
+    // Secondary ray binning, included in stageTimeMs
+    uint64_t sortedRays;
+    uint64_t sortBins; // non-empty bins, summed over the bounces
+    double sortTimeMs;
+
+    double frameTimeMs;
+};
+
+// Structure of arrays queue of the rays of one bounce
+struct RayQueueCpu
+{
+    std::vector<float> origin[3];
+    std::vector<float> direction[3];
+    std::vector<float> tmin;
+    std::vector<float> tmax;
+
+    std::vector<uint32_t> pixel;
+    std::vector<float> parentColor[3]; // color of the hit that spawned the ray
+
+    uint32_t count;
+};
+
+struct RaytracerCpu
+{
+    const Scene* pScene;
+    JobSystem* pJobSystem;
+
+    uint32_t width;
+    uint32_t height;
+
+    // Trace primary rays in packets
+    bool packets;
+
+    // Tile coordinates, x | y << 16, in scheduling order
+    std::vector<uint32_t> tiles;
+
+    // Trace bounces as queue stages instead of recursively
+    bool wavefront;
+    std::vector<RayQueueCpu> queues; // indexed by the depth of the spawning hit
+    std::vector<HitCpu> hits;
+    std::vector<glm::vec4> pixelColorDistance; // payload.colorDistance per pixel
+
+    // Bin secondary rays by origin cell and direction octant before tracing
+    // them (wavefront only)
+    bool sortRays;
+    RayQueueCpu sortQueue;
+    std::vector<uint32_t> sortKeys;
+    std::vector<uint32_t> sortOffsets;
+
+    // One per Scene::meshes
+    std::vector<BvhCpu> blas;
+    std::vector<BvhCpuCreateInfo> blasCreateInfos; // for rebuilds
+    std::vector<WideBvhCpu> wideBlas; // empty unless bvhWidth > 2
+    uint32_t bvhWidth;
+    bool quantizeBvh;
+
+    // One per scene node (gl_InstanceID)
+    std::vector<InstanceCpu> instances;
+
+    TlasCpu tlas;
+
+    // offscreenImage equivalent, RGBA8
+    std::vector<uint32_t> image;
+
+    RaytracerCpuStats stats;
+    std::vector<RaytracerCpuStats> threadStats; // per job system thread, last frame
+    std::vector<JobThreadStats> threadJobStats; // summed over the frame's parallelFors
+};
+
+struct RaytracerCpuCreateInfo
+{
+    const Scene* pScene;
+    JobSystem* pJobSystem;
+    uint32_t width;
+    uint32_t height;
+    bool packets;
+    TileOrder tileOrder;
+    bool wavefront;
+    bool sortRays; // implies wavefront
+    uint32_t bvhWidth; // 2 (binary), 4 or 8; packets always use the binary BVHs
+    bool quantizeBvh;  // 8 bit child bounds in the wide BVHs
+
+    BvhBuildMode bvhBuildMode;
+    float sbvhSplitBudget;     // see BvhCpuCreateInfo, per BLAS
+    size_t sbvhMaxMemoryBytes;
+    const BvhBuildMode* pMeshBuildModes; // optional, one per Scene::meshes, overrides bvhBuildMode
+
+    const char* bvhCacheDirectory; // null -> always build the BLASes, see BvhCache.h
+
+    bool triangleRecords; // precomputed triangles in the BLAS leaves (not for packets)
+};
+
+bool createRaytracerCpu(const RaytracerCpuCreateInfo& ci, RaytracerCpu* pRaytracer);
+
+void destroyRaytracerCpu(RaytracerCpu& rt);
+
+// Animation without rebuilding everything: the BLASes of the listed meshes
+// are refit to their new Mesh::positionData (written in place through
+// positionStorage, so not for cooked scenes or .glb files; same vertex
+// count and indices, geometry owners only, which moves all meshes sharing
+// the geometry) and the TLAS to the new Scene::nodes transforms.  A BVH is
+// rebuilt instead once its SAH cost degrades past maxSahRatio times the
+// cost of its build.
+struct RaytracerCpuUpdateInfo
+{
+    const uint32_t* pMeshIndices;
+    uint32_t meshCount;
+
+    bool nodesChanged;
+
+    float maxSahRatio; // 0 -> kBvhRebuildSahRatio
+};
+
+struct RaytracerCpuUpdateStats
+{
+    double timeMs;
+
+    uint32_t blasRefits;
+    uint32_t blasRebuilds;
+
+    bool tlasRebuilt;
+    float tlasSahCost;
+    float tlasBuiltSahCost;
+};
+
+// pStats is optional
+bool updateRaytracerCpu(RaytracerCpu& rt, const RaytracerCpuUpdateInfo& ui, RaytracerCpuUpdateStats* pStats);
+
+// Equivalent of one vkCmdTraceRaysNV over width x height
+void renderFrameCpu(RaytracerCpu& rt, const CameraUniformData& cameraData);
+
+bool writeImageCpu(const RaytracerCpu& rt, const char* filename);
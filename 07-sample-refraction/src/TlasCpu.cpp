@@ -0,0 +1,303 @@
+#include "pch.h"
+
+#include "App.h"
+#include "logging.h"
+#include "TlasCpu.h"
+
+static void invert3x4(const float* m, float* pInverse)
+{
+    // glm is column major, the 3x4 rows are the columns of the transpose
+    glm::mat4 transposed = glm::mat4(1.f);
+    memcpy(glm::value_ptr(transposed), m, sizeof(float) * 12);
+
+    glm::mat4 inverse = glm::transpose(glm::inverse(glm::transpose(transposed)));
+    memcpy(pInverse, glm::value_ptr(inverse), sizeof(float) * 12);
+}
+
+// Copies the instances and writes their world bounds (min/max pairs) from
+// the current BLAS roots
+static void updateInstances(TlasCpu& tlas, const VkGeometryInstance* pInstances, uint32_t instanceCount,
+    glm::vec3* pBounds)
+{
+    for (uint32_t i = 0; i < instanceCount; i++)
+    {
+        const VkGeometryInstance& src = pInstances[i];
+        TlasInstanceCpu& instance = tlas.instances[i];
+
+        BASSERT(src.accelerationStructureHandle < tlas.blasCount);
+
+        instance.blasIndex = (uint32_t)src.accelerationStructureHandle;
+        instance.instanceCustomIndex = src.instanceCustomIndex;
+        instance.mask = src.mask;
+
+        invert3x4(src.transform, instance.worldToObject);
+
+        // World bounds from the 8 corners of the BLAS root
+        const BvhCpu& blas = tlas.pBlas[instance.blasIndex];
+        const BvhNode& root = blas.pNodes[0];
+
+        glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+        glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
+
+        for (int c = 0; c < 8; c++)
+        {
+            glm::vec3 corner(
+                (c & 1) ? root.boundsMax.x : root.boundsMin.x,
+                (c & 2) ? root.boundsMax.y : root.boundsMin.y,
+                (c & 4) ? root.boundsMax.z : root.boundsMin.z);
+
+            glm::vec3 p = transformPoint3x4(src.transform, corner);
+            boundsMin = glm::min(boundsMin, p);
+            boundsMax = glm::max(boundsMax, p);
+        }
+
+        pBounds[2 * i + 0] = boundsMin;
+        pBounds[2 * i + 1] = boundsMax;
+    }
+}
+
+static bool buildInstanceBvh(TlasCpu& tlas, const glm::vec3* pBounds)
+{
+    BvhCpuCreateInfo bvhInfo = {};
+    bvhInfo.primBounds = pBounds;
+    bvhInfo.primCount = (uint32_t)tlas.instances.size();
+
+    // One instance per leaf so each instance is culled by its own bounds
+    bvhInfo.maxLeafSize = 1;
+
+    destroyBvhCpu(tlas.bvh);
+
+    return createBvhCpu(bvhInfo, &tlas.bvh);
+}
+
+bool createTlasCpu(const TlasCpuCreateInfo& ci, TlasCpu* pTlas)
+{
+    TlasCpu& tlas = *pTlas;
+
+    tlas.pBlas = ci.pBlas;
+    tlas.blasCount = ci.blasCount;
+    tlas.pWideBlas = ci.pWideBlas;
+    tlas.instances.resize(ci.instanceCount);
+
+    // min/max pairs
+    std::vector<glm::vec3> bounds(2 * (size_t)ci.instanceCount);
+
+    updateInstances(tlas, ci.pInstances, ci.instanceCount, bounds.data());
+
+    if (!buildInstanceBvh(tlas, bounds.data()))
+        return false;
+
+    printBvhStats(tlas.bvh.stats, "TLAS");
+
+    return true;
+}
+
+bool refitTlasCpu(TlasCpu& tlas, const VkGeometryInstance* pInstances, uint32_t instanceCount,
+    float maxSahRatio, bool* pRebuilt)
+{
+    BASSERT(instanceCount == tlas.instances.size());
+
+    *pRebuilt = false;
+
+    std::vector<glm::vec3> bounds(2 * (size_t)instanceCount);
+
+    updateInstances(tlas, pInstances, instanceCount, bounds.data());
+
+    refitBvhCpu(tlas.bvh, nullptr, bounds.data());
+
+    if (shouldRebuildBvhCpu(tlas.bvh, maxSahRatio))
+    {
+        *pRebuilt = true;
+
+        return buildInstanceBvh(tlas, bounds.data());
+    }
+
+    return true;
+}
+
+void destroyTlasCpu(TlasCpu& tlas)
+{
+    destroyBvhCpu(tlas.bvh);
+    tlas.instances.clear();
+}
+
+static bool intersectInstance(const TlasCpu& tlas, uint32_t instanceID, const RayCpu& ray,
+    float tmax, bool anyHit, HitCpu* pHit)
+{
+    const TlasInstanceCpu& instance = tlas.instances[instanceID];
+
+    // The direction is not normalized, so t is the same in both spaces.
+    RayCpu objectRay;
+    objectRay.origin = transformPoint3x4(instance.worldToObject, ray.origin);
+    objectRay.direction = transformVector3x4(instance.worldToObject, ray.direction);
+    objectRay.tmin = ray.tmin;
+    objectRay.tmax = tmax;
+
+    bool hit = tlas.pWideBlas ?
+        intersectWideBvhCpu(tlas.pWideBlas[instance.blasIndex], objectRay, anyHit, pHit) :
+        intersectBvhCpu(tlas.pBlas[instance.blasIndex], objectRay, anyHit, pHit);
+
+    if (!hit)
+        return false;
+
+    pHit->instanceID = instanceID;
+
+    return true;
+}
+
+bool intersectTlasCpu(const TlasCpu& tlas, const RayCpu& ray, uint32_t cullMask,
+    bool anyHit, HitCpu* pHit)
+{
+    const BvhCpu& bvh = tlas.bvh;
+
+    if (bvh.nodeCount == 0)
+        return false;
+
+    const BvhNode* nodes = bvh.pNodes;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+
+    glm::vec3 invDirection = 1.f / ray.direction;
+    float tmax = ray.tmax;
+    bool found = false;
+
+    if (!intersectAabb(nodes[0].boundsMin, nodes[0].boundsMax,
+        ray.origin, invDirection, ray.tmin, tmax))
+        return false;
+
+    struct StackEntry
+    {
+        uint32_t node;
+        float enter;
+    };
+
+    StackEntry stack[kMaxBvhDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeIndex = 0;
+
+    for (;;)
+    {
+        const BvhNode& node = nodes[nodeIndex];
+
+        if (node.primCount > 0)
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.primCount; i++)
+            {
+                uint32_t instanceID = primIndices[i];
+
+                if ((tlas.instances[instanceID].mask & cullMask) == 0)
+                    continue;
+
+                if (!intersectInstance(tlas, instanceID, ray, tmax, anyHit, pHit))
+                    continue;
+
+                tmax = pHit->t;
+                found = true;
+
+                if (anyHit)
+                    return true;
+            }
+        }
+        else
+        {
+            uint32_t left = nodeIndex + 1;
+            uint32_t right = node.offset;
+
+            float enterLeft, enterRight;
+
+            bool hitLeft = intersectAabb(nodes[left].boundsMin, nodes[left].boundsMax,
+                ray.origin, invDirection, ray.tmin, tmax, &enterLeft);
+            bool hitRight = intersectAabb(nodes[right].boundsMin, nodes[right].boundsMax,
+                ray.origin, invDirection, ray.tmin, tmax, &enterRight);
+
+            if (hitLeft && hitRight)
+            {
+                if (enterRight < enterLeft)
+                {
+                    std::swap(left, right);
+                    std::swap(enterLeft, enterRight);
+                }
+
+                stack[stackSize++] = { right, enterRight };
+                nodeIndex = left;
+                continue;
+            }
+
+            if (hitLeft || hitRight)
+            {
+                nodeIndex = hitLeft ? left : right;
+                continue;
+            }
+        }
+
+        for (;;)
+        {
+            if (stackSize == 0)
+                return found;
+
+            StackEntry& entry = stack[--stackSize];
+
+            if (entry.enter <= tmax)
+            {
+                nodeIndex = entry.node;
+                break;
+            }
+        }
+    }
+}
+
+bool occludedTlasCpu(const TlasCpu& tlas, const RayCpu& ray, uint32_t cullMask)
+{
+    const BvhCpu& bvh = tlas.bvh;
+
+    if (bvh.nodeCount == 0)
+        return false;
+
+    const BvhNode* nodes = bvh.pNodes;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+
+    glm::vec3 invDirection = 1.f / ray.direction;
+
+    uint32_t stack[kMaxBvhDepth];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const BvhNode& node = nodes[stack[--stackSize]];
+
+        if (!intersectAabb(node.boundsMin, node.boundsMax,
+            ray.origin, invDirection, ray.tmin, ray.tmax))
+            continue;
+
+        if (node.primCount == 0)
+        {
+            stack[stackSize++] = node.offset;
+            stack[stackSize++] = (uint32_t)(&node - nodes) + 1;
+            continue;
+        }
+
+        for (uint32_t i = node.offset; i < node.offset + node.primCount; i++)
+        {
+            const TlasInstanceCpu& instance = tlas.instances[primIndices[i]];
+
+            if ((instance.mask & cullMask) == 0)
+                continue;
+
+            RayCpu objectRay;
+            objectRay.origin = transformPoint3x4(instance.worldToObject, ray.origin);
+            objectRay.direction = transformVector3x4(instance.worldToObject, ray.direction);
+            objectRay.tmin = ray.tmin;
+            objectRay.tmax = ray.tmax;
+
+            bool occluded = tlas.pWideBlas ?
+                occludedWideBvhCpu(tlas.pWideBlas[instance.blasIndex], objectRay) :
+                occludedBvhCpu(tlas.pBlas[instance.blasIndex], objectRay);
+
+            if (occluded)
+                return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "BvhCpu.h"
+#include "WideBvhCpu.h"
+
+struct VkGeometryInstance;
+
+// Top level structure over VkGeometryInstances (CPU equivalent of
+// Scene::topLevelStruct).  Instances reference a BLAS and are only entered
+// when the ray reaches their world space bounds, so instanced meshes are
+// never flattened into one BVH.
+
+struct TlasInstanceCpu
+{
+    // Inverse of VkGeometryInstance::transform, same 3x4 row major layout
+    float worldToObject[12];
+
+    uint32_t blasIndex;
+    uint32_t instanceCustomIndex : 24;
+    uint32_t mask : 8;
+};
+
+struct TlasCpu
+{
+    // Built over the instance world space bounds
+    BvhCpu bvh;
+
+    std::vector<TlasInstanceCpu> instances; // gl_InstanceID
+
+    // Not owned
+    const BvhCpu* pBlas;
+    uint32_t blasCount;
+
+    // Optional, traversed instead of pBlas for single rays.  Not owned.
+    const WideBvhCpu* pWideBlas;
+};
+
+struct TlasCpuCreateInfo
+{
+    // accelerationStructureHandle is the index of the instance's BLAS in pBlas
+    const VkGeometryInstance* pInstances;
+    uint32_t instanceCount;
+
+    const BvhCpu* pBlas;
+    uint32_t blasCount;
+
+    const WideBvhCpu* pWideBlas; // null or blasCount entries, built over pBlas
+};
+
+// 3x4 row major, as VkGeometryInstance::transform
+inline glm::vec3 transformPoint3x4(const float* m, const glm::vec3& p)
+{
+    return glm::vec3(
+        m[0] * p.x + m[1] * p.y + m[2]  * p.z + m[3],
+        m[4] * p.x + m[5] * p.y + m[6]  * p.z + m[7],
+        m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]);
+}
+
+inline glm::vec3 transformVector3x4(const float* m, const glm::vec3& v)
+{
+    return glm::vec3(
+        m[0] * v.x + m[1] * v.y + m[2]  * v.z,
+        m[4] * v.x + m[5] * v.y + m[6]  * v.z,
+        m[8] * v.x + m[9] * v.y + m[10] * v.z);
+}
+
+bool createTlasCpu(const TlasCpuCreateInfo& ci, TlasCpu* pTlas);
+
+void destroyTlasCpu(TlasCpu& tlas);
+
+// Takes new instance transforms (same instances and BLASes, in the same
+// order) and refits the instance BVH over their world bounds, which also
+// picks up refit BLASes.  Rebuilds it instead once shouldRebuildBvhCpu()
+// with maxSahRatio, *pRebuilt tells which.
+bool refitTlasCpu(TlasCpu& tlas, const VkGeometryInstance* pInstances, uint32_t instanceCount,
+    float maxSahRatio, bool* pRebuilt);
+
+// Instances with (mask & cullMask) == 0 are skipped, as with the cullMask
+// argument of traceNV.  Fills all of HitCpu.
+bool intersectTlasCpu(const TlasCpu& tlas, const RayCpu& ray, uint32_t cullMask,
+    bool anyHit, HitCpu* pHit);
+
+// Occlusion query, see occludedBvhCpu.  occludedPacketsCpu (PacketCpu.h)
+// takes batches of coherent rays.
+bool occludedTlasCpu(const TlasCpu& tlas, const RayCpu& ray, uint32_t cullMask);
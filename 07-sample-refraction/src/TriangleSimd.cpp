@@ -0,0 +1,250 @@
+#include "pch.h"
+
+#include "logging.h"
+#include "TriangleSimd.h"
+
+// Moller-Trumbore with the same operations in the same order as
+// intersectTriangleEdges(), so every kernel returns the same hits.
+
+static bool intersectTriangleBlockScalar(const TriangleBlock& block,
+    const RayCpu& ray, float tmax, HitCpu* pHit)
+{
+    bool found = false;
+
+    for (uint32_t i = 0; i < block.count; i++)
+    {
+        glm::vec3 p0(block.p0[0][i], block.p0[1][i], block.p0[2][i]);
+        glm::vec3 e1(block.e1[0][i], block.e1[1][i], block.e1[2][i]);
+        glm::vec3 e2(block.e2[0][i], block.e2[1][i], block.e2[2][i]);
+
+        float t, u, v;
+
+        if (!intersectTriangleEdges(ray.origin, ray.direction, p0, e1, e2,
+            ray.tmin, tmax, &t, &u, &v))
+            continue;
+
+        tmax = t;
+        found = true;
+
+        pHit->t = t;
+        pHit->u = u;
+        pHit->v = v;
+        pHit->primitiveID = block.primitiveIDs[i];
+    }
+
+    return found;
+}
+
+static bool intersectTriangleBlockSse(const TriangleBlock& block,
+    const RayCpu& ray, float tmax, HitCpu* pHit)
+{
+    const __m128 ox = _mm_set1_ps(ray.origin.x);
+    const __m128 oy = _mm_set1_ps(ray.origin.y);
+    const __m128 oz = _mm_set1_ps(ray.origin.z);
+    const __m128 dx = _mm_set1_ps(ray.direction.x);
+    const __m128 dy = _mm_set1_ps(ray.direction.y);
+    const __m128 dz = _mm_set1_ps(ray.direction.z);
+    const __m128 tmin = _mm_set1_ps(ray.tmin);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+
+    bool found = false;
+
+    for (uint32_t base = 0; base < block.count; base += 4)
+    {
+        __m128 e1x = _mm_load_ps(&block.e1[0][base]);
+        __m128 e1y = _mm_load_ps(&block.e1[1][base]);
+        __m128 e1z = _mm_load_ps(&block.e1[2][base]);
+        __m128 e2x = _mm_load_ps(&block.e2[0][base]);
+        __m128 e2y = _mm_load_ps(&block.e2[1][base]);
+        __m128 e2z = _mm_load_ps(&block.e2[2][base]);
+
+        // pvec = cross(direction, e2)
+        __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+        __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+        __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+
+        __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+        __m128 invDet = _mm_div_ps(one, det);
+
+        // tvec = origin - p0
+        __m128 tx = _mm_sub_ps(ox, _mm_load_ps(&block.p0[0][base]));
+        __m128 ty = _mm_sub_ps(oy, _mm_load_ps(&block.p0[1][base]));
+        __m128 tz = _mm_sub_ps(oz, _mm_load_ps(&block.p0[2][base]));
+
+        __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), invDet);
+
+        // qvec = cross(tvec, e1)
+        __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+        __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+        __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+        __m128 mask = _mm_cmpneq_ps(det, zero);
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(u, one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(t, tmin));
+        mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(tmax)));
+
+        int bits = _mm_movemask_ps(mask);
+
+        if (bits == 0)
+            continue;
+
+        alignas(16) float ts[4], us[4], vs[4];
+        _mm_store_ps(ts, t);
+        _mm_store_ps(us, u);
+        _mm_store_ps(vs, v);
+
+        // Lanes are in primitive order, so ties go to the lower lane as in
+        // the scalar loop.
+        while (bits)
+        {
+            unsigned long lane;
+            _BitScanForward(&lane, (unsigned long)bits);
+
+            bits &= bits - 1;
+
+            if (ts[lane] >= tmax)
+                continue;
+
+            tmax = ts[lane];
+            found = true;
+
+            pHit->t = ts[lane];
+            pHit->u = us[lane];
+            pHit->v = vs[lane];
+            pHit->primitiveID = block.primitiveIDs[base + lane];
+        }
+    }
+
+    return found;
+}
+
+static bool intersectTriangleBlockAvx(const TriangleBlock& block,
+    const RayCpu& ray, float tmax, HitCpu* pHit)
+{
+    const __m256 ox = _mm256_set1_ps(ray.origin.x);
+    const __m256 oy = _mm256_set1_ps(ray.origin.y);
+    const __m256 oz = _mm256_set1_ps(ray.origin.z);
+    const __m256 dx = _mm256_set1_ps(ray.direction.x);
+    const __m256 dy = _mm256_set1_ps(ray.direction.y);
+    const __m256 dz = _mm256_set1_ps(ray.direction.z);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+
+    __m256 e1x = _mm256_load_ps(block.e1[0]);
+    __m256 e1y = _mm256_load_ps(block.e1[1]);
+    __m256 e1z = _mm256_load_ps(block.e1[2]);
+    __m256 e2x = _mm256_load_ps(block.e2[0]);
+    __m256 e2y = _mm256_load_ps(block.e2[1]);
+    __m256 e2z = _mm256_load_ps(block.e2[2]);
+
+    __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+
+    __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 invDet = _mm256_div_ps(one, det);
+
+    __m256 tx = _mm256_sub_ps(ox, _mm256_load_ps(block.p0[0]));
+    __m256 ty = _mm256_sub_ps(oy, _mm256_load_ps(block.p0[1]));
+    __m256 tz = _mm256_sub_ps(oz, _mm256_load_ps(block.p0[2]));
+
+    __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tx, px), _mm256_mul_ps(ty, py)), _mm256_mul_ps(tz, pz)), invDet);
+
+    __m256 qx = _mm256_sub_ps(_mm256_mul_ps(ty, e1z), _mm256_mul_ps(tz, e1y));
+    __m256 qy = _mm256_sub_ps(_mm256_mul_ps(tz, e1x), _mm256_mul_ps(tx, e1z));
+    __m256 qz = _mm256_sub_ps(_mm256_mul_ps(tx, e1y), _mm256_mul_ps(ty, e1x));
+
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+    __m256 mask = _mm256_cmp_ps(det, zero, _CMP_NEQ_OQ);
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(ray.tmin), _CMP_GE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(t, _mm256_set1_ps(tmax), _CMP_LT_OQ));
+
+    int bits = _mm256_movemask_ps(mask);
+
+    if (bits == 0)
+        return false;
+
+    // Closest lane: min over the hit lanes, lowest lane on ties
+    __m256 tHit = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, mask);
+    __m256 tMin = _mm256_min_ps(tHit, _mm256_permute_ps(tHit, _MM_SHUFFLE(2, 3, 0, 1)));
+    tMin = _mm256_min_ps(tMin, _mm256_permute_ps(tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+    tMin = _mm256_min_ps(tMin, _mm256_permute2f128_ps(tMin, tMin, 1));
+
+    bits &= _mm256_movemask_ps(_mm256_cmp_ps(tHit, tMin, _CMP_EQ_OQ));
+
+    unsigned long lane;
+    _BitScanForward(&lane, (unsigned long)bits);
+
+    alignas(32) float ts[8], us[8], vs[8];
+    _mm256_store_ps(ts, t);
+    _mm256_store_ps(us, u);
+    _mm256_store_ps(vs, v);
+
+    pHit->t = ts[lane];
+    pHit->u = us[lane];
+    pHit->v = vs[lane];
+    pHit->primitiveID = block.primitiveIDs[lane];
+
+    return true;
+}
+
+IntersectTriangleBlockFunction getIntersectTriangleBlockFunction(SimdLevel level)
+{
+    switch (level)
+    {
+    case SIMD_LEVEL_AVX:
+    case SIMD_LEVEL_AVX2:
+        return intersectTriangleBlockAvx;
+    case SIMD_LEVEL_SSE:
+        return intersectTriangleBlockSse;
+    default:
+        return intersectTriangleBlockScalar;
+    }
+}
+
+void buildTriangleBlocks(const glm::vec3* positions, const uint32_t* indices,
+    const uint32_t* primitiveIDs, uint32_t count, std::vector<TriangleBlock>& blocks)
+{
+    for (uint32_t base = 0; base < count; base += kTriangleBlockWidth)
+    {
+        TriangleBlock block = {};
+        block.count = std::min(kTriangleBlockWidth, count - base);
+
+        for (uint32_t i = 0; i < block.count; i++)
+        {
+            uint32_t prim = primitiveIDs[base + i];
+
+            // getFaceIndex(), getOnePosition()
+            glm::vec3 p0 = positions[indices[3 * prim + 0]];
+            glm::vec3 p1 = positions[indices[3 * prim + 1]];
+            glm::vec3 p2 = positions[indices[3 * prim + 2]];
+
+            glm::vec3 e1 = p1 - p0;
+            glm::vec3 e2 = p2 - p0;
+
+            for (int c = 0; c < 3; c++)
+            {
+                block.p0[c][i] = p0[c];
+                block.e1[c][i] = e1[c];
+                block.e2[c][i] = e2[c];
+            }
+
+            block.primitiveIDs[i] = prim;
+        }
+
+        blocks.push_back(block);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "CpuFeatures.h"
+#include "RayCpu.h"
+
+// One ray against a block of triangles in SoA layout, 4 (SSE) or 8 (AVX)
+// at a time.  Blocks are built from the same indices/positions layout the
+// hit shaders read (getFaceIndex + getOnePosition).
+
+const uint32_t kTriangleBlockWidth = 8;
+
+struct alignas(32) TriangleBlock
+{
+    float p0[3][kTriangleBlockWidth];
+    float e1[3][kTriangleBlockWidth]; // p1 - p0
+    float e2[3][kTriangleBlockWidth]; // p2 - p0
+
+    uint32_t primitiveIDs[kTriangleBlockWidth];
+    uint32_t count; // unused lanes are degenerate and never hit
+};
+
+// Closest hit in the block with t in [ray.tmin, tmax).  Fills t, u, v and
+// primitiveID.
+typedef bool (*IntersectTriangleBlockFunction)(const TriangleBlock& block,
+    const RayCpu& ray, float tmax, HitCpu* pHit);
+
+// SIMD_LEVEL_AVX2 uses the AVX kernel
+IntersectTriangleBlockFunction getIntersectTriangleBlockFunction(SimdLevel level);
+
+// Appends (count + 7) / 8 blocks for the triangles in primitiveIDs
+void buildTriangleBlocks(const glm::vec3* positions, const uint32_t* indices,
+    const uint32_t* primitiveIDs, uint32_t count, std::vector<TriangleBlock>& blocks);
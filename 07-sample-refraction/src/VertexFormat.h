@@ -0,0 +1,96 @@
+#pragma once
+
+#include "App.h"
+
+// Compact vertex and index formats (GltfLoadInfo::compactVertices), set
+// per mesh in Mesh::format.  The CPU copies hold the packed arrays and the
+// GPU vertex records the packed values; the shaders and the CPU raytracer
+// decode them at the hit.  Positions stay float, they are the BLAS build
+// input and what the CPU BVHs read.
+enum MeshFormatFlags
+{
+    MESH_FORMAT_OCT_NORMALS = 1 << 0, // snorm16x2 octahedral normals in octNormalData
+    MESH_FORMAT_HALF_UVS = 1 << 1,    // half2 UVs in halfUvData
+    MESH_FORMAT_INDEX16 = 1 << 2,     // 16 bit GPU indices, the CPU copy stays 32 bit for the BVHs
+};
+
+// Keep in sync with chit.rchit
+
+inline uint32_t encodeOctNormal(const glm::vec3& n)
+{
+    float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    glm::vec2 p = sum > 0.f ? glm::vec2(n.x, n.y) / sum : glm::vec2(0.f);
+
+    // Fold the lower hemisphere over the diagonals
+    if (n.z < 0.f)
+    {
+        glm::vec2 folded = 1.f - glm::abs(glm::vec2(p.y, p.x));
+        p.x = p.x >= 0.f ? folded.x : -folded.x;
+        p.y = p.y >= 0.f ? folded.y : -folded.y;
+    }
+
+    return glm::packSnorm2x16(p);
+}
+
+inline glm::vec3 decodeOctNormal(uint32_t packed)
+{
+    glm::vec2 p = glm::unpackSnorm2x16(packed);
+    glm::vec3 n(p.x, p.y, 1.f - fabsf(p.x) - fabsf(p.y));
+
+    float t = std::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+
+    return glm::normalize(n);
+}
+
+inline uint32_t encodeHalfUv(const glm::vec2& uv)
+{
+    return glm::packHalf2x16(uv);
+}
+
+inline glm::vec2 decodeHalfUv(uint32_t packed)
+{
+    return glm::unpackHalf2x16(packed);
+}
+
+// Bytes per vertex or index, as in the GPU buffers
+inline size_t getNormalSize(uint32_t format)
+{
+    return format & MESH_FORMAT_OCT_NORMALS ? sizeof(uint32_t) : sizeof(glm::vec3);
+}
+
+inline size_t getUvSize(uint32_t format)
+{
+    return format & MESH_FORMAT_HALF_UVS ? sizeof(uint32_t) : sizeof(glm::vec2);
+}
+
+inline size_t getGpuIndexSize(uint32_t format)
+{
+    return format & MESH_FORMAT_INDEX16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+// GPU vertex record: position, normal, UV
+inline size_t getVertexStride(uint32_t format)
+{
+    return sizeof(glm::vec3) + getNormalSize(format) + getUvSize(format);
+}
+
+// 16 bit indices are padded to a whole number of 32 bit words, which is
+// how the shaders read them
+inline size_t getGpuIndexBufferSize(const Mesh& mesh)
+{
+    return mesh.format & MESH_FORMAT_INDEX16 ?
+        ((mesh.indexCount + 1) & ~1u) * sizeof(uint16_t) : mesh.indexCount * sizeof(uint32_t);
+}
+
+inline glm::vec3 getVertexNormal(const Mesh& mesh, uint32_t index)
+{
+    return mesh.format & MESH_FORMAT_OCT_NORMALS ?
+        decodeOctNormal(mesh.octNormalData[index]) : mesh.normalData[index];
+}
+
+inline glm::vec2 getVertexUv(const Mesh& mesh, uint32_t index)
+{
+    return mesh.format & MESH_FORMAT_HALF_UVS ? decodeHalfUv(mesh.halfUvData[index]) : mesh.uvData[index];
+}
@@ -0,0 +1,653 @@
+#include "pch.h"
+
+#include "CpuFeatures.h"
+#include "logging.h"
+#include "WideBvhCpu.h"
+
+static float surfaceArea(const BvhNode& node)
+{
+    glm::vec3 d = node.boundsMax - node.boundsMin;
+    return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Pulls the children of the largest interior child into the node until it
+// has Width children or only leaves are left.  Returns the wide node index.
+template <uint32_t Width>
+static uint32_t collapseNode(const BvhCpu& bvh, uint32_t binaryIndex,
+    std::vector<WideBvhNode<Width>>& nodes, WideBvhStats& stats)
+{
+    const BvhNode* binaryNodes = bvh.pNodes;
+
+    uint32_t slots[Width];
+    uint32_t slotCount = 0;
+
+    if (binaryNodes[binaryIndex].primCount > 0)
+    {
+        // Leaf root, one child
+        slots[slotCount++] = binaryIndex;
+    }
+    else
+    {
+        slots[slotCount++] = binaryIndex + 1;
+        slots[slotCount++] = binaryNodes[binaryIndex].offset;
+    }
+
+    while (slotCount < Width)
+    {
+        int largest = -1;
+        float largestArea = -1.f;
+
+        for (uint32_t i = 0; i < slotCount; i++)
+        {
+            const BvhNode& node = binaryNodes[slots[i]];
+
+            if (node.primCount == 0 && surfaceArea(node) > largestArea)
+            {
+                largest = (int)i;
+                largestArea = surfaceArea(node);
+            }
+        }
+
+        if (largest < 0)
+            break;
+
+        uint32_t expanded = slots[largest];
+        slots[largest] = expanded + 1;
+        slots[slotCount++] = binaryNodes[expanded].offset;
+    }
+
+    uint32_t nodeIndex = (uint32_t)nodes.size();
+    nodes.emplace_back();
+
+    stats.avgChildren += slotCount;
+
+    const float inf = std::numeric_limits<float>::infinity();
+
+    for (uint32_t i = 0; i < Width; i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            nodes[nodeIndex].bounds[0][axis][i] = i < slotCount ? binaryNodes[slots[i]].boundsMin[axis] : inf;
+            nodes[nodeIndex].bounds[1][axis][i] = i < slotCount ? binaryNodes[slots[i]].boundsMax[axis] : -inf;
+        }
+
+        nodes[nodeIndex].children[i] = 0;
+        nodes[nodeIndex].primCounts[i] = 0;
+    }
+
+    // Children are appended depth first after this node
+    for (uint32_t i = 0; i < slotCount; i++)
+    {
+        const BvhNode& child = binaryNodes[slots[i]];
+
+        if (child.primCount > 0)
+        {
+            nodes[nodeIndex].children[i] = child.offset;
+            nodes[nodeIndex].primCounts[i] = child.primCount;
+            stats.leafCount++;
+        }
+        else
+        {
+            uint32_t childIndex = collapseNode(bvh, slots[i], nodes, stats);
+            nodes[nodeIndex].children[i] = childIndex;
+        }
+    }
+
+    return nodeIndex;
+}
+
+template <uint32_t Width>
+static void buildWideNodes(const BvhCpu& bvh, std::vector<WideBvhNode<Width>>& nodes, WideBvhStats& stats)
+{
+    nodes.clear();
+    nodes.reserve(bvh.nodeCount / (Width / 2) + 1);
+
+    collapseNode(bvh, 0, nodes, stats);
+
+    nodes.shrink_to_fit();
+
+    stats.nodeCount = (uint32_t)nodes.size();
+    stats.avgChildren /= stats.nodeCount;
+    stats.memoryBytes = nodes.size() * sizeof(WideBvhNode<Width>) + bvh.stats.referenceCount * sizeof(uint32_t) +
+        bvh.stats.triangleRecordBytes;
+}
+
+// Smallest q with origin + q * scale <= value, or the largest with
+// origin + q * scale >= value.  The decode must match the traversal's.
+static uint8_t quantizeBound(float value, float origin, float scale, bool roundUp)
+{
+    if (scale == 0.f)
+        return 0;
+
+    int q = (int)(roundUp ? ceilf((value - origin) / scale) : floorf((value - origin) / scale));
+    q = std::min(std::max(q, 0), 255);
+
+    for (;;)
+    {
+        float scaled = (float)q * scale;
+        float decoded = origin + scaled;
+
+        if (roundUp ? (decoded >= value || q == 255) : (decoded <= value || q == 0))
+            break;
+
+        q += roundUp ? 1 : -1;
+    }
+
+    return (uint8_t)q;
+}
+
+template <uint32_t Width>
+static bool quantizeNodes(const std::vector<WideBvhNode<Width>>& nodes,
+    std::vector<QuantizedBvhNode<Width>>& quantizedNodes)
+{
+    quantizedNodes.resize(nodes.size());
+
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        const WideBvhNode<Width>& node = nodes[n];
+        QuantizedBvhNode<Width>& qnode = quantizedNodes[n];
+
+        uint32_t childCount = 0;
+
+        while (childCount < Width && node.bounds[0][0][childCount] <= node.bounds[1][0][childCount])
+            childCount++;
+
+        qnode.childCount = (uint8_t)childCount;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float boundsMin = FLT_MAX;
+            float boundsMax = -FLT_MAX;
+
+            for (uint32_t i = 0; i < childCount; i++)
+            {
+                boundsMin = std::min(boundsMin, node.bounds[0][axis][i]);
+                boundsMax = std::max(boundsMax, node.bounds[1][axis][i]);
+            }
+
+            // The grid has to reach boundsMax after rounding
+            float scale = (boundsMax - boundsMin) / 255.f;
+
+            while (boundsMin + 255.f * scale < boundsMax)
+                scale = nextafterf(scale, FLT_MAX);
+
+            qnode.origin[axis] = boundsMin;
+            qnode.scale[axis] = scale;
+
+            for (uint32_t i = 0; i < Width; i++)
+            {
+                bool used = i < childCount;
+
+                qnode.qbounds[0][axis][i] = used ? quantizeBound(node.bounds[0][axis][i], boundsMin, scale, false) : 255;
+                qnode.qbounds[1][axis][i] = used ? quantizeBound(node.bounds[1][axis][i], boundsMin, scale, true) : 0;
+            }
+        }
+
+        for (uint32_t i = 0; i < Width; i++)
+        {
+            if (node.primCounts[i] > 255)
+            {
+                DebugPrint("Error: %u triangles in a leaf, quantized nodes take up to 255\n", node.primCounts[i]);
+                return false;
+            }
+
+            qnode.children[i] = node.children[i];
+            qnode.primCounts[i] = (uint8_t)node.primCounts[i];
+        }
+    }
+
+    return true;
+}
+
+bool createWideBvhCpu(const WideBvhCpuCreateInfo& ci, WideBvhCpu* pWideBvh)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    WideBvhCpu& wideBvh = *pWideBvh;
+
+    wideBvh.width = ci.width;
+    wideBvh.quantized = ci.quantized;
+    wideBvh.pBvh = ci.pBvh;
+    wideBvh.stats = {};
+
+    if (ci.pBvh->nodeCount == 0)
+        return false;
+
+    if (wideBvh.width == 8 && detectSimdLevel() < SIMD_LEVEL_AVX)
+    {
+        DebugPrint("Warning: no AVX, using 4 wide BVH nodes\n");
+        wideBvh.width = 4;
+    }
+
+    if (wideBvh.width == 8)
+    {
+        buildWideNodes(*ci.pBvh, wideBvh.nodes8, wideBvh.stats);
+    }
+    else if (wideBvh.width == 4)
+    {
+        buildWideNodes(*ci.pBvh, wideBvh.nodes4, wideBvh.stats);
+    }
+    else
+    {
+        DebugPrint("Error: unsupported BVH width %u\n", ci.width);
+        return false;
+    }
+
+    if (wideBvh.quantized)
+    {
+        bool res = wideBvh.width == 8 ?
+            quantizeNodes(wideBvh.nodes8, wideBvh.quantizedNodes8) :
+            quantizeNodes(wideBvh.nodes4, wideBvh.quantizedNodes4);
+
+        if (!res)
+            return false;
+
+        // Only the quantized nodes are traversed
+        size_t floatBytes = wideBvh.nodes4.size() * sizeof(WideBvhNode<4>) + wideBvh.nodes8.size() * sizeof(WideBvhNode<8>);
+        size_t quantizedBytes = wideBvh.quantizedNodes4.size() * sizeof(QuantizedBvhNode<4>) +
+            wideBvh.quantizedNodes8.size() * sizeof(QuantizedBvhNode<8>);
+
+        wideBvh.stats.memoryBytes = wideBvh.stats.memoryBytes - floatBytes + quantizedBytes;
+
+        wideBvh.nodes4.clear();
+        wideBvh.nodes4.shrink_to_fit();
+        wideBvh.nodes8.clear();
+        wideBvh.nodes8.shrink_to_fit();
+    }
+
+    wideBvh.stats.bytesPerTriangle = (float)wideBvh.stats.memoryBytes / std::max(ci.pBvh->stats.primCount, 1u);
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    wideBvh.stats.buildTimeMs = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+
+    return true;
+}
+
+void destroyWideBvhCpu(WideBvhCpu& wideBvh)
+{
+    wideBvh.nodes4.clear();
+    wideBvh.nodes4.shrink_to_fit();
+    wideBvh.nodes8.clear();
+    wideBvh.nodes8.shrink_to_fit();
+    wideBvh.quantizedNodes4.clear();
+    wideBvh.quantizedNodes4.shrink_to_fit();
+    wideBvh.quantizedNodes8.clear();
+    wideBvh.quantizedNodes8.shrink_to_fit();
+}
+
+// Per ray constants of the slab test.  The near plane of an axis is the
+// min bound for positive directions and the max bound for negative ones,
+// which also makes the inverted bounds of unused slots miss.
+struct WideRay
+{
+    glm::vec3 invDirection;
+    uint32_t nearIndex[3];
+};
+
+static void prepareWideRay(const RayCpu& ray, WideRay* pWideRay)
+{
+    pWideRay->invDirection = 1.f / ray.direction;
+
+    for (int axis = 0; axis < 3; axis++)
+        pWideRay->nearIndex[axis] = std::signbit(pWideRay->invDirection[axis]) ? 1 : 0;
+}
+
+// Returns the mask of children hit within [ray.tmin, tmax], with their
+// entry distances in pEnter.  max/min take the plane distance as the first
+// operand so a NaN (origin on the plane of a zero direction component) is
+// ignored.
+static uint32_t intersectChildren(const WideBvhNode<4>& node, const RayCpu& ray,
+    const WideRay& wideRay, float tmax, float* pEnter)
+{
+    __m128 enter = _mm_set1_ps(ray.tmin);
+    __m128 exit = _mm_set1_ps(tmax);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        __m128 origin = _mm_set1_ps(ray.origin[axis]);
+        __m128 invDirection = _mm_set1_ps(wideRay.invDirection[axis]);
+
+        uint32_t nearIndex = wideRay.nearIndex[axis];
+
+        __m128 tnear = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[nearIndex][axis]), origin), invDirection);
+        __m128 tfar = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[1 - nearIndex][axis]), origin), invDirection);
+
+        enter = _mm_max_ps(tnear, enter);
+        exit = _mm_min_ps(tfar, exit);
+    }
+
+    _mm_storeu_ps(pEnter, enter);
+
+    return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(enter, exit));
+}
+
+static uint32_t intersectChildren(const WideBvhNode<8>& node, const RayCpu& ray,
+    const WideRay& wideRay, float tmax, float* pEnter)
+{
+    __m256 enter = _mm256_set1_ps(ray.tmin);
+    __m256 exit = _mm256_set1_ps(tmax);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+        __m256 invDirection = _mm256_set1_ps(wideRay.invDirection[axis]);
+
+        uint32_t nearIndex = wideRay.nearIndex[axis];
+
+        __m256 tnear = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[nearIndex][axis]), origin), invDirection);
+        __m256 tfar = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[1 - nearIndex][axis]), origin), invDirection);
+
+        enter = _mm256_max_ps(tnear, enter);
+        exit = _mm256_min_ps(tfar, exit);
+    }
+
+    _mm256_storeu_ps(pEnter, enter);
+
+    return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ));
+}
+
+// Same slab test on the decoded bounds.  origin + q * scale is evaluated as in
+// quantizeBound(), so the boxes contain the exact ones.
+static __m128 decodeBounds(const uint8_t* q, float origin, float scale)
+{
+    int32_t packed;
+    memcpy(&packed, q, sizeof(packed));
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i q32 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+
+    return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(q32), _mm_set1_ps(scale)));
+}
+
+// Two halves, 8 bit to 32 bit widening on 256 bit registers needs AVX2
+static __m256 decodeBounds8(const uint8_t* q, float origin, float scale)
+{
+    __m128 lo = decodeBounds(q, origin, scale);
+    __m128 hi = decodeBounds(q + 4, origin, scale);
+
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+
+static uint32_t intersectChildren(const QuantizedBvhNode<4>& node, const RayCpu& ray,
+    const WideRay& wideRay, float tmax, float* pEnter)
+{
+    __m128 enter = _mm_set1_ps(ray.tmin);
+    __m128 exit = _mm_set1_ps(tmax);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        __m128 origin = _mm_set1_ps(ray.origin[axis]);
+        __m128 invDirection = _mm_set1_ps(wideRay.invDirection[axis]);
+
+        uint32_t nearIndex = wideRay.nearIndex[axis];
+
+        __m128 nearBounds = decodeBounds(node.qbounds[nearIndex][axis], node.origin[axis], node.scale[axis]);
+        __m128 farBounds = decodeBounds(node.qbounds[1 - nearIndex][axis], node.origin[axis], node.scale[axis]);
+
+        __m128 tnear = _mm_mul_ps(_mm_sub_ps(nearBounds, origin), invDirection);
+        __m128 tfar = _mm_mul_ps(_mm_sub_ps(farBounds, origin), invDirection);
+
+        enter = _mm_max_ps(tnear, enter);
+        exit = _mm_min_ps(tfar, exit);
+    }
+
+    _mm_storeu_ps(pEnter, enter);
+
+    uint32_t mask = (uint32_t)_mm_movemask_ps(_mm_cmple_ps(enter, exit));
+
+    return mask & ((1u << node.childCount) - 1);
+}
+
+static uint32_t intersectChildren(const QuantizedBvhNode<8>& node, const RayCpu& ray,
+    const WideRay& wideRay, float tmax, float* pEnter)
+{
+    __m256 enter = _mm256_set1_ps(ray.tmin);
+    __m256 exit = _mm256_set1_ps(tmax);
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+        __m256 invDirection = _mm256_set1_ps(wideRay.invDirection[axis]);
+
+        uint32_t nearIndex = wideRay.nearIndex[axis];
+
+        __m256 nearBounds = decodeBounds8(node.qbounds[nearIndex][axis], node.origin[axis], node.scale[axis]);
+        __m256 farBounds = decodeBounds8(node.qbounds[1 - nearIndex][axis], node.origin[axis], node.scale[axis]);
+
+        __m256 tnear = _mm256_mul_ps(_mm256_sub_ps(nearBounds, origin), invDirection);
+        __m256 tfar = _mm256_mul_ps(_mm256_sub_ps(farBounds, origin), invDirection);
+
+        enter = _mm256_max_ps(tnear, enter);
+        exit = _mm256_min_ps(tfar, exit);
+    }
+
+    _mm256_storeu_ps(pEnter, enter);
+
+    uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(enter, exit, _CMP_LE_OQ));
+
+    return mask & ((1u << node.childCount) - 1);
+}
+
+struct WideStackEntry
+{
+    uint32_t child;
+    uint32_t primCount; // 0 -> node
+    float enter;
+};
+
+template <typename Node>
+static bool intersectWideNodes(const WideBvhCpu& wideBvh, const std::vector<Node>& nodes,
+    const RayCpu& ray, bool anyHit, HitCpu* pHit)
+{
+    const BvhCpu& bvh = *wideBvh.pBvh;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+    const uint32_t* indices = bvh.indices;
+    const glm::vec3* positions = bvh.positions;
+    const TriangleRecord* records = bvh.triangleRecords.empty() ? nullptr : bvh.triangleRecords.data();
+
+    WideRay wideRay;
+    prepareWideRay(ray, &wideRay);
+
+    float tmax = ray.tmax;
+    bool found = false;
+
+    // Up to kWidth - 1 entries stay behind per level
+    WideStackEntry stack[kMaxBvhDepth * kWideBvhMaxWidth];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = { 0, 0, ray.tmin };
+
+    while (stackSize > 0)
+    {
+        WideStackEntry entry = stack[--stackSize];
+
+        if (entry.enter > tmax)
+            continue;
+
+        if (entry.primCount > 0)
+        {
+            for (uint32_t i = entry.child; i < entry.child + entry.primCount; i++)
+            {
+                float t, u, v;
+
+                if (records)
+                {
+                    if (!intersectTriangleRecord(ray.origin, ray.direction, records[i],
+                        ray.tmin, tmax, &t, &u, &v))
+                        continue;
+                }
+                else
+                {
+                    uint32_t prim = primIndices[i];
+
+                    if (!intersectTriangle(ray.origin, ray.direction,
+                        positions[indices[3 * prim + 0]],
+                        positions[indices[3 * prim + 1]],
+                        positions[indices[3 * prim + 2]],
+                        ray.tmin, tmax, &t, &u, &v))
+                        continue;
+                }
+
+                tmax = t;
+                found = true;
+
+                pHit->t = t;
+                pHit->u = u;
+                pHit->v = v;
+                pHit->primitiveID = primIndices[i];
+
+                if (anyHit)
+                    return true;
+            }
+
+            continue;
+        }
+
+        const Node& node = nodes[entry.child];
+
+        alignas(32) float enter[Node::kWidth];
+        uint32_t mask = intersectChildren(node, ray, wideRay, tmax, enter);
+
+        // Push farthest first so the nearest child is on top
+        uint32_t first = stackSize;
+
+        while (mask)
+        {
+            unsigned long slot;
+            _BitScanForward(&slot, mask);
+            mask &= mask - 1;
+
+            WideStackEntry child = { node.children[slot], node.primCounts[slot], enter[slot] };
+
+            uint32_t i = stackSize++;
+
+            while (i > first && stack[i - 1].enter < child.enter)
+            {
+                stack[i] = stack[i - 1];
+                i--;
+            }
+
+            stack[i] = child;
+        }
+    }
+
+    return found;
+}
+
+template <typename Node>
+static bool occludedWideNodes(const WideBvhCpu& wideBvh, const std::vector<Node>& nodes,
+    const RayCpu& ray)
+{
+    const BvhCpu& bvh = *wideBvh.pBvh;
+    const uint32_t* primIndices = bvh.pPrimIndices;
+    const uint32_t* indices = bvh.indices;
+    const glm::vec3* positions = bvh.positions;
+    const TriangleRecord* records = bvh.triangleRecords.empty() ? nullptr : bvh.triangleRecords.data();
+
+    WideRay wideRay;
+    prepareWideRay(ray, &wideRay);
+
+    uint32_t stack[kMaxBvhDepth * kWideBvhMaxWidth];
+    uint32_t stackSize = 0;
+
+    stack[stackSize++] = 0;
+
+    while (stackSize > 0)
+    {
+        const Node& node = nodes[stack[--stackSize]];
+
+        alignas(32) float enter[Node::kWidth];
+        uint32_t mask = intersectChildren(node, ray, wideRay, ray.tmax, enter);
+
+        while (mask)
+        {
+            unsigned long slot;
+            _BitScanForward(&slot, mask);
+            mask &= mask - 1;
+
+            if (node.primCounts[slot] == 0)
+            {
+                stack[stackSize++] = node.children[slot];
+                continue;
+            }
+
+            uint32_t begin = node.children[slot];
+
+            for (uint32_t i = begin; i < begin + node.primCounts[slot]; i++)
+            {
+                if (records)
+                {
+                    float t, u, v;
+
+                    if (intersectTriangleRecord(ray.origin, ray.direction, records[i],
+                        ray.tmin, ray.tmax, &t, &u, &v))
+                        return true;
+
+                    continue;
+                }
+
+                uint32_t prim = primIndices[i];
+
+                if (occludesTriangle(ray.origin, ray.direction,
+                    positions[indices[3 * prim + 0]],
+                    positions[indices[3 * prim + 1]],
+                    positions[indices[3 * prim + 2]],
+                    ray.tmin, ray.tmax))
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+template <typename Node>
+static bool intersectWideNodesChecked(const WideBvhCpu& wideBvh, const std::vector<Node>& nodes,
+    const RayCpu& ray, bool anyHit, HitCpu* pHit)
+{
+    return !nodes.empty() && intersectWideNodes(wideBvh, nodes, ray, anyHit, pHit);
+}
+
+bool intersectWideBvhCpu(const WideBvhCpu& wideBvh, const RayCpu& ray, bool anyHit, HitCpu* pHit)
+{
+    if (wideBvh.quantized)
+    {
+        return wideBvh.width == 8 ?
+            intersectWideNodesChecked(wideBvh, wideBvh.quantizedNodes8, ray, anyHit, pHit) :
+            intersectWideNodesChecked(wideBvh, wideBvh.quantizedNodes4, ray, anyHit, pHit);
+    }
+
+    return wideBvh.width == 8 ?
+        intersectWideNodesChecked(wideBvh, wideBvh.nodes8, ray, anyHit, pHit) :
+        intersectWideNodesChecked(wideBvh, wideBvh.nodes4, ray, anyHit, pHit);
+}
+
+template <typename Node>
+static bool occludedWideNodesChecked(const WideBvhCpu& wideBvh, const std::vector<Node>& nodes,
+    const RayCpu& ray)
+{
+    return !nodes.empty() && occludedWideNodes(wideBvh, nodes, ray);
+}
+
+bool occludedWideBvhCpu(const WideBvhCpu& wideBvh, const RayCpu& ray)
+{
+    if (wideBvh.quantized)
+    {
+        return wideBvh.width == 8 ?
+            occludedWideNodesChecked(wideBvh, wideBvh.quantizedNodes8, ray) :
+            occludedWideNodesChecked(wideBvh, wideBvh.quantizedNodes4, ray);
+    }
+
+    return wideBvh.width == 8 ?
+        occludedWideNodesChecked(wideBvh, wideBvh.nodes8, ray) :
+        occludedWideNodesChecked(wideBvh, wideBvh.nodes4, ray);
+}
+
+void printWideBvhStats(const WideBvhCpu& wideBvh, const char* name)
+{
+    const WideBvhStats& stats = wideBvh.stats;
+
+    DebugPrint("BVH%u%s %s: %.2f ms, %u nodes, %u leaves, %.2f children per node, %.1f KB, %.1f bytes/tri\n",
+        wideBvh.width, wideBvh.quantized ? " quantized" : "", name, stats.buildTimeMs, stats.nodeCount,
+        stats.leafCount, stats.avgChildren, stats.memoryBytes / 1024., stats.bytesPerTriangle);
+}
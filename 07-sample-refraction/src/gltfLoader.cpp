@@ -3,6 +3,39 @@
 #include "App.h"
 #include "logging.h"
 #include "gltfLoader.h"
+#include "Hash.h"
+#include "MappedFile.h"
+#include "GltfSource.h"
+#include "GltfStream.h"
+#include "Base64.h"
+#include "JobSystem.h"
+#include "CookedScene.h"
+#include "VertexFormat.h"
+
+// Binary glTF (.glb): a 12 byte header, then chunks of { length, type, data }
+// padded to 4 bytes, the JSON chunk first and optionally the BIN chunk.
+const uint32_t kGlbMagic = 0x46546C67;     // "glTF"
+const uint32_t kGlbVersion = 2;
+const uint32_t kGlbChunkJson = 0x4E4F534A; // "JSON"
+const uint32_t kGlbChunkBin = 0x004E4942;  // "BIN\0"
+
+// Stands in for buffers whose data the loader provides itself, so tinygltf
+// neither copies nor decodes them
+const char* kPlaceholderBufferUri = "data:application/octet-stream;base64,AA==";
+
+// Buffer data of a mesh in the GPU formats, uploaded from there rather
+// than from the CPU copies.  Points into the file mapping for a .glb or a
+// cooked scene.  The indices of a glTF mesh are its widened CPU copy, and
+// packed normals, UVs and 16 bit indices are converted on the way.
+struct MeshSource
+{
+    const uint8_t* pPositions;
+    const uint8_t* pNormals;
+    const uint8_t* pUvs;
+    const uint8_t* pIndices;
+
+    std::vector<uint16_t> indices16; // with MESH_FORMAT_INDEX16, padded as the buffer
+};
 
 static bool readVec3(const std::vector<double>& src, glm::vec3* dst,
     const glm::vec3& defaultValue = glm::vec3(0.f))
@@ -34,7 +67,7 @@ static bool readVec4(const std::vector<double>& src, glm::vec4* dst,
     }
 }
 
-static bool readQuat(std::vector<double>& src, glm::quat* dst,
+static bool readQuat(const std::vector<double>& src, glm::quat* dst,
     const glm::quat& defaultValue = glm::quat(1.f, 0.f, 0.f, 0.f))
 {
     // glm uses w, x, y, z
@@ -50,9 +83,48 @@ static bool readQuat(std::vector<double>& src, glm::quat* dst,
     }
 };
 
-static void loadMesh(DeviceVulkan& vk, tinygltf::Model& gltfModel,
-    tinygltf::Mesh& gltfMesh, Mesh* pMesh)
+static bool hasDevice(const DeviceVulkan& vk)
+{
+    // No device when running headless (CPU raytracer only)
+    return vk.device != VK_NULL_HANDLE;
+}
+
+static const uint8_t* getBufferViewData(const GltfSource& src, int bufferViewID)
+{
+    auto& bv = src.model.bufferViews[bufferViewID];
+
+    if (src.pBin && bv.buffer == 0)
+        return src.pBin + bv.byteOffset;
+
+    return &src.model.buffers[bv.buffer].data[bv.byteOffset];
+}
+
+// CPU copy of an attribute: read in place from the BIN chunk of a .glb,
+// whose mapping the scene keeps, or copied out of a buffer tinygltf owns
+template <typename T>
+static const T* getAttributeData(const GltfSource& src, int bufferViewID, const uint8_t* pData,
+    uint32_t count, std::vector<T>& storage)
+{
+    if (src.pBin && src.model.bufferViews[bufferViewID].buffer == 0)
+        return (const T*)pData;
+
+    storage.assign((const T*)pData, (const T*)pData + count);
+    return storage.data();
+}
+
+// Narrowed from the 32 bit CPU copy
+static void setIndices16(const Mesh& mesh, MeshSource* pSource)
+{
+    pSource->indices16.assign(mesh.indexData, mesh.indexData + mesh.indexCount);
+    pSource->indices16.resize(getGpuIndexBufferSize(mesh) / sizeof(uint16_t), 0);
+    pSource->pIndices = (const uint8_t*)pSource->indices16.data();
+}
+
+static void loadMesh(GltfSource& src, tinygltf::Mesh& gltfMesh, bool compact, Mesh* pMesh,
+    MeshSource* pSource)
 {
+    tinygltf::Model& gltfModel = src.model;
+
     // Only handle single triangle primitives (for now).
     BASSERT(gltfMesh.primitives.size() == 1);
 
@@ -79,18 +151,11 @@ static void loadMesh(DeviceVulkan& vk, tinygltf::Model& gltfModel,
 
         pMesh->vertexCount = (uint32_t)gltfModel.accessors[idPosition].count;
 
-        auto& bv = gltfModel.bufferViews[gltfModel.accessors[idPosition].bufferView];
-
-        //std::vector<glm::vec3> dbgPositions(bv.byteLength / 12);
-        //memcpy(dbgPositions.data(),
-        //    &gltfModel.buffers[bv.buffer].data[bv.byteOffset], bv.byteLength);
+        int bufferView = gltfModel.accessors[idPosition].bufferView;
 
-        createBufferVulkan(vk, { bv.byteLength,
-            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-            VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            &gltfModel.buffers[bv.buffer].data[bv.byteOffset] },
-            &pMesh->positions);
+        pSource->pPositions = getBufferViewData(src, bufferView);
+        pMesh->positionData = getAttributeData(src, bufferView, pSource->pPositions,
+            pMesh->vertexCount, pMesh->positionStorage);
     }
 
     // Load normals
@@ -100,15 +165,28 @@ static void loadMesh(DeviceVulkan& vk, tinygltf::Model& gltfModel,
         BASSERT(gltfModel.accessors[idNormal].componentType == TINYGLTF_COMPONENT_TYPE_FLOAT
             && gltfModel.accessors[idNormal].type == TINYGLTF_TYPE_VEC3);
 
-        auto& bv = gltfModel.bufferViews[gltfModel.accessors[idNormal].bufferView];
-
         //auto normalCount = gltfModel.accessors[idNormal].count;
 
-        createBufferVulkan(vk, { bv.byteLength,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            &gltfModel.buffers[bv.buffer].data[bv.byteOffset] },
-            &pMesh->normals);
+        pSource->pNormals = getBufferViewData(src, gltfModel.accessors[idNormal].bufferView);
+
+        if (compact)
+        {
+            const glm::vec3* pNormals = (const glm::vec3*)pSource->pNormals;
+
+            pMesh->format |= MESH_FORMAT_OCT_NORMALS;
+            pMesh->octNormalStorage.resize(pMesh->vertexCount);
+
+            for (size_t i = 0; i < pMesh->octNormalStorage.size(); i++)
+                pMesh->octNormalStorage[i] = encodeOctNormal(pNormals[i]);
+
+            pMesh->octNormalData = pMesh->octNormalStorage.data();
+            pSource->pNormals = (const uint8_t*)pMesh->octNormalStorage.data();
+        }
+        else
+        {
+            pMesh->normalData = getAttributeData(src, gltfModel.accessors[idNormal].bufferView,
+                pSource->pNormals, pMesh->vertexCount, pMesh->normalStorage);
+        }
     }
 
     // Load uvs
@@ -118,13 +196,26 @@ static void loadMesh(DeviceVulkan& vk, tinygltf::Model& gltfModel,
         BASSERT(gltfModel.accessors[idTexcoord0].componentType == TINYGLTF_COMPONENT_TYPE_FLOAT
             && gltfModel.accessors[idTexcoord0].type == TINYGLTF_TYPE_VEC2);
 
-        auto& bv = gltfModel.bufferViews[gltfModel.accessors[idTexcoord0].bufferView];
+        pSource->pUvs = getBufferViewData(src, gltfModel.accessors[idTexcoord0].bufferView);
+
+        if (compact)
+        {
+            const glm::vec2* pUvs = (const glm::vec2*)pSource->pUvs;
 
-        createBufferVulkan(vk, { bv.byteLength,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            &gltfModel.buffers[bv.buffer].data[bv.byteOffset] },
-            &pMesh->uvs);
+            pMesh->format |= MESH_FORMAT_HALF_UVS;
+            pMesh->halfUvStorage.resize(pMesh->vertexCount);
+
+            for (size_t i = 0; i < pMesh->halfUvStorage.size(); i++)
+                pMesh->halfUvStorage[i] = encodeHalfUv(pUvs[i]);
+
+            pMesh->halfUvData = pMesh->halfUvStorage.data();
+            pSource->pUvs = (const uint8_t*)pMesh->halfUvStorage.data();
+        }
+        else
+        {
+            pMesh->uvData = getAttributeData(src, gltfModel.accessors[idTexcoord0].bufferView,
+                pSource->pUvs, pMesh->vertexCount, pMesh->uvStorage);
+        }
     }
 
     // Load indices
@@ -135,37 +226,298 @@ static void loadMesh(DeviceVulkan& vk, tinygltf::Model& gltfModel,
         uint32_t indexCount = (uint32_t)gltfModel.accessors[idIndices].count;
         pMesh->indexCount = indexCount;
 
-        std::vector<uint16_t> indices16(indexCount);
+        // Widened straight from the source, the GPU gets the 32 bit copy
+        const uint16_t* pIndices16 = (const uint16_t*)getBufferViewData(src,
+            gltfModel.accessors[idIndices].bufferView);
+
+        pMesh->indexStorage.assign(pIndices16, pIndices16 + indexCount);
+        pMesh->indexData = pMesh->indexStorage.data();
+        pSource->pIndices = (const uint8_t*)pMesh->indexStorage.data();
+
+        if (compact && pMesh->vertexCount <= 0x10000)
+            pMesh->format |= MESH_FORMAT_INDEX16;
+    }
+}
 
-        auto& bv = gltfModel.bufferViews[gltfModel.accessors[idIndices].bufferView];
+// Duplicates keep their counts and material only, see Mesh::geometryID
+static void releaseMeshData(Mesh& mesh)
+{
+    mesh.positionData = nullptr;
+    mesh.normalData = nullptr;
+    mesh.octNormalData = nullptr;
+    mesh.uvData = nullptr;
+    mesh.halfUvData = nullptr;
+    mesh.indexData = nullptr;
+
+    mesh.positionStorage = {};
+    mesh.normalStorage = {};
+    mesh.octNormalStorage = {};
+    mesh.uvStorage = {};
+    mesh.halfUvStorage = {};
+    mesh.indexStorage = {};
+}
 
-        memcpy(indices16.data(), &gltfModel.buffers[bv.buffer].data[bv.byteOffset],
-            bv.byteLength);
+// One record per vertex, the attributes in the formats of mesh
+static void writeVertexRecords(const MeshSource& source, const Mesh& mesh, uint8_t* pDst)
+{
+    size_t normalSize = getNormalSize(mesh.format);
+    size_t uvSize = getUvSize(mesh.format);
+    size_t stride = getVertexStride(mesh.format);
 
-        std::vector<uint32_t> indices32(indices16.begin(), indices16.end());
+    for (uint32_t i = 0; i < mesh.vertexCount; i++)
+    {
+        uint8_t* pVertex = pDst + i * stride;
 
-        createBufferVulkan(vk, { indexCount * sizeof(uint32_t),
-            VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-            VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-            indices32.data() }, &pMesh->indices);
+        memcpy(pVertex, source.pPositions + i * sizeof(glm::vec3), sizeof(glm::vec3));
+        memcpy(pVertex + sizeof(glm::vec3), source.pNormals + i * normalSize, normalSize);
+        memcpy(pVertex + sizeof(glm::vec3) + normalSize, source.pUvs + i * uvSize, uvSize);
     }
 }
 
-static void loadMeshes(DeviceVulkan& vk, tinygltf::Model& model, Scene* pScene)
+// fn(index) for every index in [0, count), on the job system if there is one
+template <typename Function>
+static void forEachIndex(JobSystem* pJobSystem, uint32_t count, const Function& fn)
+{
+    if (pJobSystem)
+    {
+        parallelFor(*pJobSystem, count, [&fn](uint32_t index, uint32_t) { fn(index); });
+    }
+    else
+    {
+        for (uint32_t index = 0; index < count; index++)
+            fn(index);
+    }
+}
+
+static size_t getMeshDataBytes(const Mesh& mesh)
+{
+    return mesh.vertexCount * (sizeof(glm::vec3) + getNormalSize(mesh.format) + getUvSize(mesh.format)) +
+        mesh.indexCount * sizeof(uint32_t);
+}
+
+// Size first, so moving data between the arrays changes the hash.  Null
+// arrays hash as empty ones.
+static uint64_t hashArray(const void* pData, size_t size, uint64_t seed)
+{
+    size = pData ? size : 0;
+    return hashBytes(pData, size, hashBytes(&size, sizeof(size), seed));
+}
+
+static uint64_t hashMeshGeometry(const Mesh& mesh)
+{
+    size_t vertexCount = mesh.vertexCount;
+
+    uint64_t hash = hashArray(mesh.positionData, vertexCount * sizeof(glm::vec3), 0);
+    hash = hashArray(mesh.normalData, vertexCount * sizeof(glm::vec3), hash);
+    hash = hashArray(mesh.octNormalData, vertexCount * sizeof(uint32_t), hash);
+    hash = hashArray(mesh.uvData, vertexCount * sizeof(glm::vec2), hash);
+    hash = hashArray(mesh.halfUvData, vertexCount * sizeof(uint32_t), hash);
+    return hashArray(mesh.indexData, mesh.indexCount * sizeof(uint32_t), hash);
+}
+
+static bool sameArray(const void* pA, const void* pB, size_t size)
 {
+    return (pA == nullptr) == (pB == nullptr) && (pA == nullptr || memcmp(pA, pB, size) == 0);
+}
+
+static bool sameMeshGeometry(const Mesh& a, const Mesh& b)
+{
+    if (a.format != b.format || a.vertexCount != b.vertexCount || a.indexCount != b.indexCount)
+        return false;
+
+    size_t vertexCount = a.vertexCount;
+
+    return sameArray(a.positionData, b.positionData, vertexCount * sizeof(glm::vec3)) &&
+        sameArray(a.normalData, b.normalData, vertexCount * sizeof(glm::vec3)) &&
+        sameArray(a.octNormalData, b.octNormalData, vertexCount * sizeof(uint32_t)) &&
+        sameArray(a.uvData, b.uvData, vertexCount * sizeof(glm::vec2)) &&
+        sameArray(a.halfUvData, b.halfUvData, vertexCount * sizeof(uint32_t)) &&
+        sameArray(a.indexData, b.indexData, a.indexCount * sizeof(uint32_t));
+}
+
+// Vertex and index data of the geometry owners, in their formats and as
+// float attributes with 32 bit indices
+static void printGeometryMemory(const Scene& scene)
+{
+    size_t cpuBytes = 0;
+    size_t gpuBytes = 0;
+    size_t uncompressedBytes = 0;
+
+    for (size_t i = 0; i < scene.meshes.size(); i++)
+    {
+        const Mesh& mesh = scene.meshes[i];
+
+        if (mesh.geometryID != (int)i)
+            continue;
+
+        size_t vertexBytes = mesh.vertexCount *
+            (sizeof(glm::vec3) + getNormalSize(mesh.format) + getUvSize(mesh.format));
+
+        cpuBytes += vertexBytes + mesh.indexCount * sizeof(uint32_t);
+        gpuBytes += vertexBytes + getGpuIndexBufferSize(mesh);
+        uncompressedBytes += mesh.vertexCount * (2 * sizeof(glm::vec3) + sizeof(glm::vec2)) +
+            mesh.indexCount * sizeof(uint32_t);
+    }
+
+    DebugPrint("Geometry: %.1f KB on the CPU, %.1f KB on the GPU (%.1f KB each uncompressed)\n",
+        cpuBytes / 1024., gpuBytes / 1024., uncompressedBytes / 1024.);
+}
+
+// Scene vertex and index buffers with the geometry owners packed one
+// after the other, sources has one per mesh.  False if the geometry
+// doesn't fit 32 bit byte offsets.
+static bool uploadMeshes(DeviceVulkan& vk, std::vector<MeshSource>& sources, Scene* pScene,
+    JobSystem* pJobSystem)
+{
+    std::vector<uint32_t> owners;
+    size_t vertexBytes = 0;
+    size_t indexBytes = 0;
+
+    // 16 bit index sizes are padded to words, so every offset is word
+    // aligned for the shaders
+    for (size_t i = 0; i < pScene->meshes.size(); i++)
+    {
+        Mesh& mesh = pScene->meshes[i];
+
+        if (mesh.geometryID != (int)i)
+            continue;
+
+        size_t meshVertexBytes = mesh.vertexCount * getVertexStride(mesh.format);
+        size_t meshIndexBytes = getGpuIndexBufferSize(mesh);
+
+        if (meshVertexBytes > UINT32_MAX - vertexBytes || meshIndexBytes > UINT32_MAX - indexBytes)
+        {
+            DebugPrint("Error: mesh %zu: more than 4 GB of vertex or index data in the scene\n", i);
+            return false;
+        }
+
+        mesh.vertexOffset = (uint32_t)vertexBytes;
+        mesh.indexOffset = (uint32_t)indexBytes;
+
+        vertexBytes += meshVertexBytes;
+        indexBytes += meshIndexBytes;
+
+        owners.push_back((uint32_t)i);
+    }
+
+    for (auto& mesh : pScene->meshes)
+    {
+        mesh.vertexOffset = pScene->meshes[mesh.geometryID].vertexOffset;
+        mesh.indexOffset = pScene->meshes[mesh.geometryID].indexOffset;
+    }
+
+    if (!hasDevice(vk))
+        return true;
+
+    createBufferVulkan(vk, { vertexBytes,
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        nullptr }, &pScene->vertexBuffer);
+
+    createBufferVulkan(vk, { indexBytes,
+        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        nullptr }, &pScene->indexBuffer);
+
+    // Mapped once, each mesh is copied into its own range in parallel
+    void* pVertices = nullptr;
+    void* pIndices = nullptr;
+    VK_CHECK(vkMapMemory(vk.device, pScene->vertexBuffer.memory, 0, vertexBytes, 0, &pVertices));
+    VK_CHECK(vkMapMemory(vk.device, pScene->indexBuffer.memory, 0, indexBytes, 0, &pIndices));
+
+    forEachIndex(pJobSystem, (uint32_t)owners.size(), [&](uint32_t index) {
+        const Mesh& mesh = pScene->meshes[owners[index]];
+        MeshSource& source = sources[owners[index]];
+
+        if (mesh.format & MESH_FORMAT_INDEX16)
+            setIndices16(mesh, &source);
+
+        writeVertexRecords(source, mesh, (uint8_t*)pVertices + mesh.vertexOffset);
+        memcpy((uint8_t*)pIndices + mesh.indexOffset, source.pIndices, getGpuIndexBufferSize(mesh));
+    });
+
+    vkUnmapMemory(vk.device, pScene->vertexBuffer.memory);
+    vkUnmapMemory(vk.device, pScene->indexBuffer.memory);
+
+    return true;
+}
+
+static bool loadMeshes(DeviceVulkan& vk, GltfSource& src, bool compact, Scene* pScene,
+    JobSystem* pJobSystem)
+{
+    tinygltf::Model& model = src.model;
+
     // Load meshes
     size_t meshCount = model.meshes.size();
     BASSERT(meshCount > 0);
 
     pScene->meshes.resize(meshCount);
 
-    for (size_t i = 0; i < model.meshes.size(); i++)
-        loadMesh(vk, model, model.meshes[i], &pScene->meshes[i]);
+    std::vector<MeshSource> sources(meshCount);
+    std::vector<uint64_t> hashes(meshCount);
+
+    // Each mesh only writes its own slot, so the order doesn't depend on
+    // the threads
+    forEachIndex(pJobSystem, (uint32_t)meshCount, [&](uint32_t i) {
+        loadMesh(src, model.meshes[i], compact, &pScene->meshes[i], &sources[i]);
+        hashes[i] = hashMeshGeometry(pScene->meshes[i]);
+    });
+
+    // Exporters often write the same geometry once per mesh (e.g. one per
+    // material).  Meshes with the same content share the first one's
+    // vertex records and BLAS, the copies only keep their material.
+    std::unordered_map<uint64_t, std::vector<int>> meshesByHash;
+
+    uint32_t duplicateCount = 0;
+    size_t savedBytes = 0;
+
+    for (size_t i = 0; i < meshCount; i++)
+    {
+        Mesh& mesh = pScene->meshes[i];
+        mesh.geometryID = (int)i;
+
+        // Hash collisions are compared in full
+        std::vector<int>& candidates = meshesByHash[hashes[i]];
+
+        for (int candidate : candidates)
+        {
+            if (sameMeshGeometry(pScene->meshes[candidate], mesh))
+            {
+                mesh.geometryID = candidate;
+                break;
+            }
+        }
+
+        if (mesh.geometryID == (int)i)
+        {
+            candidates.push_back((int)i);
+            continue;
+        }
+
+        duplicateCount++;
+        savedBytes += getMeshDataBytes(mesh);
+
+        releaseMeshData(mesh);
+    }
+
+    if (!uploadMeshes(vk, sources, pScene, pJobSystem))
+        return false;
+
+    // Saved once on the CPU and once more on the GPU (if any)
+    DebugPrint("Meshes: %zu, %zu unique geometries, %u BLAS builds and %.1f KB vertex and index data saved\n",
+        meshCount, meshCount - duplicateCount, duplicateCount, savedBytes / 1024.);
+
+    printGeometryMemory(*pScene);
+
+    return true;
 }
 
-static void loadSceneNodes(tinygltf::Model& model, Scene* pScene)
+static void loadSceneNodes(GltfSource& src, Scene* pScene)
 {
+    tinygltf::Model& model = src.model;
+
     // Load scene nodes
     BASSERT(model.defaultScene == 0);
     tinygltf::Scene& gltfScene = model.scenes[model.defaultScene];
@@ -174,28 +526,22 @@ static void loadSceneNodes(tinygltf::Model& model, Scene* pScene)
 
     for (auto i : gltfScene.nodes)
     {
-        auto& srcNode = model.nodes[i];
+        auto& srcNode = src.nodes[i];
 
-        if (srcNode.mesh == -1)
+        if (srcNode.meshID == -1)
         {
             // might be a light or camera.
 
             if (srcNode.children.size())
             {
-                auto& childNode = model.nodes[srcNode.children[0]];
-                if (childNode.camera >= 0)
-                {
-                    readVec3(srcNode.translation, &pScene->camera.position, glm::vec3(0.f));
+                int childID = srcNode.children[0];
+                auto& childNode = src.nodes[childID];
 
-                    glm::quat rot1, rot2;
-                    if (readQuat(srcNode.rotation, &rot1))
-                    {
-                        if (readQuat(childNode.rotation, &rot2))
-                        {
-                            cameraRotate(pScene->camera, rot1 * rot2);
-                        }
-                    }
+                if (src.nodeCameras[childID] >= 0)
+                {
+                    pScene->camera.position = srcNode.translation;
 
+                    cameraRotate(pScene->camera, srcNode.rotation * childNode.rotation);
                     cameraUpdateView(pScene->camera);
                 }
             }
@@ -203,28 +549,7 @@ static void loadSceneNodes(tinygltf::Model& model, Scene* pScene)
             continue;
         }
 
-        pScene->nodes.push_back({});
-        SceneNode& dstNode = pScene->nodes.back();
-
-        dstNode.name = srcNode.name;
-        dstNode.meshID = srcNode.mesh;
-        dstNode.children = srcNode.children;
-
-        readVec3(srcNode.translation, &dstNode.translation, glm::vec3(0.f));
-        readVec3(srcNode.scale, &dstNode.scale, glm::vec3(1.f));
-        readQuat(srcNode.rotation, &dstNode.rotation);
-
-        if (srcNode.matrix.size() > 0)
-        {
-            dstNode.matrixValid = true;
-            memcpy(glm::value_ptr(dstNode.matrix), srcNode.matrix.data(),
-                sizeof(float) * 16);
-        }
-        else
-        {
-            dstNode.matrixValid = false;
-            dstNode.matrix = glm::mat4(1.f);
-        }
+        pScene->nodes.push_back(std::move(srcNode));
     }
 }
 
@@ -235,41 +560,43 @@ static void loadMeshInstanceData(DeviceVulkan& vk, Scene* pScene)
 
     for (auto& node : pScene->nodes)
     {
+        const Mesh& mesh = pScene->meshes[node.meshID];
+
         MeshInstanceData mid = {};
-        mid.materialID = pScene->meshes[node.meshID].materialID;
+        mid.materialID = mesh.materialID;
+        mid.meshFormat = mesh.format;
+        mid.vertexOffset = mesh.vertexOffset / sizeof(uint32_t);
+        mid.vertexStride = (uint32_t)(getVertexStride(mesh.format) / sizeof(uint32_t));
+        mid.indexOffset = mesh.indexOffset / sizeof(uint32_t);
 
         meshInstanceData.push_back(mid);
     }
 
+    if (!hasDevice(vk))
+        return;
+
     createBufferVulkan(vk, { sizeof(MeshInstanceData) * meshInstanceData.size(),
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
         meshInstanceData.data() }, &pScene->meshInstanceDataBuffer);
 }
 
-static void loadMaterials(DeviceVulkan& vk, tinygltf::Model& model, Scene* pScene)
+// Texture infos and the materials buffer for pScene->materials
+static void createMaterialBuffers(DeviceVulkan& vk, Scene* pScene)
 {
-    // Note: Only loading PBR Metal/Roughness properties (not specular extension)
-    std::vector<Material> materials(model.materials.size());
-    pScene->baseColorTextureInfos.resize(model.materials.size());
+    size_t materialCount = pScene->materials.size();
+    pScene->baseColorTextureInfos.resize(materialCount);
 
     auto& textures = pScene->textures;
     VkImageView fallbackBlackView = pScene->fallbackTextureBlack.view;
     VkImageView fallbackWhiteView = pScene->fallbackTextureWhite.view;
 
-    for (size_t i = 0; i < model.materials.size(); i++)
-    {
-        auto& gltfMat = model.materials[i];
-        Material& mat = materials[i];
-
-        auto& pbr = gltfMat.pbrMetallicRoughness;
-
-        readVec4(pbr.baseColorFactor, &mat.baseColorFactor, glm::vec4(1.f));
-
-        mat.metalness = (float)pbr.metallicFactor;
-        mat.roughness = (float)pbr.roughnessFactor;
+    if (!hasDevice(vk))
+        return;
 
-        int baseColorID = pbr.baseColorTexture.index;
+    for (size_t i = 0; i < materialCount; i++)
+    {
+        int baseColorID = pScene->baseColorTextureIDs[i];
 
         VkImageView baseColorView = baseColorID >= 0 ?
             textures[baseColorID].view : fallbackWhiteView;
@@ -280,78 +607,733 @@ static void loadMaterials(DeviceVulkan& vk, tinygltf::Model& model, Scene* pScen
         baseColorInfos.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     }
 
-    createBufferVulkan(vk, { sizeof(Material) * materials.size(),
+    createBufferVulkan(vk, { sizeof(Material) * materialCount,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        materials.data() }, &pScene->materialsBuffer);
+        pScene->materials.data() }, &pScene->materialsBuffer);
 }
 
-static void loadImages(DeviceVulkan& vk, tinygltf::Model& model, Scene* pScene)
+static void loadMaterials(DeviceVulkan& vk, GltfSource& src, Scene* pScene)
 {
-    if (model.images.size() == 0)
-        return;
+    // Note: Only loading PBR Metal/Roughness properties (not specular extension)
+    pScene->materials = std::move(src.materials);
+    pScene->baseColorTextureIDs = std::move(src.baseColorTextureIDs);
+
+    createMaterialBuffers(vk, pScene);
+}
+
+// Node and material tables from the tinygltf model, the streaming parser
+// fills them directly
+static void readNodesAndMaterials(const tinygltf::Model& model, GltfSource* pSrc)
+{
+    pSrc->nodes.resize(model.nodes.size());
+    pSrc->nodeCameras.resize(model.nodes.size());
+
+    for (size_t i = 0; i < model.nodes.size(); i++)
+    {
+        auto& srcNode = model.nodes[i];
+        SceneNode& dstNode = pSrc->nodes[i];
+
+        dstNode.name = srcNode.name;
+        dstNode.meshID = srcNode.mesh;
+        dstNode.children = srcNode.children;
+
+        readVec3(srcNode.translation, &dstNode.translation, glm::vec3(0.f));
+        readVec3(srcNode.scale, &dstNode.scale, glm::vec3(1.f));
+        readQuat(srcNode.rotation, &dstNode.rotation);
+
+        dstNode.matrixValid = srcNode.matrix.size() == 16;
+        dstNode.matrix = glm::mat4(1.f);
+
+        // The matrix is stored as doubles
+        for (size_t j = 0; dstNode.matrixValid && j < 16; j++)
+            glm::value_ptr(dstNode.matrix)[j] = (float)srcNode.matrix[j];
+
+        pSrc->nodeCameras[i] = srcNode.camera;
+    }
+
+    pSrc->materials.resize(model.materials.size());
+    pSrc->baseColorTextureIDs.resize(model.materials.size());
+
+    for (size_t i = 0; i < model.materials.size(); i++)
+    {
+        auto& pbr = model.materials[i].pbrMetallicRoughness;
+        Material& mat = pSrc->materials[i];
+
+        readVec4(pbr.baseColorFactor, &mat.baseColorFactor, glm::vec4(1.f));
+
+        mat.metalness = (float)pbr.metallicFactor;
+        mat.roughness = (float)pbr.roughnessFactor;
+
+        pSrc->baseColorTextureIDs[i] = pbr.baseColorTexture.index;
+    }
+}
+
+static void uploadTexture(DeviceVulkan& vk, VkCommandBuffer cmdBuffer, const TextureData& data,
+    ImageVulkan* pImage, std::vector<BufferVulkan>* pStagingBuffers)
+{
+    createImageVulkanLocal(vk, { VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM,
+        { data.width, data.height, 1},
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT },
+        cmdBuffer, (size_t)data.width * data.height * 4, data.pixels,
+        pImage, pStagingBuffers);
+
+    // BONI TODO: generate mips
+}
+
+// RGBA8 pixels of image i from a buffer view, a data URI or a file
+static bool decodeImage(const GltfSource& src, size_t i, TextureData* pData)
+{
+    const nlohmann::json& image = src.images[i];
+    int bufferViewID = image.value("bufferView", -1);
+    std::string uri = image.value("uri", std::string());
+
+    int width, height, components;
+    stbi_uc* pPixels = nullptr;
+
+    if (bufferViewID >= 0 && bufferViewID < (int)src.model.bufferViews.size())
+    {
+        auto& bv = src.model.bufferViews[bufferViewID];
+
+        pPixels = stbi_load_from_memory(getBufferViewData(src, bufferViewID), (int)bv.byteLength,
+            &width, &height, &components, 4);
+    }
+    else if (uri.compare(0, 5, "data:") == 0)
+    {
+        size_t comma = uri.find(',');
+        std::vector<uint8_t> bytes;
+
+        if (comma != std::string::npos && decodeBase64(uri.data() + comma + 1, uri.size() - comma - 1, bytes))
+            pPixels = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &components, 4);
+    }
+    else if (!uri.empty())
+    {
+        pPixels = stbi_load((src.baseDirectory + uri).c_str(), &width, &height, &components, 4);
+    }
+
+    if (!pPixels)
+        return false;
+
+    pData->width = (uint32_t)width;
+    pData->height = (uint32_t)height;
+    pData->pixelStorage.assign(pPixels, pPixels + (size_t)width * height * 4);
+    pData->pixels = pData->pixelStorage.data();
+
+    stbi_image_free(pPixels);
+
+    return true;
+}
+
+// Images are decoded as jobs.  With a device, the jobs run from a helper
+// thread while this one uploads each image as soon as it is decoded, so
+// decoding overlaps the staging copies.
+static bool loadImages(DeviceVulkan& vk, const char* fn, const GltfSource& src, Scene* pScene,
+    JobSystem* pJobSystem)
+{
+    uint32_t imageCount = (uint32_t)src.images.size();
+
+    if (imageCount == 0)
+        return true;
+
+    pScene->textureData.resize(imageCount);
+
+    std::vector<uint8_t> decodedOk(imageCount, 0);
+    std::vector<uint32_t> decoded; // in the order they finished
+
+    std::mutex mutex;
+    std::condition_variable decodedCondition;
+
+    auto decodeJob = [&](uint32_t i) {
+        bool ok = decodeImage(src, i, &pScene->textureData[i]);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        decodedOk[i] = ok;
+        decoded.push_back(i);
+        decodedCondition.notify_one();
+    };
+
+    std::thread decoder;
+
+    if (hasDevice(vk) && pJobSystem)
+        decoder = std::thread([&]() { forEachIndex(pJobSystem, imageCount, decodeJob); });
+    else
+        forEachIndex(pJobSystem, imageCount, decodeJob);
+
+    if (hasDevice(vk))
+    {
+        VkCommandBuffer cmdBuffer = createOneTimeCommandBuffer(vk);
+
+        pScene->textures.resize(imageCount);
+
+        std::vector<BufferVulkan> stagingBuffers;
+
+        for (uint32_t uploadCount = 0; uploadCount < imageCount; uploadCount++)
+        {
+            uint32_t i;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                decodedCondition.wait(lock, [&]() { return decoded.size() > uploadCount; });
+                i = decoded[uploadCount];
+            }
+
+            if (!decodedOk[i])
+                continue;
+
+            uploadTexture(vk, cmdBuffer, pScene->textureData[i], &pScene->textures[i], &stagingBuffers);
+        }
 
-    VkCommandBuffer cmdBuffer = createOneTimeCommandBuffer(vk);
+        if (decoder.joinable())
+            decoder.join();
 
-    pScene->textures.resize(model.images.size());
+        submitOneTimeCommandBuffer(vk, cmdBuffer);
 
-    std::vector<BufferVulkan> stagingBuffers;
+        for (auto& b : stagingBuffers)
+            destroyBufferVulkan(vk, b);
+    }
+
+    bool ok = true;
 
-    for (size_t i = 0; i < model.images.size(); i++)
+    for (uint32_t i = 0; i < imageCount; i++)
     {
-        auto& gltfImage = model.images[i];
-        auto& texture = pScene->textures[i];
+        if (!decodedOk[i])
+        {
+            DebugPrint("Error: %s: could not decode image %u\n", fn, i);
+            ok = false;
+        }
+    }
 
-        createImageVulkanLocal(vk, { VK_IMAGE_TYPE_2D, VK_FORMAT_R8G8B8A8_UNORM,
-            { (uint32_t)gltfImage.width, (uint32_t)gltfImage.height, 1},
-            VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT },
-            cmdBuffer, gltfImage.image.size(), gltfImage.image.data(),
-            &texture, &stagingBuffers);
+    if (!ok)
+    {
+        for (auto& texture : pScene->textures)
+            destroyImageVulkan(vk, texture);
 
-        // BONI TODO: generate mips
+        pScene->textures.clear();
     }
 
-    submitOneTimeCommandBuffer(vk, cmdBuffer);
+    return ok;
+}
+
+glm::mat4 getNodeMatrix(const SceneNode& node)
+{
+    if (node.matrixValid)
+        return node.matrix;
+
+    glm::mat4 T = glm::translate(glm::mat4(1.f), node.translation);
+    glm::mat4 R = glm::toMat4(node.rotation);
+    glm::mat4 S = glm::scale(glm::mat4(1.f), node.scale);
+
+    return T * R * S;
+}
+
+// ext in lower case, with the dot
+static bool hasExtension(const char* fn, const char* ext)
+{
+    size_t length = strlen(fn);
+    size_t extLength = strlen(ext);
+
+    if (length < extLength)
+        return false;
+
+    for (size_t i = 0; i < extLength; i++)
+    {
+        if (tolower(fn[length - extLength + i]) != ext[i])
+            return false;
+    }
 
-    for (auto& b : stagingBuffers)
-        destroyBufferVulkan(vk, b);
+    return true;
 }
 
+static std::string getBaseDirectory(const char* fn)
+{
+    std::string path = fn;
+    size_t slash = path.find_last_of("/\\");
+
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
 
-bool loadGltfFile(DeviceVulkan& vk, const char* fn, Scene* pScene)
+// Decodes the buffers stored as base64 data URIs with the SIMD decoder and
+// replaces their uri with the placeholder.  pDecoded gets one entry per
+// buffer, empty for the ones left to tinygltf.
+static bool decodeDataUriBuffers(const char* fn, nlohmann::json& json,
+    std::vector<std::vector<uint8_t>>* pDecoded)
 {
-    tinygltf::Model model;
-    tinygltf::TinyGLTF loader;
+    auto it = json.find("buffers");
+
+    if (it == json.end() || !it->is_array())
+        return true;
+
+    auto& buffers = *it;
+    pDecoded->resize(buffers.size());
+
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        auto& buffer = buffers[i];
+
+        if (!buffer.contains("uri") || !buffer["uri"].is_string())
+            continue;
 
+        const std::string& uri = buffer["uri"].get_ref<const std::string&>();
+
+        if (uri.compare(0, 5, "data:") != 0)
+            continue;
+
+        size_t comma = uri.find(',');
+
+        if (comma == std::string::npos || comma < 7 || uri.compare(comma - 7, 7, ";base64") != 0)
+            continue;
+
+        std::vector<uint8_t>& data = (*pDecoded)[i];
+
+        // tinygltf also rejects a data URI whose size isn't byteLength
+        if (!decodeBase64(uri.data() + comma + 1, uri.size() - comma - 1, data) ||
+            data.size() != buffer.value("byteLength", (size_t)0))
+        {
+            DebugPrint("Error: %s: invalid base64 data in buffer %zu\n", fn, i);
+            return false;
+        }
+
+        buffer["uri"] = kPlaceholderBufferUri;
+        buffer["byteLength"] = 1;
+    }
+
+    return true;
+}
+
+// tinygltf on the JSON, with the data URI buffers decoded beforehand and
+// the images left to loadImages
+static bool loadGltfJson(const char* fn, nlohmann::json& json, GltfSource* pSrc)
+{
+    std::vector<std::vector<uint8_t>> decoded;
+
+    if (!decodeDataUriBuffers(fn, json, &decoded))
+        return false;
+
+    pSrc->images = json.value("images", nlohmann::json::array());
+    pSrc->baseDirectory = getBaseDirectory(fn);
+    json.erase("images");
+
+    std::string text = json.dump();
+
+    tinygltf::TinyGLTF loader;
     std::string err;
     std::string warn;
-    bool ret = loader.LoadASCIIFromFile(&model, &err, &warn, fn);
+
+    if (!loader.LoadASCIIFromString(&pSrc->model, &err, &warn, text.c_str(), (unsigned int)text.size(),
+        pSrc->baseDirectory))
+    {
+        DebugPrint("Error: could not load %s: %s\n", fn, err.c_str());
+        return false;
+    }
+
+    for (size_t i = 0; i < decoded.size(); i++)
+    {
+        if (decoded[i].size() > 0)
+            pSrc->model.buffers[i].data = std::move(decoded[i]);
+    }
+
+    readNodesAndMaterials(pSrc->model, pSrc);
+
+    return true;
+}
+
+static bool loadGltfTextFile(const char* fn, bool streaming, GltfSource* pSrc)
+{
+    if (streaming)
+    {
+        // Parsed from the mapping, the strings are copied out
+        MappedFile file;
+
+        if (!mapFile(fn, &file))
+        {
+            DebugPrint("Error: could not map %s\n", fn);
+            return false;
+        }
+
+        pSrc->baseDirectory = getBaseDirectory(fn);
+
+        bool ret = parseGltfStream(fn, (const char*)file.pData, file.size, pSrc);
+        unmapFile(file);
+
+        return ret;
+    }
+
+    std::ifstream in(fn, std::ios::binary);
+
+    if (!in)
+    {
+        DebugPrint("Error: could not open %s\n", fn);
+        return false;
+    }
+
+    nlohmann::json json = nlohmann::json::parse(in, nullptr, false);
+
+    if (json.is_discarded())
+    {
+        DebugPrint("Error: %s: invalid JSON\n", fn);
+        return false;
+    }
+
+    return loadGltfJson(fn, json, pSrc);
+}
+
+// Points buffer 0 at the BIN chunk that follows the JSON chunk
+static bool setGlbBinChunk(const char* fn, const uint8_t* pData, size_t glbLength, size_t binChunkOffset,
+    const uint32_t binChunk[2], GltfSource* pSrc)
+{
+    if (binChunk[1] != kGlbChunkBin || binChunkOffset + 2 * sizeof(uint32_t) + binChunk[0] > glbLength)
+    {
+        DebugPrint("Error: %s: BIN chunk missing or truncated\n", fn);
+        return false;
+    }
+
+    pSrc->pBin = pData + binChunkOffset + 2 * sizeof(uint32_t);
+    pSrc->binSize = binChunk[0];
+
+    return true;
+}
+
+static bool loadGlbFile(const char* fn, bool streaming, GltfSource* pSrc)
+{
+    if (!mapFile(fn, &pSrc->glbFile))
+    {
+        DebugPrint("Error: could not map %s\n", fn);
+        return false;
+    }
+
+    const uint8_t* pData = pSrc->glbFile.pData;
+    size_t size = pSrc->glbFile.size;
+
+    // magic, version, length, then the JSON chunk's length and type
+    uint32_t header[5] = {};
+
+    if (size >= sizeof(header))
+        memcpy(header, pData, sizeof(header));
+
+    if (header[0] != kGlbMagic || header[1] != kGlbVersion || header[2] > size ||
+        header[4] != kGlbChunkJson || sizeof(header) + header[3] > header[2])
+    {
+        DebugPrint("Error: %s is not a glTF 2.0 binary file\n", fn);
+        return false;
+    }
+
+    const char* pJson = (const char*)pData + sizeof(header);
+    size_t binChunkOffset = sizeof(header) + header[3];
+
+    uint32_t binChunk[2] = {}; // length, type
+
+    if (binChunkOffset + sizeof(binChunk) <= header[2])
+        memcpy(binChunk, pData + binChunkOffset, sizeof(binChunk));
+
+    pSrc->pBin = nullptr;
+    pSrc->binSize = 0;
+
+    if (streaming)
+    {
+        pSrc->baseDirectory = getBaseDirectory(fn);
+
+        if (!parseGltfStream(fn, pJson, header[3], pSrc))
+            return false;
+
+        // A buffer 0 without uri is the BIN chunk
+        auto& buffers = pSrc->model.buffers;
+
+        if (buffers.size() > 0 && buffers[0].uri.empty())
+        {
+            if (!setGlbBinChunk(fn, pData, header[2], binChunkOffset, binChunk, pSrc))
+                return false;
+        }
+    }
+    else
+    {
+        nlohmann::json json = nlohmann::json::parse(pJson, pJson + header[3], nullptr, false);
+
+        if (json.is_discarded())
+        {
+            DebugPrint("Error: %s: invalid JSON chunk\n", fn);
+            return false;
+        }
+
+        // A buffer 0 without uri is the BIN chunk
+        auto& buffers = json["buffers"];
+
+        if (buffers.is_array() && buffers.size() > 0 && !buffers[0].contains("uri"))
+        {
+            if (!setGlbBinChunk(fn, pData, header[2], binChunkOffset, binChunk, pSrc))
+                return false;
+
+            buffers[0] = { { "byteLength", 1 }, { "uri", kPlaceholderBufferUri } };
+        }
+
+        if (!loadGltfJson(fn, json, pSrc))
+            return false;
+    }
+
+    return true;
+}
+
+// What getBufferViewData() relies on, for every way of loading the model
+static bool checkBufferViews(const char* fn, const GltfSource& src)
+{
+    const tinygltf::Model& model = src.model;
+
+    for (size_t i = 0; i < model.bufferViews.size(); i++)
+    {
+        const tinygltf::BufferView& bv = model.bufferViews[i];
+
+        if (bv.buffer < 0 || bv.buffer >= (int)model.buffers.size())
+        {
+            DebugPrint("Error: %s: buffer view %zu refers to a missing buffer\n", fn, i);
+            return false;
+        }
+
+        size_t size = src.pBin && bv.buffer == 0 ? src.binSize : model.buffers[bv.buffer].data.size();
+
+        if (bv.byteOffset > size || bv.byteLength > size - bv.byteOffset)
+        {
+            DebugPrint("Error: %s: buffer view %zu outside of buffer %d\n", fn, i, bv.buffer);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The CPU side is mapped (see CookedScene.h), only the GPU resources are
+// created here
+static bool loadCookedScene(DeviceVulkan& vk, const char* fn, const GltfLoadInfo& info, Scene* pScene)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    if (!mapCookedScene(fn, pScene))
+        return false;
+
+    double mapTimeMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - startTime).count();
+
+    if (hasDevice(vk) && !pScene->textureData.empty())
+    {
+        VkCommandBuffer cmdBuffer = createOneTimeCommandBuffer(vk);
+
+        pScene->textures.resize(pScene->textureData.size());
+
+        std::vector<BufferVulkan> stagingBuffers;
+
+        for (size_t i = 0; i < pScene->textureData.size(); i++)
+            uploadTexture(vk, cmdBuffer, pScene->textureData[i], &pScene->textures[i], &stagingBuffers);
+
+        submitOneTimeCommandBuffer(vk, cmdBuffer);
+
+        for (auto& b : stagingBuffers)
+            destroyBufferVulkan(vk, b);
+    }
+
+    std::vector<MeshSource> sources(pScene->meshes.size());
+
+    for (size_t i = 0; i < pScene->meshes.size(); i++)
+    {
+        const Mesh& mesh = pScene->meshes[i];
+        MeshSource& source = sources[i];
+
+        source.pPositions = (const uint8_t*)mesh.positionData;
+        source.pNormals = mesh.format & MESH_FORMAT_OCT_NORMALS ?
+            (const uint8_t*)mesh.octNormalData : (const uint8_t*)mesh.normalData;
+        source.pUvs = mesh.format & MESH_FORMAT_HALF_UVS ?
+            (const uint8_t*)mesh.halfUvData : (const uint8_t*)mesh.uvData;
+        source.pIndices = (const uint8_t*)mesh.indexData;
+    }
+
+    if (!uploadMeshes(vk, sources, pScene, info.pJobSystem))
+    {
+        unmapFile(pScene->cookedFile);
+        return false;
+    }
+
+    printGeometryMemory(*pScene);
+
+    loadMeshInstanceData(vk, pScene);
+
+    createMaterialBuffers(vk, pScene);
+
+    double loadTimeMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - startTime).count();
+
+    DebugPrint("Loaded %s in %.2f ms (%.2f ms mapping)\n", fn, loadTimeMs, mapTimeMs);
+
+    return true;
+}
+
+bool loadGltfFile(DeviceVulkan& vk, const char* fn, const GltfLoadInfo& info, Scene* pScene)
+{
+    if (hasExtension(fn, kCookedSceneExtension))
+        return loadCookedScene(vk, fn, info, pScene);
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    GltfSource src = {};
+    tinygltf::Model& model = src.model;
+
+    bool ret;
+
+    if (hasExtension(fn, ".glb"))
+    {
+        ret = loadGlbFile(fn, info.streaming, &src);
+    }
+    else
+    {
+        ret = loadGltfTextFile(fn, info.streaming, &src);
+    }
+
     BASSERT(ret);
 
+    ret = ret && checkBufferViews(fn, src);
+
     if (ret == false)
     {
         DebugPrint("Error: could not load %s\n", fn);
+        unmapFile(src.glbFile);
         return false;
     }
 
     if (model.scenes.size() == 0)
     {
         DebugPrint("Error: no scene found in %s\n", fn);
+        unmapFile(src.glbFile);
+        return false;
+    }
+
+    double parseTimeMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - startTime).count();
+
+    if (!loadImages(vk, fn, src, pScene, info.pJobSystem))
+    {
+        unmapFile(src.glbFile);
         return false;
     }
 
-    loadMeshes(vk, model, pScene);
+    if (!loadMeshes(vk, src, info.compactVertices, pScene, info.pJobSystem))
+    {
+        unmapFile(src.glbFile);
+        return false;
+    }
 
-    loadSceneNodes(model, pScene);
+    loadSceneNodes(src, pScene);
 
     loadMeshInstanceData(vk, pScene);
 
-    loadImages(vk, model, pScene);
+    loadMaterials(vk, src, pScene);
+
+    // The CPU copies of the meshes read from the BIN chunk point into it
+    pScene->glbFile = src.glbFile;
 
-    loadMaterials(vk, model, pScene);
+    double loadTimeMs = std::chrono::duration<double, std::milli>(
+        std::chrono::high_resolution_clock::now() - startTime).count();
+
+    DebugPrint("Loaded %s in %.2f ms (%.2f ms parsing)\n", fn, loadTimeMs, parseTimeMs);
 
     return true;
 }
 
+bool writeGlbFile(const char* gltfFilename, const char* glbFilename)
+{
+    // tinygltf for the decoded buffers, the JSON is rewritten as is
+    tinygltf::Model model;
+    tinygltf::TinyGLTF loader;
+
+    std::string err;
+    std::string warn;
+
+    if (!loader.LoadASCIIFromFile(&model, &err, &warn, gltfFilename))
+    {
+        DebugPrint("Error: could not load %s: %s\n", gltfFilename, err.c_str());
+        return false;
+    }
+
+    std::ifstream in(gltfFilename, std::ios::binary);
+    nlohmann::json json = nlohmann::json::parse(in, nullptr, false);
+
+    if (json.is_discarded())
+    {
+        DebugPrint("Error: %s: invalid JSON\n", gltfFilename);
+        return false;
+    }
+
+    // All buffers back to back in the BIN chunk, 4 byte aligned
+    std::vector<uint8_t> bin;
+    std::vector<size_t> bufferOffsets;
 
+    auto appendToBin = [&bin](const void* pData, size_t size) {
+        size_t offset = bin.size();
+        bin.insert(bin.end(), (const uint8_t*)pData, (const uint8_t*)pData + size);
+        bin.resize((bin.size() + 3) & ~(size_t)3, 0);
+        return offset;
+    };
+
+    for (auto& buffer : model.buffers)
+        bufferOffsets.push_back(appendToBin(buffer.data.data(), buffer.data.size()));
+
+    for (auto& bv : json["bufferViews"])
+    {
+        bv["byteOffset"] = bufferOffsets[bv["buffer"].get<int>()] + bv.value("byteOffset", (size_t)0);
+        bv["buffer"] = 0;
+    }
+
+    // External images move into the BIN chunk as well
+    if (json.contains("images"))
+    {
+        for (auto& image : json["images"])
+        {
+            if (!image.contains("uri"))
+                continue;
+
+            std::string uri = image["uri"].get<std::string>();
+
+            if (uri.compare(0, 5, "data:") == 0)
+            {
+                DebugPrint("Error: %s: data URI images are not supported\n", gltfFilename);
+                return false;
+            }
+
+            std::ifstream imageFile(getBaseDirectory(gltfFilename) + uri, std::ios::binary);
+            std::vector<char> bytes((std::istreambuf_iterator<char>(imageFile)), std::istreambuf_iterator<char>());
+
+            if (bytes.empty())
+            {
+                DebugPrint("Error: could not read %s\n", uri.c_str());
+                return false;
+            }
+
+            size_t offset = appendToBin(bytes.data(), bytes.size());
+
+            image["bufferView"] = json["bufferViews"].size();
+            image["mimeType"] = uri.find(".png") != std::string::npos ? "image/png" : "image/jpeg";
+            image.erase("uri");
+
+            json["bufferViews"].push_back({ { "buffer", 0 }, { "byteOffset", offset }, { "byteLength", bytes.size() } });
+        }
+    }
+
+    json["buffers"] = nlohmann::json::array({ { { "byteLength", bin.size() } } });
+
+    std::string text = json.dump();
+    text.resize((text.size() + 3) & ~(size_t)3, ' ');
+
+    uint32_t header[5] = { kGlbMagic, kGlbVersion,
+        (uint32_t)(sizeof(header) + text.size() + 8 + bin.size()), (uint32_t)text.size(), kGlbChunkJson };
+    uint32_t binChunk[2] = { (uint32_t)bin.size(), kGlbChunkBin };
+
+    std::ofstream out(glbFilename, std::ios::binary);
+    out.write((const char*)header, sizeof(header));
+    out.write(text.data(), text.size());
+    out.write((const char*)binChunk, sizeof(binChunk));
+    out.write((const char*)bin.data(), bin.size());
+
+    if (!out)
+    {
+        DebugPrint("Error: could not write %s\n", glbFilename);
+        return false;
+    }
+
+    return true;
+}
@@ -1,5 +1,21 @@
 #pragma once
 
+struct JobSystem;
 
-bool loadGltfFile(DeviceVulkan& vk, const char* fn, Scene* pScene);
+struct GltfLoadInfo
+{
+    JobSystem* pJobSystem; // meshes and images are decoded here, null for the calling thread
+    bool streaming;        // one pass SAX parse, no JSON DOM or full tinygltf model
+    bool compactVertices;  // octahedral normals, half UVs and 16 bit GPU indices, see VertexFormat.h
+};
 
+// .gltf, .glb whose BIN chunk is read from a file mapping, or a cooked
+// scene (see CookedScene.h), which only has its GPU resources created and
+// keeps the vertex formats it was cooked with
+bool loadGltfFile(DeviceVulkan& vk, const char* fn, const GltfLoadInfo& info, Scene* pScene);
+
+// Converts a .gltf to a .glb with all buffers and images in the BIN chunk
+bool writeGlbFile(const char* gltfFilename, const char* glbFilename);
+
+// Local to world (node.matrix, or T * R * S)
+glm::mat4 getNodeMatrix(const SceneNode& node);
@@ -2,6 +2,13 @@
 
 #include "logging.h"
 
+static bool s_debugPrintToStdout = false;
+
+void setDebugPrintToStdout(bool enable)
+{
+    s_debugPrintToStdout = enable;
+}
+
 void DebugPrint(const char* fmt, ...)
 {
     va_list args;
@@ -10,5 +17,9 @@ void DebugPrint(const char* fmt, ...)
     std::vector<char> buff(len);
     vsnprintf_s(buff.data(), len, _TRUNCATE, fmt, args);
     OutputDebugStringA(buff.data());
+
+    if (s_debugPrintToStdout)
+        fputs(buff.data(), stdout);
+
     va_end(args);
 }
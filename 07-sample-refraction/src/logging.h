@@ -2,6 +2,9 @@
 
 void DebugPrint(const char* fmt, ...);
 
+// Also write DebugPrint output to stdout, for the modes without a window
+void setDebugPrintToStdout(bool enable);
+
 #define BASSERT(expr) ((void)((!!(expr)) || \
         ((DebugPrint("Error: %s, %s:%d\n", #expr, __FILE__, __LINE__),1) \
          && (__debugbreak(),0)) ))
@@ -4,6 +4,11 @@
 #include "App.h"
 #include "logging.h"
 #include "gltfLoader.h"
+#include "JobSystem.h"
+#include "RaytracerCpu.h"
+#include "BenchmarkCpu.h"
+#include "CookedScene.h"
+#include "VertexFormat.h"
 
 const uint32_t kWindowWidth = 800;
 const uint32_t kWindowHeight = 600;
@@ -12,29 +17,74 @@ const float kCameraMoveSpeed = 2.f;
 
 const bool kVsync = true;
 
+const char* kDefaultSceneFilename = "../data/transmissive1.gltf";
+
+struct CommandLineOptions
+{
+    bool cpu; // headless CPU raytracer, no window or Vulkan device
+    uint32_t frames;
+    uint32_t threads; // 0 -> all cores
+    bool noPackets;   // trace primary rays one by one
+    bool threadStats; // print per-thread stats for every frame
+    TileOrder tileOrder;
+    bool wavefront;   // trace bounces as queue stages
+    bool sortRays;    // bin secondary rays before tracing them, implies wavefront
+    uint32_t bvhWidth; // children per BLAS node: 2, 4 or 8
+    bool quantizeBvh;  // 8 bit child bounds, wide BVHs only
+    BvhBuildMode bvhBuildMode;
+    float sbvhSplitBudget;  // extra references per triangle
+    uint32_t sbvhMemoryMB;  // cap per BLAS, 0 for none
+    bool animate;           // move the nodes between frames, refitting the TLAS
+    const char* bvhCacheDirectory; // map BLASes from / save them to this directory
+    bool triangleRecords;   // precomputed triangles in the BVH leaves
+    const char* sceneFilename;
+    const char* outputFilename;
+    const char* benchmark; // run a CPU microbenchmark on the scene and exit
+    const char* exportGlbFilename; // convert the scene to .glb and exit
+    bool streamGltf; // SAX parse the scene file instead of loading it through tinygltf
+    const char* cookFilename; // write the loaded scene as a cooked scene and exit
+    bool compactVertices; // octahedral normals, half UVs and 16 bit GPU indices
+};
+
 static DeviceVulkan vk;
 static App app;
 
 
+// Cleans up after itself when it fails
 bool initApp()
 {
     if (!glfwInit())
         return false;
 
     if (!glfwVulkanSupported())
+    {
+        glfwTerminate();
         return false;
+    }
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
     app.window = glfwCreateWindow(kWindowWidth, kWindowHeight, "Test Vulkan App", nullptr, nullptr);
 
     if (!app.window)
+    {
+        glfwTerminate();
         return false;
+    }
 
     HWND hwnd = glfwGetWin32Window(app.window);
 
     if (!createDeviceVulkan({hwnd, kWindowWidth, kWindowHeight, kVsync}, &vk))
+    {
+        // Whatever was created before the failure, this also nulls vk.device
+        // for the headless fallback
+        destroyDeviceVulkan(vk);
+
+        glfwDestroyWindow(app.window);
+        app.window = nullptr;
+        glfwTerminate();
         return false;
+    }
 
     createImageVulkan(vk, { VK_IMAGE_TYPE_2D, vk.surfaceFormat.format,
         {kWindowWidth, kWindowHeight, 1},
@@ -53,15 +103,19 @@ void shutdownApp()
     destroyBufferVulkan(vk, app.scene.meshInstanceDataBuffer);
 
     {
-        for (auto& mesh : app.scene.meshes)
+        for (size_t i = 0; i < app.scene.meshes.size(); i++)
         {
-            destroyBufferVulkan(vk, mesh.positions);
-            destroyBufferVulkan(vk, mesh.normals);
-            destroyBufferVulkan(vk, mesh.uvs);
-            destroyBufferVulkan(vk, mesh.indices);
+            Mesh& mesh = app.scene.meshes[i];
+
+            // Shared geometry is destroyed with its owner
+            if (mesh.geometryID != (int)i)
+                continue;
 
             destroyAccelerationStructure(vk, mesh.blas);
         }
+
+        destroyBufferVulkan(vk, app.scene.vertexBuffer);
+        destroyBufferVulkan(vk, app.scene.indexBuffer);
     }
 
     vkDestroySampler(vk.device, app.scene.linearSampler, nullptr);
@@ -95,6 +149,9 @@ void shutdownApp()
 
     destroyDeviceVulkan(vk);
 
+    unmapFile(app.scene.cookedFile);
+    unmapFile(app.scene.glbFile);
+
     glfwDestroyWindow(app.window);
     glfwTerminate();
 }
@@ -127,13 +184,20 @@ void createFallbackTextures()
         destroyBufferVulkan(vk, b);
 }
 
-void createScene()
+void createScene(const CommandLineOptions& options)
 {
-    //bool res = loadGltfFile(vk, "../data/reflection-test1.gltf", &app.scene);
-    //bool res = loadGltfFile(vk, "../data/backface2.gltf", &app.scene);
-    bool res = loadGltfFile(vk, "../data/transmissive1.gltf", &app.scene);
+    // Only needed while loading
+    JobSystem jobSystem;
+    createJobSystem({ options.threads }, &jobSystem);
+
+    //bool res = loadGltfFile(vk, "../data/reflection-test1.gltf", { &jobSystem }, &app.scene);
+    //bool res = loadGltfFile(vk, "../data/backface2.gltf", { &jobSystem }, &app.scene);
+    bool res = loadGltfFile(vk, options.sceneFilename,
+        { &jobSystem, options.streamGltf, options.compactVertices }, &app.scene);
     BASSERT(res);
 
+    destroyJobSystem(jobSystem);
+
     // BONI TODO: this doesn't handle child nodes
     size_t meshCount = app.scene.meshes.size();
     size_t nodesCount = app.scene.nodes.size();
@@ -141,28 +205,29 @@ void createScene()
     std::vector<VkGeometryNV> geometries(meshCount); // needs to exist when blas is built
     std::vector<VkGeometryInstance> instances(meshCount);
 
-    app.scene.positionsBufferInfos.resize(meshCount);
-    app.scene.normalsBufferInfos.resize(meshCount);
-    app.scene.uvsBufferInfos.resize(meshCount);
-    app.scene.indicesBufferInfos.resize(nodesCount);
-
     for (size_t i = 0; i < meshCount; i++)
     {
         Mesh& mesh = app.scene.meshes[i];
         VkGeometryNV& geometry = geometries[i];
 
+        // One BLAS per unique geometry, see Mesh::geometryID
+        if (mesh.geometryID != (int)i)
+            continue;
+
         geometry = { VK_STRUCTURE_TYPE_GEOMETRY_NV };
         geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_NV;
         geometry.geometry.triangles = { VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV };
-        geometry.geometry.triangles.vertexData = mesh.positions.buffer;
-        geometry.geometry.triangles.vertexOffset = 0;
+        // The position leads each interleaved vertex record
+        geometry.geometry.triangles.vertexData = app.scene.vertexBuffer.buffer;
+        geometry.geometry.triangles.vertexOffset = mesh.vertexOffset;
         geometry.geometry.triangles.vertexCount = mesh.vertexCount;
-        geometry.geometry.triangles.vertexStride = sizeof(float) * 3;
+        geometry.geometry.triangles.vertexStride = getVertexStride(mesh.format);
         geometry.geometry.triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
-        geometry.geometry.triangles.indexData = mesh.indices.buffer;
-        geometry.geometry.triangles.indexOffset = 0;
+        geometry.geometry.triangles.indexData = app.scene.indexBuffer.buffer;
+        geometry.geometry.triangles.indexOffset = mesh.indexOffset;
         geometry.geometry.triangles.indexCount = mesh.indexCount;
-        geometry.geometry.triangles.indexType = VK_INDEX_TYPE_UINT32; // BONI TODO: switch to uint16
+        geometry.geometry.triangles.indexType = mesh.format & MESH_FORMAT_INDEX16 ?
+            VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
         geometry.geometry.triangles.transformData = VK_NULL_HANDLE;
         geometry.geometry.triangles.transformOffset = 0;
         geometry.geometry.aabbs = { VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV };
@@ -180,23 +245,9 @@ void createScene()
         // BONI TODO: handle child nodes
         BASSERT(node.children.size() == 0);
 
-        Mesh& mesh = app.scene.meshes[node.meshID];
-
-        glm::mat4 TRS;
-
-        if (node.matrixValid)
-        {
-            TRS = node.matrix;
-        }
-        else
-        {
-            glm::mat4 T = glm::translate(glm::mat4(1.f), node.translation);
-            glm::mat4 R = glm::toMat4(node.rotation);
-            glm::mat4 S = glm::scale(glm::mat4(1.f), node.scale);
-            TRS = T * R * S;
-        }
+        Mesh& mesh = app.scene.meshes[app.scene.meshes[node.meshID].geometryID];
 
-        TRS = glm::transpose(TRS);
+        glm::mat4 TRS = glm::transpose(getNodeMatrix(node));
 
         float transform[12] = {};
         memcpy(transform, glm::value_ptr(TRS), sizeof(transform));
@@ -208,26 +259,6 @@ void createScene()
         instance.instanceOffset = 0;
         instance.flags = 0; // VK_GEOMETRY_INSTANCE_TRIANGLE_CULL_DISABLE_BIT_NV;
         instance.accelerationStructureHandle = mesh.blas.handle;
-
-        VkDescriptorBufferInfo& positionsBufferInfo = app.scene.positionsBufferInfos[i];
-        positionsBufferInfo.buffer = mesh.positions.buffer;
-        positionsBufferInfo.offset = 0;
-        positionsBufferInfo.range = mesh.positions.size;
-
-        VkDescriptorBufferInfo& normalsBufferInfo = app.scene.normalsBufferInfos[i];
-        normalsBufferInfo.buffer = mesh.normals.buffer;
-        normalsBufferInfo.offset = 0;
-        normalsBufferInfo.range = mesh.normals.size;
-
-        VkDescriptorBufferInfo& uvsBufferInfo = app.scene.uvsBufferInfos[i];
-        uvsBufferInfo.buffer = mesh.uvs.buffer;
-        uvsBufferInfo.offset = 0;
-        uvsBufferInfo.range = mesh.uvs.size;
-
-        VkDescriptorBufferInfo& indicesBufferInfo = app.scene.indicesBufferInfos[i];
-        indicesBufferInfo.buffer = mesh.indices.buffer;
-        indicesBufferInfo.offset = 0;
-        indicesBufferInfo.range = mesh.indices.size;
     }
 
     createBufferVulkan(vk, { instances.size() * sizeof(VkGeometryInstance),
@@ -245,8 +276,13 @@ void createScene()
 
     VkDeviceSize scratchBufferSize = 0;
 
-    for (auto& mesh : app.scene.meshes)
+    for (size_t i = 0; i < meshCount; i++)
     {
+        Mesh& mesh = app.scene.meshes[i];
+
+        if (mesh.geometryID != (int)i)
+            continue;
+
         memoryRequirementsInfo.accelerationStructure = mesh.blas.accelerationStructure;
 
         VkMemoryRequirements2 memReqBlas;
@@ -273,8 +309,13 @@ void createScene()
     memoryBarrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
     memoryBarrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
 
-    for (auto& mesh : app.scene.meshes)
+    for (size_t i = 0; i < meshCount; i++)
     {
+        Mesh& mesh = app.scene.meshes[i];
+
+        if (mesh.geometryID != (int)i)
+            continue;
+
         vkCmdBuildAccelerationStructureNV(cmdBuffer, &mesh.blas.accelerationStructureInfo,
             VK_NULL_HANDLE, 0, VK_FALSE, mesh.blas.accelerationStructure,
             VK_NULL_HANDLE, scratchBuffer.buffer, 0);
@@ -301,10 +342,13 @@ void createScene()
 
 void setupDefaultCamera()
 {
-    createBufferVulkan(vk, { sizeof(CameraUniformData),
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT },
-        &app.scene.cameraBuffer);
+    if (vk.device != VK_NULL_HANDLE)
+    {
+        createBufferVulkan(vk, { sizeof(CameraUniformData),
+            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT },
+            &app.scene.cameraBuffer);
+    }
 
     Camera& cam = app.scene.camera;
 
@@ -339,22 +383,15 @@ void createDescriptorSetLayouts()
     //   Binding 3 -> MeshInstanceData[] (per instance)
     //   Binding 4 -> Material[] (material count)
 
-    // Set 1: float[3] positionsArrays[] (per instance)
-    //   Binding 0-N, where N = mesh count
-
-    // Set 2: float[3] normalsArrays[] (per instance)
-    //   Binding 0-N, where N = mesh count
+    // Set 1: uint vertices[], interleaved records of every mesh
+    //   (MeshInstanceData::vertexOffset)
 
-    // Set 3: vec2 uvsArray[] (per instance)
-    //   Binding 0-N, where N = mesh count
+    // Set 2: uint indices[] of every mesh (MeshInstanceData::indexOffset)
 
-    // Set 4: uint indicesArrays[] (per instance)
-    //   Binding 0-N, where N = mesh count
-
-    // Set 5:
+    // Set 3:
     //   Binding 0: linear sampler
     //   Binding 1: texture2d baseColorTextures[] (material count)
-    const int numDescriptorSets = 6;
+    const int numDescriptorSets = 4;
 
     app.descriptorSetLayouts.resize(numDescriptorSets);
 
@@ -404,24 +441,16 @@ void createDescriptorSetLayouts()
     VK_CHECK(vkCreateDescriptorSetLayout(vk.device, &set0LayoutInfo, nullptr,
         &app.descriptorSetLayouts[0]));
 
-    // Set 1: vec4 positionsArrays[]
-    //   Binding 0-N, where N = mesh count
-
-    const VkDescriptorBindingFlagsEXT flags = VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
-
-    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlags = {};
-    bindingFlags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
-    bindingFlags.pBindingFlags = &flags;
-    bindingFlags.bindingCount = 1;
+    // Set 1: uint vertices[]
+    // Set 2: uint indices[]
 
     VkDescriptorSetLayoutBinding storageBufferBinding = {};
     storageBufferBinding.binding = 0;
     storageBufferBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    storageBufferBinding.descriptorCount = (uint32_t)app.scene.meshes.size();
+    storageBufferBinding.descriptorCount = 1;
     storageBufferBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
 
     VkDescriptorSetLayoutCreateInfo set1LayoutInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-    set1LayoutInfo.pNext = &bindingFlags;
     set1LayoutInfo.flags = 0;
     set1LayoutInfo.bindingCount = 1;
     set1LayoutInfo.pBindings = &storageBufferBinding;
@@ -429,26 +458,10 @@ void createDescriptorSetLayouts()
     VK_CHECK(vkCreateDescriptorSetLayout(vk.device, &set1LayoutInfo, nullptr,
         &app.descriptorSetLayouts[1]));
 
-    // Set 2: float[2] normals[] (per instance)
-    //   Binding 0-N, where N = mesh count
-
     VK_CHECK(vkCreateDescriptorSetLayout(vk.device, &set1LayoutInfo, nullptr,
         &app.descriptorSetLayouts[2]));
 
-
-    // Set 3: float[2] uvsArray[] (per instance)
-    //   Binding 0-N, where N = mesh count
-
-    VK_CHECK(vkCreateDescriptorSetLayout(vk.device, &set1LayoutInfo, nullptr,
-        &app.descriptorSetLayouts[3]));
-
-    // Set 4: uint indicesArrays[] (per instance)
-    //   Binding 0-N, where N = mesh count
-
-    VK_CHECK(vkCreateDescriptorSetLayout(vk.device, &set1LayoutInfo, nullptr,
-        &app.descriptorSetLayouts[4]));
-
-    // Set 5:
+    // Set 3:
     //   Binding 0: linear sampler
     //   Binding 1: texture2d Textures[]
 
@@ -464,18 +477,18 @@ void createDescriptorSetLayouts()
     baseColorTexturesBinding.descriptorCount = (uint32_t)app.scene.baseColorTextureInfos.size();
     baseColorTexturesBinding.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
 
-    VkDescriptorSetLayoutBinding set4Bindings[] = {
+    VkDescriptorSetLayoutBinding set3Bindings[] = {
         linearSamplerBinding,
         baseColorTexturesBinding
     };
 
-    VkDescriptorSetLayoutCreateInfo set4LayoutInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-    set4LayoutInfo.flags = 0;
-    set4LayoutInfo.bindingCount = (uint32_t)std::size(set4Bindings);
-    set4LayoutInfo.pBindings = set4Bindings;
+    VkDescriptorSetLayoutCreateInfo set3LayoutInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+    set3LayoutInfo.flags = 0;
+    set3LayoutInfo.bindingCount = (uint32_t)std::size(set3Bindings);
+    set3LayoutInfo.pBindings = set3Bindings;
 
-    VK_CHECK(vkCreateDescriptorSetLayout(vk.device, &set4LayoutInfo, nullptr,
-        &app.descriptorSetLayouts[5]));
+    VK_CHECK(vkCreateDescriptorSetLayout(vk.device, &set3LayoutInfo, nullptr,
+        &app.descriptorSetLayouts[3]));
 }
 
 void createRaytracingPipeline()
@@ -606,8 +619,6 @@ void createShaderBindingTable()
 
 void createDescriptorSets()
 {
-    uint32_t meshCount = (uint32_t)app.scene.meshes.size();
-
     app.descriptorSets.resize(app.descriptorSetLayouts.size());
 
     std::vector<VkDescriptorPoolSize> poolSizes = {
@@ -618,14 +629,10 @@ void createDescriptorSets()
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }, // MeshInstanceData[]
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }, // Material[]
         // set 1
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, meshCount }, // positions
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }, // vertices
         // set 2
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, meshCount }, // normals
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }, // indices
         // set 3
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, meshCount }, // uvs
-        // set 4
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, meshCount }, // indices
-        // set 5
         { VK_DESCRIPTOR_TYPE_SAMPLER, 1 },  // linear sampler
         { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
             (uint32_t)app.scene.baseColorTextureInfos.size() }, // baseColorTextures[]
@@ -638,22 +645,7 @@ void createDescriptorSets()
 
     VK_CHECK(vkCreateDescriptorPool(vk.device, &descPoolCreateInfo, nullptr, &app.descriptorPool));
 
-    std::vector<uint32_t> variableDescriptorCounts = {
-        1, // set 0
-        meshCount, // set 1: positions
-        meshCount, // set 2: normals
-        meshCount, // set 3: uvs
-        meshCount, // set 4: indices
-        1, // set 5 sampler/textures
-    };
-
-    VkDescriptorSetVariableDescriptorCountAllocateInfoEXT variableDescriptorCountInfo = {};
-    variableDescriptorCountInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
-    variableDescriptorCountInfo.descriptorSetCount = (uint32_t)std::size(variableDescriptorCounts);
-    variableDescriptorCountInfo.pDescriptorCounts = variableDescriptorCounts.data();
-
     VkDescriptorSetAllocateInfo descSetAllocInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-    descSetAllocInfo.pNext = &variableDescriptorCountInfo;
     descSetAllocInfo.descriptorPool = app.descriptorPool;
     descSetAllocInfo.descriptorSetCount = (uint32_t)app.descriptorSetLayouts.size();
     descSetAllocInfo.pSetLayouts = app.descriptorSetLayouts.data();
@@ -729,41 +721,33 @@ void createDescriptorSets()
     materialBufferWrite.pBufferInfo = &materialBufferInfo;
     materialBufferWrite.pTexelBufferView = nullptr;
 
-    VkWriteDescriptorSet positionsBufferWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-    positionsBufferWrite.dstSet = app.descriptorSets[1];
-    positionsBufferWrite.dstBinding = 0;
-    positionsBufferWrite.descriptorCount = meshCount;
-    positionsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    positionsBufferWrite.pImageInfo = nullptr;
-    positionsBufferWrite.pBufferInfo = app.scene.positionsBufferInfos.data();
-    positionsBufferWrite.pTexelBufferView = nullptr;
-
-    VkWriteDescriptorSet normalsBufferWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-    normalsBufferWrite.dstSet = app.descriptorSets[2];
-    normalsBufferWrite.dstBinding = 0;
-    normalsBufferWrite.descriptorCount = meshCount;
-    normalsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    normalsBufferWrite.pImageInfo = nullptr;
-    normalsBufferWrite.pBufferInfo = app.scene.normalsBufferInfos.data();
-    normalsBufferWrite.pTexelBufferView = nullptr;
-
-    VkWriteDescriptorSet uvsBufferWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-    uvsBufferWrite.dstSet = app.descriptorSets[3];
-    uvsBufferWrite.dstBinding = 0;
-    uvsBufferWrite.descriptorCount = meshCount;
-    uvsBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    uvsBufferWrite.pImageInfo = nullptr;
-    uvsBufferWrite.pBufferInfo = app.scene.uvsBufferInfos.data();
-    uvsBufferWrite.pTexelBufferView = nullptr;
-
-    VkWriteDescriptorSet indicesBufferWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-    indicesBufferWrite.dstSet = app.descriptorSets[4];
-    indicesBufferWrite.dstBinding = 0;
-    indicesBufferWrite.descriptorCount = meshCount;
-    indicesBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    indicesBufferWrite.pImageInfo = nullptr;
-    indicesBufferWrite.pBufferInfo = app.scene.indicesBufferInfos.data();
-    indicesBufferWrite.pTexelBufferView = nullptr;
+    VkDescriptorBufferInfo vertexBufferInfo = {};
+    vertexBufferInfo.buffer = app.scene.vertexBuffer.buffer;
+    vertexBufferInfo.offset = 0;
+    vertexBufferInfo.range = app.scene.vertexBuffer.size;
+
+    VkWriteDescriptorSet vertexBufferWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    vertexBufferWrite.dstSet = app.descriptorSets[1];
+    vertexBufferWrite.dstBinding = 0;
+    vertexBufferWrite.descriptorCount = 1;
+    vertexBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    vertexBufferWrite.pImageInfo = nullptr;
+    vertexBufferWrite.pBufferInfo = &vertexBufferInfo;
+    vertexBufferWrite.pTexelBufferView = nullptr;
+
+    VkDescriptorBufferInfo indexBufferInfo = {};
+    indexBufferInfo.buffer = app.scene.indexBuffer.buffer;
+    indexBufferInfo.offset = 0;
+    indexBufferInfo.range = app.scene.indexBuffer.size;
+
+    VkWriteDescriptorSet indexBufferWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+    indexBufferWrite.dstSet = app.descriptorSets[2];
+    indexBufferWrite.dstBinding = 0;
+    indexBufferWrite.descriptorCount = 1;
+    indexBufferWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    indexBufferWrite.pImageInfo = nullptr;
+    indexBufferWrite.pBufferInfo = &indexBufferInfo;
+    indexBufferWrite.pTexelBufferView = nullptr;
 
     std::vector<VkWriteDescriptorSet> descriptorWrites = {
         accelStructWrite,
@@ -771,17 +755,15 @@ void createDescriptorSets()
         camdataBufferWrite,
         meshInstanceDataBufferWrite,
         materialBufferWrite,
-        positionsBufferWrite,
-        normalsBufferWrite,
-        uvsBufferWrite,
-        indicesBufferWrite
+        vertexBufferWrite,
+        indexBufferWrite
     };
 
     VkDescriptorImageInfo linearSamplerImageInfo = {};
     linearSamplerImageInfo.sampler = app.scene.linearSampler;
 
     VkWriteDescriptorSet samplerWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-    samplerWrite.dstSet = app.descriptorSets[5];
+    samplerWrite.dstSet = app.descriptorSets[3];
     samplerWrite.dstBinding = 0;
     samplerWrite.descriptorCount = 1;
     samplerWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
@@ -790,7 +772,7 @@ void createDescriptorSets()
     samplerWrite.pTexelBufferView = nullptr;
 
     VkWriteDescriptorSet baseColorTexturesWrite = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-    baseColorTexturesWrite.dstSet = app.descriptorSets[5];
+    baseColorTexturesWrite.dstSet = app.descriptorSets[3];
     baseColorTexturesWrite.dstBinding = 1;
     baseColorTexturesWrite.descriptorCount = (uint32_t)app.scene.baseColorTextureInfos.size();
     baseColorTexturesWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
@@ -926,6 +908,15 @@ void fillCommandBuffers()
 
 }
 
+CameraUniformData getCameraUniformData(const Camera& cam)
+{
+    CameraUniformData camData;
+    camData.viewInverse = glm::inverse(cam.view);
+    camData.projInverse = glm::inverse(cam.projection);
+
+    return camData;
+}
+
 void updateCamera(const float dt)
 {
     Camera& cam = app.scene.camera;
@@ -948,9 +939,7 @@ void updateCamera(const float dt)
     cameraUpdateView(cam);
 
 
-    CameraUniformData camData;
-    camData.viewInverse = glm::inverse(app.scene.camera.view);
-    camData.projInverse = glm::inverse(app.scene.camera.projection);
+    CameraUniformData camData = getCameraUniformData(cam);
 
     void* mem = nullptr;
     VK_CHECK(vkMapMemory(vk.device, app.scene.cameraBuffer.memory, 0, app.scene.cameraBuffer.size, 0, &mem));
@@ -960,20 +949,409 @@ void updateCamera(const float dt)
     vkUnmapMemory(vk.device, app.scene.cameraBuffer.memory);
 }
 
+// Load imbalance of the last frame: reflection and refraction tiles cost
+// far more than sky tiles.
+void printThreadStats(const RaytracerCpu& rt, bool perThread)
+{
+    double minMs = DBL_MAX;
+    double maxMs = 0.;
+    double totalMs = 0.;
+    uint32_t steals = 0;
+
+    uint32_t threadCount = (uint32_t)rt.threadJobStats.size();
+
+    for (uint32_t i = 0; i < threadCount; i++)
+    {
+        const JobThreadStats& jobStats = rt.threadJobStats[i];
+        const RaytracerCpuStats& stats = rt.threadStats[i];
+
+        minMs = std::min(minMs, jobStats.busyMs);
+        maxMs = std::max(maxMs, jobStats.busyMs);
+        totalMs += jobStats.busyMs;
+        steals += jobStats.stealCount;
+
+        if (perThread)
+        {
+            printf("  thread %2u: %4u jobs, %3u steals, %8.2f ms busy, rays: %llu primary, %llu secondary, %llu shadow\n",
+                i, jobStats.jobCount, jobStats.stealCount, jobStats.busyMs,
+                stats.primaryRays, stats.secondaryRays, stats.shadowRays);
+        }
+    }
+
+    double avgMs = totalMs / threadCount;
+
+    printf("  threads: busy min %.2f avg %.2f max %.2f ms, imbalance %.2fx, %u steals\n",
+        minMs, avgMs, maxMs, avgMs > 0. ? maxMs / avgMs : 1., steals);
+}
 
-int main()
+// Moves every node a little further along a circle in the xz plane
+static void animateNodes(Scene& scene, uint32_t frame)
 {
-    if (!initApp())
+    for (size_t i = 0; i < scene.nodes.size(); i++)
+    {
+        SceneNode& node = scene.nodes[i];
+
+        float angle = 0.3f * frame + (float)i;
+        glm::vec3 step = 0.05f * glm::vec3(cosf(angle), 0.f, sinf(angle));
+
+        if (node.matrixValid)
+            node.matrix[3] += glm::vec4(step, 0.f);
+        else
+            node.translation += step;
+    }
+}
+
+// No window or Vulkan device: render with the CPU raytracer and write the
+// result to an image file.
+int runHeadless(const CommandLineOptions& options)
+{
+    setDebugPrintToStdout(true);
+
+    setupDefaultCamera();
+
+    JobSystem jobSystem;
+    createJobSystem({ options.threads }, &jobSystem);
+
+    bool res = loadGltfFile(vk, options.sceneFilename,
+        { &jobSystem, options.streamGltf, options.compactVertices }, &app.scene);
+
+    if (!res)
+    {
+        fprintf(stderr, "Error: unable to load %s\n", options.sceneFilename);
+        destroyJobSystem(jobSystem);
+        return 1;
+    }
+
+    RaytracerCpu rt;
+    res = createRaytracerCpu({ &app.scene, &jobSystem, kWindowWidth, kWindowHeight,
+        !options.noPackets, options.tileOrder, options.wavefront, options.sortRays,
+        options.bvhWidth, options.quantizeBvh, options.bvhBuildMode,
+        options.sbvhSplitBudget, (size_t)options.sbvhMemoryMB << 20, nullptr, options.bvhCacheDirectory,
+        options.triangleRecords }, &rt);
+
+    if (!res)
+    {
+        fprintf(stderr, "Error: unable to create the CPU raytracer\n");
+        destroyJobSystem(jobSystem);
+        unmapFile(app.scene.cookedFile);
+        unmapFile(app.scene.glbFile);
+        return 1;
+    }
+
+    CameraUniformData camData = getCameraUniformData(app.scene.camera);
+
+    printf("CPU raytracer: %s, %ux%u, %u threads\n", options.sceneFilename,
+        kWindowWidth, kWindowHeight, jobSystem.threadCount);
+
+    double totalTimeMs = 0.;
+    uint64_t totalRays = 0;
+
+    for (uint32_t i = 0; i < options.frames; i++)
+    {
+        if (options.animate && i > 0)
+        {
+            animateNodes(app.scene, i);
+
+            RaytracerCpuUpdateStats updateStats;
+            if (!updateRaytracerCpu(rt, { nullptr, 0, true, 0.f }, &updateStats))
+            {
+                fprintf(stderr, "Error: unable to update the CPU raytracer for frame %u\n", i);
+                destroyRaytracerCpu(rt);
+                destroyJobSystem(jobSystem);
+                unmapFile(app.scene.cookedFile);
+                unmapFile(app.scene.glbFile);
+                return 1;
+            }
+
+            printf("update: %.3f ms, TLAS SAH %.2f (%.2fx build)%s\n", updateStats.timeMs,
+                updateStats.tlasSahCost, updateStats.tlasSahCost / updateStats.tlasBuiltSahCost,
+                updateStats.tlasRebuilt ? ", rebuilt" : "");
+        }
+
+        renderFrameCpu(rt, camData);
+
+        const RaytracerCpuStats& stats = rt.stats;
+        uint64_t rays = stats.primaryRays + stats.secondaryRays + stats.shadowRays;
+
+        printf("frame %u: %.2f ms, rays: %llu primary, %llu secondary, %llu shadow, %.2f Mrays/s\n",
+            i, stats.frameTimeMs, stats.primaryRays, stats.secondaryRays, stats.shadowRays,
+            rays / (stats.frameTimeMs * 1000.));
+
+        if (stats.primaryPackets + stats.packetFallbacks > 0)
+        {
+            printf("  packets: %llu traced, %llu fell back to single rays\n",
+                stats.primaryPackets, stats.packetFallbacks);
+        }
+
+        if (rt.wavefront)
+        {
+            for (int stage = 0; stage < kMaxDepth && stats.stageRays[stage] > 0; stage++)
+            {
+                printf("  bounce %d: %8llu rays, %8.2f ms, %.2f Mrays/s\n", stage,
+                    stats.stageRays[stage], stats.stageTimeMs[stage],
+                    stats.stageRays[stage] / (stats.stageTimeMs[stage] * 1000.));
+            }
+
+            printf("  shadow: %8llu rays, %8.2f ms\n", stats.shadowRays, stats.stageTimeMs[kMaxDepth]);
+
+            if (stats.sortedRays > 0)
+            {
+                printf("  sort: %llu rays into %llu bins (%.1f rays per bin), %.2f ms\n",
+                    stats.sortedRays, stats.sortBins, (double)stats.sortedRays / stats.sortBins,
+                    stats.sortTimeMs);
+            }
+        }
+
+        printThreadStats(rt, options.threadStats);
+
+        totalTimeMs += stats.frameTimeMs;
+        totalRays += rays;
+    }
+
+    printf("average: %.2f ms, %.2f Mrays/s (%.2f Mrays/s per thread)\n",
+        totalTimeMs / options.frames, totalRays / (totalTimeMs * 1000.),
+        totalRays / (totalTimeMs * 1000.) / jobSystem.threadCount);
+
+    writeImageCpu(rt, options.outputFilename);
+
+    destroyRaytracerCpu(rt);
+    destroyJobSystem(jobSystem);
+
+    unmapFile(app.scene.cookedFile);
+    unmapFile(app.scene.glbFile);
+
+    return 0;
+}
+
+// Loads the scene without a device and writes it as a cooked scene, see
+// CookedScene.h
+int cookScene(const CommandLineOptions& options)
+{
+    setDebugPrintToStdout(true);
+
+    setupDefaultCamera();
+
+    JobSystem jobSystem;
+    createJobSystem({ options.threads }, &jobSystem);
+
+    bool res = loadGltfFile(vk, options.sceneFilename,
+        { &jobSystem, options.streamGltf, options.compactVertices }, &app.scene);
+
+    destroyJobSystem(jobSystem);
+
+    if (!res)
+    {
+        fprintf(stderr, "Error: unable to load %s\n", options.sceneFilename);
+        return 1;
+    }
+
+    res = writeCookedScene(options.cookFilename, app.scene);
+
+    unmapFile(app.scene.cookedFile);
+    unmapFile(app.scene.glbFile);
+
+    return res ? 0 : 1;
+}
+
+int runBenchmark(const CommandLineOptions& options)
+{
+    setDebugPrintToStdout(true);
+
+    if (strcmp(options.benchmark, "base64") == 0)
+    {
+        benchmarkBase64(options.sceneFilename);
+        return 0;
+    }
+
+    JobSystem jobSystem;
+    createJobSystem({ options.threads }, &jobSystem);
+
+    int ret = 0;
+
+    // Loads the scene itself
+    if (strcmp(options.benchmark, "load") == 0)
+    {
+        benchmarkSceneLoad(options.sceneFilename, jobSystem);
+    }
+    else if (strcmp(options.benchmark, "parse") == 0)
+    {
+        benchmarkGltfParse(options.sceneFilename, jobSystem);
+    }
+    else if (!loadGltfFile(vk, options.sceneFilename,
+        { &jobSystem, options.streamGltf, options.compactVertices }, &app.scene))
+    {
+        fprintf(stderr, "Error: unable to load %s\n", options.sceneFilename);
+        ret = 1;
+    }
+    else if (strcmp(options.benchmark, "triangles") == 0)
+    {
+        benchmarkTriangleKernels(app.scene);
+    }
+    else if (strcmp(options.benchmark, "wide") == 0)
+    {
+        benchmarkWideBvh(app.scene);
+    }
+    else if (strcmp(options.benchmark, "refit") == 0)
+    {
+        benchmarkBvhRefit(app.scene);
+    }
+    else if (strcmp(options.benchmark, "build") == 0)
+    {
+        benchmarkBvhBuild(app.scene, jobSystem);
+    }
+    else
+    {
+        fprintf(stderr, "Error: unknown benchmark %s\n", options.benchmark);
+        ret = 1;
+    }
+
+    destroyJobSystem(jobSystem);
+
+    unmapFile(app.scene.cookedFile);
+    unmapFile(app.scene.glbFile);
+
+    return ret;
+}
+
+// False on a usage error, which has been printed
+bool parseCommandLine(int argc, char** argv, CommandLineOptions* pOptions)
+{
+    CommandLineOptions options = {};
+    options.frames = 1;
+    options.sceneFilename = kDefaultSceneFilename;
+    options.outputFilename = "output-cpu.png";
+    options.tileOrder = TILE_ORDER_HILBERT;
+    options.bvhWidth = 2;
+
+    for (int i = 1; i < argc; i++)
     {
-        fprintf(stderr, "Error: unable to initialize Vulkan\n");
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (strcmp(arg, "--cpu") == 0)
+            options.cpu = true;
+        else if (strcmp(arg, "--frames") == 0 && value)
+            options.frames = std::max(1, atoi(argv[++i]));
+        else if (strcmp(arg, "--no-packets") == 0)
+            options.noPackets = true;
+        else if (strcmp(arg, "--wavefront") == 0)
+            options.wavefront = true;
+        else if (strcmp(arg, "--sort-rays") == 0)
+            options.sortRays = true;
+        else if (strcmp(arg, "--bvh-width") == 0 && value)
+        {
+            int width = atoi(argv[++i]);
+
+            if (width != 2 && width != 4 && width != 8)
+            {
+                fprintf(stderr, "Error: --bvh-width must be 2, 4 or 8, not %s\n", argv[i]);
+                return false;
+            }
+
+            options.bvhWidth = (uint32_t)width;
+        }
+        else if (strcmp(arg, "--quantize-bvh") == 0)
+            options.quantizeBvh = true;
+        else if (strcmp(arg, "--bvh-build") == 0 && value)
+        {
+            const char* mode = argv[++i];
+
+            if (strcmp(mode, "sah") == 0)
+                options.bvhBuildMode = BVH_BUILD_BINNED_SAH;
+            else if (strcmp(mode, "lbvh") == 0)
+                options.bvhBuildMode = BVH_BUILD_LBVH;
+            else if (strcmp(mode, "lbvh-sah") == 0)
+                options.bvhBuildMode = BVH_BUILD_LBVH_SAH;
+            else if (strcmp(mode, "sbvh") == 0)
+                options.bvhBuildMode = BVH_BUILD_SBVH;
+            else
+            {
+                fprintf(stderr, "Error: --bvh-build must be sah, lbvh, lbvh-sah or sbvh, not %s\n", mode);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--bvh-cache") == 0 && value)
+            options.bvhCacheDirectory = argv[++i];
+        else if (strcmp(arg, "--triangle-records") == 0)
+            options.triangleRecords = true;
+        else if (strcmp(arg, "--animate") == 0)
+            options.animate = true;
+        else if (strcmp(arg, "--sbvh-budget") == 0 && value)
+            options.sbvhSplitBudget = (float)atof(argv[++i]);
+        else if (strcmp(arg, "--sbvh-memory") == 0 && value)
+            options.sbvhMemoryMB = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(arg, "--thread-stats") == 0)
+            options.threadStats = true;
+        else if (strcmp(arg, "--tile-order") == 0 && value)
+        {
+            const char* order = argv[++i];
+
+            if (strcmp(order, "rows") == 0)
+                options.tileOrder = TILE_ORDER_ROWS;
+            else if (strcmp(order, "morton") == 0)
+                options.tileOrder = TILE_ORDER_MORTON;
+            else if (strcmp(order, "hilbert") == 0)
+                options.tileOrder = TILE_ORDER_HILBERT;
+            else
+            {
+                fprintf(stderr, "Error: --tile-order must be rows, morton or hilbert, not %s\n", order);
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--threads") == 0 && value)
+            options.threads = (uint32_t)std::max(0, atoi(argv[++i]));
+        else if (strcmp(arg, "--scene") == 0 && value)
+            options.sceneFilename = argv[++i];
+        else if (strcmp(arg, "--output") == 0 && value)
+            options.outputFilename = argv[++i];
+        else if (strcmp(arg, "--benchmark") == 0 && value)
+            options.benchmark = argv[++i];
+        else if (strcmp(arg, "--export-glb") == 0 && value)
+            options.exportGlbFilename = argv[++i];
+        else if (strcmp(arg, "--stream-gltf") == 0)
+            options.streamGltf = true;
+        else if (strcmp(arg, "--cook") == 0 && value)
+            options.cookFilename = argv[++i];
+        else if (strcmp(arg, "--compact-vertices") == 0)
+            options.compactVertices = true;
+        else
+            fprintf(stderr, "Warning: unknown argument %s\n", arg);
+    }
+
+    *pOptions = options;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    CommandLineOptions options;
+
+    if (!parseCommandLine(argc, argv, &options))
         return 1;
+
+    if (options.exportGlbFilename)
+        return writeGlbFile(options.sceneFilename, options.exportGlbFilename) ? 0 : 1;
+
+    if (options.cookFilename)
+        return cookScene(options);
+
+    if (options.benchmark)
+        return runBenchmark(options);
+
+    if (options.cpu)
+        return runHeadless(options);
+
+    if (!initApp())
+    {
+        fprintf(stderr, "Error: unable to initialize Vulkan, falling back to the CPU raytracer\n");
+        return runHeadless(options);
     }
 
     setupDefaultCamera();
 
     createFallbackTextures();
 
-    createScene();
+    createScene(options);
 
     createSamplers();
     createDescriptorSetLayouts();
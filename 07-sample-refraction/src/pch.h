@@ -8,14 +8,28 @@
 #include <array>
 #include <vector>
 #include <algorithm>
+#include <filesystem>
 #include <fstream>
 #include <string>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <unordered_map>
+
+#include <intrin.h>
+#include <immintrin.h>
 
 #pragma warning(push)
 #pragma warning(disable: 26812)
 #include <volk.h>
 #pragma warning(pop)
 
+#include <psapi.h> // GetProcessMemoryInfo, after windows.h
+
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
@@ -29,5 +43,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
+#include <glm/packing.hpp>
 
 #include <tiny_gltf.h>
+#include <json.hpp>     // bundled with tinygltf
+#include <stb_image.h> // bundled with tinygltf